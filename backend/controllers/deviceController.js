@@ -1,43 +1,41 @@
 
 const Device = require('../models/Device');
 const { logger } = require('../middleware/logger');
-// Per-device command sequence for strict ordering to devices
+const crypto = require('crypto');
+const commandPipeline = require('../utils/commandPipeline');
+// Per-device command sequence for strict ordering to devices. The device also uses it as
+// the command id for switch_result and its duplicate filter, so each process starts
+// from a random base instead of 1: ids from before a backend restart do not collide.
 const _cmdSeqMap = new Map(); // mac -> last seq
+const _cmdSeqBase = crypto.randomInt(1, 0x40000000);
 function nextCmdSeq(mac) {
   if (!mac) return 0;
   const key = mac.toUpperCase();
-  const prev = _cmdSeqMap.get(key) || 0;
-  const next = prev + 1;
+  const prev = _cmdSeqMap.get(key) || _cmdSeqBase;
+  const next = prev >= 0xFFFFFFF0 ? 1 : prev + 1; // the device keeps ids as uint32
   _cmdSeqMap.set(key, next);
   return next;
 }
-const crypto = require('crypto');
 const ActivityLog = require('../models/ActivityLog');
 const SecurityAlert = require('../models/SecurityAlert');
 // Access io via req.app.get('io') where needed instead of legacy socketService
 
-// Small helper to stagger hardware commands to avoid MCU/relay glitches under burst load
-function sendStaggeredCommands(ws, mac, payloads, io, deviceId, baseDelayMs = 40) {
+// Bulk hardware commands go through the per-device pipeline: a few in flight, the rest
+// released as the device acks them with switch_result (utils/commandPipeline.js)
+function sendPipelinedCommands(ws, mac, payloads, io, deviceId) {
   if (!ws || ws.readyState !== 1) return;
-  payloads.forEach((payload, idx) => {
-    setTimeout(() => {
-      try {
-        ws.send(JSON.stringify(payload));
-        if (io && deviceId) {
-          io.emit('bulk_switch_progress', {
-            deviceId,
-            mac,
-            gpio: payload.gpio,
-            desiredState: payload.state,
-            seq: payload.seq,
-            ts: Date.now()
-          });
-        }
-      } catch (e) {
-        try { logger.warn('[hw] sendStaggeredCommands send failed', { mac, err: e.message }); } catch {}
-      }
-    }, idx * baseDelayMs);
-  });
+  const onSent = (payload) => {
+    if (!io || !deviceId) return;
+    io.emit('bulk_switch_progress', {
+      deviceId,
+      mac,
+      gpio: payload.gpio,
+      desiredState: payload.state,
+      seq: payload.seq,
+      ts: Date.now()
+    });
+  };
+  payloads.forEach((payload) => commandPipeline.send(ws, payload, onSent));
 }
 
 const getAllDevices = async (req, res) => {
@@ -551,7 +549,7 @@ const toggleSwitch = async (req, res) => {
             try {
               logger.info('[hw] switch_command push', { mac: updated.macAddress, gpio: payload.gpio, state: payload.state, deviceId: updated._id.toString(), switchId });
             } catch {}
-            ws.send(JSON.stringify(payload));
+            commandPipeline.send(ws, payload);
             dispatchedToHardware = true;
             hwReason = 'sent';
           } else {
@@ -692,6 +690,43 @@ const deleteDevice = async (req, res) => {
   }
 };
 
+// Start an OTA update on a connected device. Body: { url, sha256, size?, version?, sig?, delta? }.
+// url must be https; sha256 (and sig, DER ECDSA over it) cover the resulting image.
+// delta: true sends an ODP1 patch (scripts/makeOtaDelta.js) against the build the device
+// reported at auth; the device refuses it if that is not what it runs.
+const startOtaUpdate = async (req, res) => {
+  try {
+    const { url, sha256, size, version, sig, delta } = req.body || {};
+    const hex = (v, n) => typeof v === 'string' && /^[0-9a-fA-F]*$/.test(v) && v.length % 2 === 0 && (!n || v.length === n);
+    if (typeof url !== 'string' || !url.startsWith('https://')) {
+      return res.status(400).json({ message: 'https url required' });
+    }
+    if (!hex(sha256, 64)) return res.status(400).json({ message: 'sha256 (64 hex chars) required' });
+    if (sig !== undefined && !hex(sig)) return res.status(400).json({ message: 'sig must be hex' });
+    if (delta && !(Number.isInteger(size) && size > 0)) {
+      return res.status(400).json({ message: 'size of the resulting image required for a delta' });
+    }
+
+    const device = await Device.findById(req.params.deviceId);
+    if (!device) return res.status(404).json({ message: 'Device not found' });
+    const ws = global.wsDevices && device.macAddress ? global.wsDevices.get(device.macAddress.toUpperCase()) : null;
+    if (!ws || ws.readyState !== 1) return res.status(409).json({ message: 'Device not connected' });
+    if (delta && !ws.build) return res.status(409).json({ message: 'Device did not report its build' });
+
+    const payload = { type: 'ota_update', url, sha256: sha256.toLowerCase() };
+    if (Number.isInteger(size)) payload.size = size;
+    if (version) payload.version = String(version).slice(0, 31);
+    if (sig) payload.sig = sig.toLowerCase();
+    if (delta) payload.delta = { base: ws.build };
+    ws.send(JSON.stringify(payload));
+    logger.info('[ota] update sent', { mac: device.macAddress, version: payload.version, delta: !!delta, from: ws.fw, by: req.user && req.user.id });
+
+    res.status(202).json({ success: true, message: 'OTA update sent; progress follows as device_ota_status', from: ws.fw, build: ws.build });
+  } catch (error) {
+    res.status(500).json({ message: 'Server error', error: error.message });
+  }
+};
+
 // Bulk toggle all switches (or all accessible devices for non-admin roles)
 const bulkToggleSwitches = async (req, res) => {
   try {
@@ -739,7 +774,7 @@ const bulkToggleSwitches = async (req, res) => {
         }
         // NOTE: Do NOT emit device_state_changed here. We'll wait for ESP32 confirmations
         // via switch_result/state_update to avoid UI desync.
-        // Push commands to ESP32 (raw WS) with slight staggering to avoid glitches
+        // Push commands to ESP32 (raw WS), pipelined on switch_result acks
         try {
           if (global.wsDevices && device.macAddress) {
             const ws = global.wsDevices.get(device.macAddress.toUpperCase());
@@ -751,8 +786,8 @@ const bulkToggleSwitches = async (req, res) => {
                 state: sw.state,
                 seq: nextCmdSeq(device.macAddress)
               }));
-              try { logger.info('[hw] bulk switch_command (staggered)', { mac: device.macAddress, count: payloads.length }); } catch {}
-              sendStaggeredCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
+              try { logger.info('[hw] bulk switch_command (pipelined)', { mac: device.macAddress, count: payloads.length }); } catch {}
+              sendPipelinedCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
             }
           }
         } catch (e) {
@@ -818,7 +853,7 @@ const bulkToggleByType = async (req, res) => {
           });
         } catch {}
         // Do NOT emit device_state_changed here; wait for hardware confirmation
-        // Push commands to ESP32 (staggered) for type-based bulk
+        // Push commands to ESP32 (pipelined) for type-based bulk
         try {
           if (global.wsDevices && device.macAddress) {
             const ws = global.wsDevices.get(device.macAddress.toUpperCase());
@@ -827,7 +862,7 @@ const bulkToggleByType = async (req, res) => {
               const payloads = selected.map(sw => ({
                 type: 'switch_command', mac: device.macAddress, gpio: sw.relayGpio || sw.gpio, state: sw.state, seq: nextCmdSeq(device.macAddress)
               }));
-              sendStaggeredCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
+              sendPipelinedCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
             }
           }
         } catch (e) { if (process.env.NODE_ENV !== 'production') console.warn('[bulkToggleByType push failed]', e.message); }
@@ -881,7 +916,7 @@ const bulkToggleByLocation = async (req, res) => {
           });
         } catch {}
         // Do NOT emit device_state_changed here; wait for hardware confirmation
-        // Push commands to ESP32 (staggered) for location-based bulk
+        // Push commands to ESP32 (pipelined) for location-based bulk
         try {
           if (global.wsDevices && device.macAddress) {
             const ws = global.wsDevices.get(device.macAddress.toUpperCase());
@@ -889,7 +924,7 @@ const bulkToggleByLocation = async (req, res) => {
               const payloads = device.switches.map(sw => ({
                 type: 'switch_command', mac: device.macAddress, gpio: sw.relayGpio || sw.gpio, state: sw.state, seq: nextCmdSeq(device.macAddress)
               }));
-              sendStaggeredCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
+              sendPipelinedCommands(ws, device.macAddress, payloads, req.app.get('io'), device._id.toString());
             }
           }
         } catch (e) { if (process.env.NODE_ENV !== 'production') console.warn('[bulkToggleByLocation push failed]', e.message); }
@@ -916,4 +951,5 @@ module.exports = {
   bulkToggleSwitches
   ,bulkToggleByType
   ,bulkToggleByLocation
+  ,startOtaUpdate
 };
@@ -34,7 +34,8 @@ const activityLogSchema = new mongoose.Schema({
   ip: String,
   userAgent: String,
   duration: Number,
-  powerConsumption: Number
+  powerConsumption: Number,
+  journalKey: String  // mac:boot:up:kind:idx of a replayed device journal record
 }, {
   timestamps: false
 });
@@ -42,5 +43,6 @@ const activityLogSchema = new mongoose.Schema({
 activityLogSchema.index({ deviceId: 1, timestamp: -1 });
 activityLogSchema.index({ userId: 1, timestamp: -1 });
 activityLogSchema.index({ classroom: 1, timestamp: -1 });
+activityLogSchema.index({ journalKey: 1 }, { unique: true, sparse: true });
 
 module.exports = mongoose.model('ActivityLog', activityLogSchema);
@@ -10,7 +10,8 @@ const {
   getDeviceStats,
   updateDevice,
   deleteDevice,
-  getDeviceById
+  getDeviceById,
+  startOtaUpdate
 } = require('../controllers/deviceController');
 
 const router = express.Router();
@@ -51,6 +52,7 @@ router.get('/stats', getDeviceStats);
 router.get('/:deviceId', checkDeviceAccess, getDeviceById);
 router.put('/:deviceId', authorize('admin', 'faculty'), checkDeviceAccess, validateDevice, updateDevice);
 router.delete('/:deviceId', authorize('admin'), checkDeviceAccess, deleteDevice);
+router.post('/:deviceId/ota', authorize('admin'), checkDeviceAccess, startOtaUpdate);
 
 // Switch operations
 router.post('/:deviceId/switches/:switchId/toggle', checkDeviceAccess, toggleSwitch);
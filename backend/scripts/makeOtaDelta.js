@@ -0,0 +1,102 @@
+// Usage: node scripts/makeOtaDelta.js old.bin new.bin [out.odp] [--key signing_key.pem]
+// Builds an ODP1 patch that turns the firmware image a device runs (old.bin, exactly as
+// flashed) into new.bin, and prints what POST /api/devices/:id/ota needs: the sha256 and
+// size of new.bin, the build (app_elf_sha256) the patch applies to and, with --key
+// (ECDSA P-256 private key), the signature for OTA_SIGNING_PUBKEY.
+//
+// ODP1: "ODP1" u32 size, then 0x01 COPY u32 src u32 len (from old.bin),
+// 0x02 DATA u32 len + bytes, 0xFF END. All little endian (see esp32/ota.h).
+// Matching is on BLOCK-byte blocks of old.bin found anywhere in new.bin, so code that
+// only moved is still copied; without --out only the summary is printed.
+
+const fs = require('fs');
+const crypto = require('crypto');
+
+const BLOCK = 64;
+const MIN_COPY = 32;            // shorter matches cost more as a COPY op than as data
+const APP_ELF_SHA256_AT = 176;  // image header (24) + segment header (8) + offset in esp_app_desc_t
+
+function u32(n) {
+  const b = Buffer.alloc(4);
+  b.writeUInt32LE(n >>> 0);
+  return b;
+}
+
+function makeDelta(oldImg, newImg) {
+  const index = new Map(); // block contents -> offset in old
+  for (let at = 0; at + BLOCK <= oldImg.length; at += BLOCK) {
+    const key = oldImg.toString('latin1', at, at + BLOCK);
+    if (!index.has(key)) index.set(key, at);
+  }
+
+  const out = [Buffer.from('ODP1', 'latin1'), u32(newImg.length)];
+  let copied = 0;
+  let pending = 0; // start of new bytes not covered yet
+  const flushData = (end) => {
+    if (end > pending) out.push(Buffer.from([0x02]), u32(end - pending), newImg.subarray(pending, end));
+  };
+
+  let pos = 0;
+  while (pos + BLOCK <= newImg.length) {
+    const src = index.get(newImg.toString('latin1', pos, pos + BLOCK));
+    if (src === undefined) {
+      pos++;
+      continue;
+    }
+    // Grow the match both ways
+    let start = pos, from = src;
+    while (start > pending && from > 0 && newImg[start - 1] === oldImg[from - 1]) { start--; from--; }
+    let end = pos + BLOCK, fromEnd = src + BLOCK;
+    while (end < newImg.length && fromEnd < oldImg.length && newImg[end] === oldImg[fromEnd]) { end++; fromEnd++; }
+    if (end - start < MIN_COPY) {
+      pos++;
+      continue;
+    }
+    flushData(start);
+    out.push(Buffer.from([0x01]), u32(from), u32(end - start));
+    copied += end - start;
+    pending = pos = end;
+  }
+  flushData(newImg.length);
+  out.push(Buffer.from([0xff]));
+  return { patch: Buffer.concat(out), copied };
+}
+
+function main() {
+  const args = process.argv.slice(2);
+  const keyAt = args.indexOf('--key');
+  const keyFile = keyAt >= 0 ? args.splice(keyAt, 2)[1] : null;
+  const [oldFile, newFile, outFile] = args;
+  if (!oldFile || !newFile) {
+    console.error('Usage: node scripts/makeOtaDelta.js old.bin new.bin [out.odp] [--key signing_key.pem]');
+    process.exit(1);
+  }
+  const oldImg = fs.readFileSync(oldFile);
+  const newImg = fs.readFileSync(newFile);
+  if (oldImg.length < APP_ELF_SHA256_AT + 32) {
+    console.error('old.bin is too short to be an ESP32 app image');
+    process.exit(2);
+  }
+
+  const { patch, copied } = makeDelta(oldImg, newImg);
+  if (outFile) fs.writeFileSync(outFile, patch);
+
+  const digest = crypto.createHash('sha256').update(newImg).digest();
+  const result = {
+    sha256: digest.toString('hex'),
+    size: newImg.length,
+    delta: true,
+    base: oldImg.subarray(APP_ELF_SHA256_AT, APP_ELF_SHA256_AT + 32).toString('hex'),
+    patchBytes: patch.length,
+    copiedBytes: copied
+  };
+  if (keyFile) {
+    // The device verifies the signature over the digest (mbedtls_pk_verify, SHA-256)
+    result.sig = crypto.sign('sha256', newImg, { key: fs.readFileSync(keyFile), dsaEncoding: 'der' }).toString('hex');
+  }
+  console.log(JSON.stringify(result, null, 2));
+}
+
+if (require.main === module) main();
+
+module.exports = { makeDelta };
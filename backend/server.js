@@ -9,6 +9,7 @@ const morgan = require('morgan');
 const rateLimit = require('express-rate-limit');
 const { authLimiter, apiLimiter } = require('./middleware/rateLimiter');
 const { logger } = require('./middleware/logger');
+const commandPipeline = require('./utils/commandPipeline');
 const routeMonitor = require('./middleware/routeMonitor');
 
 // Initialize error tracking
@@ -566,6 +567,28 @@ const pingInterval = setInterval(() => {
   });
 }, 30000);
 
+// Cadence the firmware keepalive should use (sent in auth_success): a ping or heartbeat
+// well inside the 35 s offline cutoff below, full heartbeats once a minute when idle
+const DEVICE_KEEPALIVE = { pingMs: 20000, heartbeatMs: 60000 };
+const BIN_PING = 0x07;
+
+// BinPing (esp32/binproto.h): telemetry in the payload of the device's keepalive pings
+function decodePingTelemetry(buf) {
+  if (buf.length < 24 || buf[0] !== 0xB1 || buf[1] !== 1 || buf[2] !== BIN_PING) return null;
+  return {
+    seq: buf.readUInt32LE(4),
+    uptime: buf.readUInt32LE(8),
+    rssi: buf.readInt8(12),
+    sleeping: !!(buf[13] & 0x01),
+    active: !!(buf[13] & 0x02),
+    heapKb: buf.readUInt16LE(14),
+    relays: buf.readUInt32LE(16),
+    rttMs: buf.readUInt16LE(20),
+    heartbeatS: buf.readUInt16LE(22),
+    ts: Date.now()
+  };
+}
+
 wss.on('connection', (ws) => {
   ws.isAlive = true;
   ws.on('pong', () => { ws.isAlive = true; });
@@ -575,7 +598,22 @@ wss.on('connection', (ws) => {
   
   // Set last activity timestamp
   ws.lastActivity = Date.now();
+
+  // Device pings stand in for heartbeats between the idle ones (ws sends the pong itself)
+  ws.on('ping', (buf) => {
+    ws.isAlive = true;
+    ws.lastActivity = Date.now();
+    const t = decodePingTelemetry(buf);
+    if (!t || !ws.mac) return;
+    ws.pingTelemetry = t;
+    if (Date.now() - (ws._pingSavedAt || 0) < 15000) return; // at most one DB write per 15 s
+    ws._pingSavedAt = Date.now();
+    const Device = require('./models/Device');
+    Device.updateOne({ macAddress: ws.mac }, { $set: { lastSeen: new Date(), status: 'online' } })
+      .catch(err => logger.error('[ping] lastSeen update failed', err.message));
+  });
   ws.on('message', async (msg) => {
+    ws.lastActivity = Date.now();
     let data;
     try { data = JSON.parse(msg.toString()); } catch { return; }
     const type = data.type;
@@ -610,13 +648,15 @@ wss.on('connection', (ws) => {
         // ✅ Auth success
         ws.mac = mac;
         ws.secret = device.deviceSecret;
+        ws.fw = data.fw;       // running firmware version
+        ws.build = data.build; // app_elf_sha256: base for delta OTA
         wsDevices.set(mac, ws);
 
         device.status = 'online';
         device.lastSeen = new Date();
         await device.save();
 
-        ws.send(JSON.stringify({ type: 'auth_success', mac }));
+        ws.send(JSON.stringify({ type: 'auth_success', mac, keepalive: DEVICE_KEEPALIVE }));
         logger.info(`[auth] Device ${mac} authenticated`);
 
         // Send minimal switch config back to ESP32
@@ -631,10 +671,19 @@ wss.on('connection', (ws) => {
           state: sw.state
         })) : [];
 
+        // PIR: the firmware switches the usePir relays and runs auto-off locally
+        const pirLinked = Array.isArray(device.switches)
+          ? device.switches.map((sw, i) => (sw.usePir ? i : -1)).filter(i => i >= 0)
+          : [];
+        const pir = device.pirEnabled && device.pirGpio !== undefined
+          ? [{ gpio: device.pirGpio, autoOff: device.pirAutoOffDelay ?? 30, linked: pirLinked }]
+          : [];
+
         ws.send(JSON.stringify({
           type: 'config_update',
           mac,
-          switches: switchConfig
+          switches: switchConfig,
+          pir
         }));
 
         try { io.emit('device_connected', { deviceId: device.id, mac }); } catch {}
@@ -661,6 +710,83 @@ wss.on('connection', (ws) => {
       } catch (e) { /* silent */ }
       return;
     }
+    if (type === 'ota_status') {
+      // Progress of an ota_update: downloading (every OTA_REPORT_PCT), then done or failed
+      const level = data.state === 'failed' ? 'warn' : 'info';
+      if (data.state !== 'downloading') logger[level]('[ota] status', { mac: ws.mac, state: data.state, version: data.version, reason: data.reason });
+      try {
+        const Device = require('./models/Device');
+        const device = await Device.findOne({ macAddress: ws.mac }).select('_id');
+        io.emit('device_ota_status', {
+          deviceId: device ? device.id : undefined,
+          mac: ws.mac,
+          state: data.state,
+          version: data.version,
+          written: data.written,
+          size: data.size,
+          reason: data.reason,
+          ts: Date.now()
+        });
+      } catch { }
+      return;
+    }
+    if (type === 'journal') {
+      // Offline backlog: [dUp, kind, idx, state], kind 0 relay / 1 manual switch / 2 PIR.
+      // Ack first so the device sends the next batch while this one is stored.
+      ws.send(JSON.stringify({ type: 'journal_ack', seq: data.seq }));
+      try {
+        const Device = require('./models/Device');
+        const ActivityLog = require('./models/ActivityLog');
+        const device = await Device.findOne({ macAddress: ws.mac });
+        if (!device || !Array.isArray(data.events)) return;
+        // up is the device clock at epoch (or now, when it had no time yet)
+        const base = data.epoch ? data.epoch * 1000 : Date.now();
+        let up = data.up || 0;
+        const logs = [];
+        for (const [dUp, kind, idx, state] of data.events) {
+          up += dUp;
+          const sw = device.switches[idx];
+          if (kind === 2 || !sw) continue;
+          logs.push({
+            // Batches are resent after a lost ack or a reconnect: one entry per record
+            journalKey: `${ws.mac}:${data.boot}:${up}:${kind}:${idx}`,
+            deviceId: device._id,
+            deviceName: device.name,
+            switchId: sw._id?.toString(),
+            switchName: sw.name,
+            action: state ? 'on' : 'off',
+            triggeredBy: kind === 1 ? 'user' : 'system',
+            classroom: device.classroom,
+            location: device.location,
+            timestamp: new Date(base - ((data.up || 0) - up))
+          });
+        }
+        if (logs.length) {
+          await ActivityLog.bulkWrite(logs.map((log) => ({
+            updateOne: { filter: { journalKey: log.journalKey }, update: { $setOnInsert: log }, upsert: true }
+          })), { ordered: false });
+        }
+      } catch (e) {
+        logger.error('[esp32 journal] error', e.message);
+      }
+      return;
+    }
+    if (type === 'occupancy') {
+      // Aggregated occupied/vacant transitions (rate limited on the device)
+      try {
+        const Device = require('./models/Device');
+        const device = await Device.findOne({ macAddress: ws.mac });
+        if (device) {
+          if (data.occupied) device.pirSensorLastTriggered = new Date();
+          device.lastSeen = new Date();
+          await device.save();
+          io.emit('device_occupancy', { deviceId: device.id, occupied: !!data.occupied, sensors: data.sensors || [], ts: Date.now() });
+        }
+      } catch (e) {
+        logger.error('[esp32 occupancy] error', e.message);
+      }
+      return;
+    }
   if (type === 'state_update') {
       // Relaxed rate limiting: accept up to ~10 updates per 2s; prefer newest
       const now = Date.now();
@@ -721,7 +847,8 @@ wss.on('connection', (ws) => {
         device.lastSeen = new Date();
   await device.save();
   emitDeviceStateChanged(device, { source: 'esp32:state_update' });
-  ws.send(JSON.stringify({ type: 'state_ack', ts: Date.now(), changed }));
+  // Echo seq/epoch so firmware can drop acked relays from its next delta
+  ws.send(JSON.stringify({ type: 'state_ack', ts: Date.now(), changed, seq: incomingSeq, stateEpoch: data.epoch }));
         // Broadcast to all UIs (Socket.IO)
         io.emit('device_state_changed', {
           deviceId: device.id,
@@ -755,14 +882,14 @@ wss.on('connection', (ws) => {
           }
         }
       } catch (e) { /* do not block on hmac errors */ }
-      // Drop stale by seq if provided
+      // No ordering check on seq: with several commands in flight, busy / unknown_gpio / dup
+      // results go out on receipt and successes only after the relay switched, so a lower
+      // seq can legitimately arrive last. The device dedups by id, and each result carries
+      // the actual relay state at the time it was sent.
       const incomingSeq = typeof data.seq === 'number' ? data.seq : undefined;
       if (incomingSeq !== undefined) {
-        ws._lastResSeq = ws._lastResSeq || 0;
-        if (incomingSeq < ws._lastResSeq) {
-          return; // stale
-        }
-        ws._lastResSeq = incomingSeq;
+        // Frees the pipeline slot even for a duplicate re-ack or a failure
+        commandPipeline.acknowledge(ws, incomingSeq);
       }
       try {
         const Device = require('./models/Device');
@@ -808,7 +935,7 @@ wss.on('connection', (ws) => {
           emitDeviceStateChanged(device, { source: 'esp32:switch_result:success:reconcile' });
         }
         // Always emit switch_result for UI even if no DB change (authoritative confirmation)
-  io.emit('switch_result', { deviceId: device.id, gpio, requestedState: requested, actualState: actual !== undefined ? actual : (target ? target.state : undefined), success: true, ts: Date.now(), seq: incomingSeq });
+  io.emit('switch_result', { deviceId: device.id, gpio, requestedState: requested, actualState: actual !== undefined ? actual : (target ? target.state : undefined), success: true, ts: Date.now(), seq: incomingSeq, deviceUs: data.us });
       } catch (e) {
         logger.error('[switch_result handling] error', e.message);
       }
@@ -816,6 +943,7 @@ wss.on('connection', (ws) => {
     }
   });
   ws.on('close', () => {
+    commandPipeline.reset(ws);
     if (ws.mac) {
       wsDevices.delete(ws.mac);
       logger.info(`[esp32] disconnected ${ws.mac}`);
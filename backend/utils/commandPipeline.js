@@ -0,0 +1,65 @@
+const { logger } = require('../middleware/logger');
+
+// Pipelined switch_command delivery to raw-WebSocket devices.
+// Up to WINDOW commands per socket are in flight at once; the next one goes out as
+// soon as the device answers one with switch_result (its seq echoed back). Firmware
+// without switch_result never answers, so a slot is also freed after ACK_TIMEOUT_MS
+// and those devices degrade to one command per timeout slice instead of stalling.
+const WINDOW = 4;
+const ACK_TIMEOUT_MS = 400;
+
+function pipeOf(ws) {
+  if (!ws._cmdPipe) ws._cmdPipe = { queue: [], inflight: new Map() };
+  return ws._cmdPipe;
+}
+
+function pump(ws) {
+  const pipe = pipeOf(ws);
+  const now = Date.now();
+  for (const [seq, entry] of pipe.inflight) {
+    if (now - entry.sentAt >= ACK_TIMEOUT_MS) pipe.inflight.delete(seq);
+  }
+  while (pipe.queue.length && pipe.inflight.size < WINDOW) {
+    if (ws.readyState !== 1) {
+      pipe.queue.length = 0;
+      return;
+    }
+    const { payload, onSent } = pipe.queue.shift();
+    try {
+      ws.send(JSON.stringify(payload));
+      pipe.inflight.set(payload.seq, { sentAt: now });
+      if (onSent) onSent(payload);
+    } catch (e) {
+      try { logger.warn('[hw] pipelined send failed', { mac: ws.mac, err: e.message }); } catch {}
+    }
+  }
+  if (pipe.queue.length && !pipe.timer) {
+    // Nothing acked in time: retry once the oldest in-flight slot expires
+    pipe.timer = setTimeout(() => {
+      pipe.timer = null;
+      pump(ws);
+    }, ACK_TIMEOUT_MS);
+  }
+}
+
+// Queue a switch_command ({ type, mac, gpio, state, seq }) for ws; returns false if the socket is not open
+function send(ws, payload, onSent) {
+  if (!ws || ws.readyState !== 1) return false;
+  pipeOf(ws).queue.push({ payload, onSent });
+  pump(ws);
+  return true;
+}
+
+// switch_result from the device: frees the slot of that command
+function acknowledge(ws, seq) {
+  if (!ws || !ws._cmdPipe) return;
+  if (ws._cmdPipe.inflight.delete(seq)) pump(ws);
+}
+
+function reset(ws) {
+  if (!ws || !ws._cmdPipe) return;
+  if (ws._cmdPipe.timer) clearTimeout(ws._cmdPipe.timer);
+  ws._cmdPipe = null;
+}
+
+module.exports = { send, acknowledge, reset, WINDOW, ACK_TIMEOUT_MS };
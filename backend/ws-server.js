@@ -1,5 +1,6 @@
 import express from "express";
 import http from "http";
+import crypto from "crypto";
 import { WebSocketServer } from "ws";
 
 const app = express();
@@ -8,37 +9,260 @@ const wss = new WebSocketServer({ server });
 
 let esp32Socket = null;
 
+// Authenticated devices by MAC. Commands carrying a "mac" go to that device;
+// without one they fall back to the most recently registered device.
+const devices = new Map();
+
+// Device key (config.h DEVICE_SECRET_KEY) every auth must present; unset = no device
+// is accepted
+const DEVICE_SECRET = process.env.WS_DEVICE_SECRET || "";
+if (!DEVICE_SECRET) console.warn("WS_DEVICE_SECRET not set: every device auth will be refused");
+
+function keyValid(key) {
+  if (!DEVICE_SECRET || typeof key !== "string") return false;
+  const a = Buffer.from(key);
+  const b = Buffer.from(DEVICE_SECRET);
+  return a.length === b.length && crypto.timingSafeEqual(a, b);
+}
+
+// Per-message logging; set WS_LOG_TRAFFIC=0 when running a fleet against this server
+const LOG_TRAFFIC = process.env.WS_LOG_TRAFFIC !== "0";
+
+// Last state applied per device (mac -> { epoch, seq, switches }). Handed back in
+// auth_success so a reconnecting device only sends what changed meanwhile.
+const deviceState = new Map();
+
+// -----------------------------------------------------------------------------
+// Binary frame protocol, mirrors esp32/binproto.h (little endian, 8-byte header:
+// magic, version, type, count, uint32 seq). Negotiated via "proto" in auth.
+const BINPROTO_MAGIC = 0xb1;
+const BINPROTO_VERSION = 1;
+const BINPROTO_NAME = "bin1";
+const BIN_STATE = 0x01;
+const BIN_COMMAND = 0x02;
+const BIN_HEARTBEAT = 0x03;
+const BIN_BATCH_ACK = 0x04;
+const BIN_DELTA = 0x05;
+const BIN_STATE_ACK = 0x06;
+// BinLatency entries appended to BIN_HEARTBEAT, LatencyStage order (esp32/latency.h)
+const LATENCY_STAGES = ["queue", "cmd", "cmdAck", "manual", "manualAck"];
+
+// Relay index -> { gpio, name } comes from the device's JSON full_state
+function switchAt(dev, index) {
+  const sw = Array.isArray(dev.switches) ? dev.switches[index] : undefined;
+  return sw ? { index, gpio: sw.gpio, name: sw.name } : { index };
+}
+
+function maskToSwitches(dev, mask, count) {
+  const out = [];
+  for (let i = 0; i < count; i++) {
+    out.push({ ...switchAt(dev, i), state: !!(mask & (1 << i)) });
+  }
+  return out;
+}
+
+// Decode a device frame into the JSON message it replaces (null if invalid)
+function decodeBinFrame(dev, buf) {
+  if (buf.length < 8 || buf[0] !== BINPROTO_MAGIC || buf[1] !== BINPROTO_VERSION) return null;
+  const type = buf[2];
+  const count = buf[3];
+  const seq = buf.readUInt32LE(4);
+  if (type === BIN_STATE && buf.length >= 12) {
+    return { type: "state_update", seq, switches: maskToSwitches(dev, buf.readUInt32LE(8), count) };
+  }
+  if (type === BIN_DELTA && buf.length >= 24) {
+    const epoch = buf.readUInt32LE(8);
+    const base = buf.readUInt32LE(12);
+    const changed = buf.readUInt32LE(16);
+    const state = buf.readUInt32LE(20);
+    const switches = maskToSwitches(dev, state, count).filter((sw) => changed & (1 << sw.index));
+    return { type: "state_update", seq, epoch, base, changed, switches };
+  }
+  if (type === BIN_HEARTBEAT && buf.length >= 20) {
+    // lat: { stage: [count, p50, p99, max] } in us, like the JSON heartbeat
+    const lat = {};
+    for (let k = 0; k < count && 20 + (k + 1) * 8 <= buf.length; k++) {
+      const off = 20 + k * 8;
+      const samples = buf.readUInt16LE(off);
+      if (!samples) continue;
+      lat[LATENCY_STAGES[k] || "stage" + k] = [
+        samples,
+        buf.readUInt16LE(off + 2) * 100,
+        buf.readUInt16LE(off + 4) * 100,
+        buf.readUInt16LE(off + 6) * 100
+      ];
+    }
+    return {
+      type: "heartbeat",
+      uptime: buf.readUInt32LE(8),
+      rssi: buf.readInt8(12),
+      tlsMs: buf[13] * 10,
+      storms: buf.readUInt16LE(14),
+      freeHeap: buf.readUInt32LE(16),
+      lat
+    };
+  }
+  if (type === BIN_BATCH_ACK && buf.length >= 16) {
+    const applied = buf.readUInt32LE(8);
+    const state = buf.readUInt32LE(12);
+    const switches = [];
+    for (let i = 0; i < 32; i++) {
+      if (applied & (1 << i)) switches.push({ ...switchAt(dev, i), state: !!(state & (1 << i)) });
+    }
+    return { type: "switch_batch_ack", seq, rejected: count, applied: switches.length, switches };
+  }
+  return null;
+}
+
+function encodeStateAck(seq) {
+  const buf = Buffer.alloc(8);
+  buf[0] = BINPROTO_MAGIC;
+  buf[1] = BINPROTO_VERSION;
+  buf[2] = BIN_STATE_ACK;
+  buf.writeUInt32LE(seq >>> 0, 4);
+  return buf;
+}
+
+// Record a device state message (full_state or delta) and ack its seq
+function applyDeviceState(ws, data) {
+  if (typeof data.seq !== "number" || !ws.mac) return;
+  const entry = deviceState.get(ws.mac) || { epoch: 0, seq: 0, switches: [] };
+  if (data.type === "full_state") {
+    entry.switches = data.switches || [];
+  } else if (data.epoch === entry.epoch && data.seq < entry.seq) {
+    return; // stale
+  }
+  (data.switches || []).forEach((sw) => {
+    const target = entry.switches.find((t) => t.gpio === sw.gpio);
+    if (target) target.state = sw.state;
+  });
+  entry.epoch = data.epoch;
+  entry.seq = data.seq;
+  deviceState.set(ws.mac, entry);
+  ws.switches = entry.switches;
+  if (ws.proto === BINPROTO_NAME) {
+    ws.send(encodeStateAck(data.seq), { binary: true });
+  } else {
+    ws.send(JSON.stringify({ type: "state_ack", seq: data.seq, stateEpoch: data.epoch }));
+  }
+}
+
+// Resolve a UI command entry ({ index } | { gpio } | { name }) to a relay index
+function resolveIndex(dev, cmd) {
+  if (typeof cmd.index === "number") return cmd.index;
+  const list = Array.isArray(dev.switches) ? dev.switches : [];
+  const i = list.findIndex((sw) => (cmd.gpio !== undefined ? sw.gpio === cmd.gpio : sw.name === cmd.name));
+  return i;
+}
+
+// switch_command / switch_command_batch -> BIN_COMMAND (seq 0 = no ack wanted). A single
+// command's seq is its command id; the device answers it with BIN_BATCH_ACK.
+function encodeBinCommand(dev, data) {
+  const entries = data.type === "switch_command_batch" ? data.commands || [] : [data];
+  const pairs = entries
+    .map((cmd) => [resolveIndex(dev, cmd), cmd.state ? 1 : 0])
+    .filter(([index]) => index >= 0 && index < 256);
+  const buf = Buffer.alloc(8 + pairs.length * 2);
+  buf[0] = BINPROTO_MAGIC;
+  buf[1] = BINPROTO_VERSION;
+  buf[2] = BIN_COMMAND;
+  buf[3] = pairs.length;
+  buf.writeUInt32LE((data.seq || 0) >>> 0, 4);
+  pairs.forEach(([index, state], k) => {
+    buf[8 + k * 2] = index;
+    buf[9 + k * 2] = state;
+  });
+  return buf;
+}
+
+// broadcast to all UI clients (device messages are tagged with the sender's MAC)
+function broadcast(from, data) {
+  if (from.mac && !data.mac) data.mac = from.mac;
+  const text = JSON.stringify(data);
+  wss.clients.forEach((client) => {
+    if (client !== from && !client.mac && client !== esp32Socket && client.readyState === 1) {
+      client.send(text);
+    }
+  });
+}
+
 wss.on("connection", (ws, req) => {
-  console.log("New WS client connected");
+  if (LOG_TRAFFIC) console.log("New WS client connected");
 
   // Identify ESP32 vs UI
-  ws.on("message", (msg) => {
+  ws.on("message", (msg, isBinary) => {
+    if (isBinary) {
+      if (!ws.mac) return; // binary frames only from an authenticated device
+      const data = decodeBinFrame(ws, msg);
+      if (!data) {
+        console.log("Invalid binary frame:", msg.length, "bytes");
+        return;
+      }
+      if (data.type === "state_update") applyDeviceState(ws, data);
+      if (data.type !== "heartbeat") broadcast(ws, data);
+      return;
+    }
     try {
       const data = JSON.parse(msg);
 
+      // ESP32 identifies itself; accept the binary protocol if offered
+      if (data.type === "auth") {
+        const mac = (data.mac || "").toUpperCase();
+        if (!mac || !keyValid(data.secretKey)) {
+          console.log("Auth refused for", mac || "(no mac)");
+          ws.send(JSON.stringify({ type: "auth_failed", reason: mac ? "invalid_key" : "missing_fields" }));
+          ws.close();
+          return;
+        }
+        esp32Socket = ws;
+        ws.mac = mac;
+        devices.set(ws.mac, ws);
+        ws.proto = data.proto === BINPROTO_NAME ? BINPROTO_NAME : "json";
+        const known = deviceState.get(ws.mac);
+        if (known) ws.switches = known.switches;
+        ws.send(JSON.stringify({
+          type: "auth_success",
+          mac: data.mac,
+          proto: ws.proto,
+          stateEpoch: known ? known.epoch : 0,
+          stateSeq: known ? known.seq : 0
+        }));
+        if (LOG_TRAFFIC) console.log("ESP32 registered", data.mac, "proto", ws.proto);
+      }
+
+      // Snapshot with names/pins: keep the index map for binary frames
+      if (data.type === "full_state") {
+        ws.switches = data.switches;
+        applyDeviceState(ws, data);
+        broadcast(ws, data);
+      }
+
       // ESP32 state update
       if (data.type === "state_update") {
-        console.log("State from ESP32:", data);
-        // broadcast to all UI clients
-        wss.clients.forEach((client) => {
-          if (client !== ws && client.readyState === 1) {
-            client.send(JSON.stringify(data));
-          }
-        });
+        if (LOG_TRAFFIC) console.log("State from ESP32:", data);
+        applyDeviceState(ws, data);
+        broadcast(ws, data);
       }
 
-      // UI sends command
-      if (data.type === "switch_command") {
-        console.log("Command from UI:", data);
-        if (esp32Socket && esp32Socket.readyState === 1) {
-          esp32Socket.send(JSON.stringify(data));
-        }
+      // ESP32 answers a whole scene with one aggregated ack, a switch_command with a
+      // seq with switch_result (applied state + on-device latency)
+      if (data.type === "switch_batch_ack" || data.type === "switch_result") {
+        if (LOG_TRAFFIC) console.log("Batch ack from ESP32:", data);
+        broadcast(ws, data);
       }
 
-      // First time: register ESP32
-      if (data.type === "auth_success") {
-        esp32Socket = ws;
-        console.log("ESP32 registered");
+      // UI sends command (single switch, or a scene as switch_command_batch:
+      // { type, seq, commands: [{ index | gpio, state }] })
+      if (data.type === "switch_command" || data.type === "switch_command_batch") {
+        if (LOG_TRAFFIC) console.log("Command from UI:", data);
+        const target = data.mac ? devices.get(String(data.mac).toUpperCase()) : esp32Socket;
+        if (target && target.readyState === 1) {
+          if (target.proto === BINPROTO_NAME) {
+            target.send(encodeBinCommand(target, data), { binary: true });
+          } else {
+            target.send(JSON.stringify(data));
+          }
+        }
       }
     } catch (e) {
       console.log("Invalid JSON:", msg.toString());
@@ -46,9 +270,23 @@ wss.on("connection", (ws, req) => {
   });
 
   ws.on("close", () => {
-    console.log("Client disconnected");
+    if (LOG_TRAFFIC) console.log("Client disconnected");
     if (ws === esp32Socket) esp32Socket = null;
+    if (ws.mac && devices.get(ws.mac) === ws) devices.delete(ws.mac);
+  });
+});
+
+// Planned restart: tell devices how long to stay away so the fleet does not
+// reconnect in one burst (the firmware spreads its attempt over retry_after..1.5x)
+const RESTART_RETRY_AFTER_MS = 15000;
+process.on("SIGTERM", () => {
+  wss.clients.forEach((client) => {
+    if (client.mac && client.readyState === 1) {
+      client.send(JSON.stringify({ type: "retry_after", ms: RESTART_RETRY_AFTER_MS }));
+    }
   });
+  server.close();
+  setTimeout(() => process.exit(0), 500);
 });
 
 server.listen(4000, () => {
@@ -0,0 +1,118 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+
+#include <stdint.h>
+
+// ---------------- Binary frame protocol (WStype_BIN) ----------------
+// Negotiated at auth time: the device offers "proto":"bin1" in its auth
+// message and switches to these frames once auth_success echoes it back.
+// JSON stays in use for auth, config_update and the full_state snapshot that
+// carries names/pins (the server needs it to map relay index -> gpio).
+//
+// Every frame starts with an 8-byte header. Multi-byte fields are little
+// endian (native on ESP32; backend/ws-server.js decodes with readUInt*LE).
+
+#define BINPROTO_MAGIC    0xB1
+#define BINPROTO_VERSION  1
+#define BINPROTO_NAME     "bin1"
+
+enum BinFrameType : uint8_t {
+  BIN_STATE     = 0x01,  // device -> server: relay bitmask (v1 form, superseded by BIN_DELTA)
+  BIN_COMMAND   = 0x02,  // server -> device: packed (index, state) pairs
+  BIN_HEARTBEAT = 0x03,  // device -> server: fixed-size telemetry
+  BIN_BATCH_ACK = 0x04,  // device -> server: answer to a BIN_COMMAND with seq != 0
+  BIN_DELTA     = 0x05,  // device -> server: relays changed since the server's last ack
+  BIN_STATE_ACK = 0x06,  // server -> device: header only, seq = last applied state seq
+  BIN_PING      = 0x07,  // device -> server: WebSocket ping payload (any proto), see BinPing
+};
+
+struct __attribute__((packed)) BinHeader {
+  uint8_t  magic;    // BINPROTO_MAGIC
+  uint8_t  version;  // BINPROTO_VERSION
+  uint8_t  type;     // BinFrameType
+  uint8_t  count;    // STATE/DELTA: relay count, COMMAND: pair count, BATCH_ACK: rejected entries
+  uint32_t seq;      // STATE/DELTA/STATE_ACK: state sequence, COMMAND/BATCH_ACK: command sequence (0 = no ack wanted)
+};
+
+struct __attribute__((packed)) BinState {
+  BinHeader h;
+  uint32_t  mask;    // bit i = relay i ON
+};
+
+struct __attribute__((packed)) BinDelta {
+  BinHeader h;         // count = relay count, seq = device state seq
+  uint32_t  epoch;     // random per boot; seqs from another epoch never match
+  uint32_t  base;      // state seq the delta is relative to (last ack)
+  uint32_t  changed;   // relays changed after base
+  uint32_t  state;     // full relay bitmask (changed bits are the payload)
+};
+
+struct __attribute__((packed)) BinCommandPair {
+  uint8_t index;     // relay index (switchCfg order)
+  uint8_t state;     // 0 = OFF, 1 = ON
+};
+// BIN_COMMAND = BinHeader followed by h.count BinCommandPair entries
+
+struct __attribute__((packed)) BinHeartbeat {
+  BinHeader h;
+  uint32_t  uptime;    // seconds
+  int8_t    rssi;      // dBm
+  uint8_t   tls10ms;   // last connect handshake, 10 ms units (saturates at 2.55 s)
+  uint16_t  storms;    // reconnects delayed by retry_after / the reconnect token bucket
+  uint32_t  freeHeap;  // bytes
+};
+
+// BIN_HEARTBEAT may be followed by h.count BinLatency entries (LatencyStage order,
+// latency.h) covering the interval since the previous heartbeat
+struct __attribute__((packed)) BinLatency {
+  uint16_t  count;     // samples (saturating)
+  uint16_t  p50;       // 100 us units (saturating at 6.5 s)
+  uint16_t  p99;
+  uint16_t  max;
+};
+
+// Payload of the keepalive pings (keepalive.h), sent whether or not bin1 was
+// negotiated; the pong echoes it. Control frames carry at most 125 bytes.
+struct __attribute__((packed)) BinPing {
+  BinHeader h;         // count = relay count, seq = ping number on this connection
+  uint32_t  uptime;    // seconds
+  int8_t    rssi;      // dBm
+  uint8_t   flags;     // BIN_PING_SLEEP, BIN_PING_ACTIVE
+  uint16_t  heapKb;    // free heap, KiB
+  uint32_t  relays;    // bit i = relay i ON
+  uint16_t  rttMs;     // previous ping round trip (saturating)
+  uint16_t  heartbeatS; // app heartbeat interval in effect
+};
+#define BIN_PING_SLEEP   0x01  // modem sleep in effect
+#define BIN_PING_ACTIVE  0x02  // recent commands / state changes
+
+struct __attribute__((packed)) BinBatchAck {
+  BinHeader h;
+  uint32_t  applied;   // relays the command set
+  uint32_t  state;     // relay bitmask after applying
+};
+
+static_assert(sizeof(BinHeader) == 8, "BinHeader wire size");
+static_assert(sizeof(BinState) == 12, "BinState wire size");
+static_assert(sizeof(BinDelta) == 24, "BinDelta wire size");
+static_assert(sizeof(BinCommandPair) == 2, "BinCommandPair wire size");
+static_assert(sizeof(BinHeartbeat) == 20, "BinHeartbeat wire size");
+static_assert(sizeof(BinBatchAck) == 16, "BinBatchAck wire size");
+static_assert(sizeof(BinLatency) == 8, "BinLatency wire size");
+static_assert(sizeof(BinPing) == 24 && sizeof(BinPing) <= 125, "BinPing wire size");
+
+inline void binHeader(BinHeader &h, BinFrameType type, uint8_t count, uint32_t seq) {
+  h.magic = BINPROTO_MAGIC;
+  h.version = BINPROTO_VERSION;
+  h.type = type;
+  h.count = count;
+  h.seq = seq;
+}
+
+inline bool binHeaderValid(const uint8_t *payload, size_t length) {
+  if (length < sizeof(BinHeader)) return false;
+  const BinHeader *h = (const BinHeader *)payload;
+  return h->magic == BINPROTO_MAGIC && h->version == BINPROTO_VERSION;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef BOARD_PROFILE_H
+#define BOARD_PROFILE_H
+
+// Included from config.h (needs its pin / driver settings above the include)
+
+// ---------------- Board profiles ----------------
+// One BoardProfile<BOARD_...> specialization per board variant, picked with
+// BOARD_PROFILE: the factory channel table (relay output, wall switch input and
+// its polarity, name), the relay polarity and through the table the channel
+// count. Everything is constexpr: the tables live in flash, names are string
+// literals, and the pin map is checked below at compile time.
+//
+// Relay polarity is a compile-time constant from here on (relayLevel() folds to
+// on or !on). Wall switch polarity stays per switch because config_update can
+// change it; inputActive() applies it without a branch.
+//
+// Adding a board: a specialization with relayActiveLow and channels[]; relay is
+// a GPIO for RELAY_DRIVER_GPIO and an expander output otherwise, -1 = none.
+
+struct BoardChannel {
+  int8_t relay;
+  int8_t manual;            // maintained wall switch input, -1 = none
+  bool manualActiveLow;     // LOW = ON (switch to GND, internal pull-up)
+  const char *name;
+};
+
+template <int Id> struct BoardProfile;
+
+// Stock board relays are wired to these GPIOs, or to expander outputs 0..5 in
+// the same order when RELAY_DRIVER selects an expander
+constexpr int8_t stockRelay(int8_t gpio, int8_t channel) {
+  return RELAY_DRIVER == RELAY_DRIVER_GPIO ? gpio : channel;
+}
+
+template <> struct BoardProfile<BOARD_STOCK_6CH> {
+  static constexpr const char *id = "stock-6ch";
+  static constexpr bool relayActiveLow = true;
+  static constexpr BoardChannel channels[] = {
+    {stockRelay( 4, 0), 25, true, "Fan1"},
+    {stockRelay(16, 1), 27, true, "Fan2"},
+    {stockRelay(17, 2), 32, true, "Light1"},
+    {stockRelay( 5, 3), 33, true, "Light2"},
+    {stockRelay(19, 4), 12, true, "Projector"},
+    {stockRelay(18, 5), 14, true, "NComputing"},
+  };
+};
+
+template <> struct BoardProfile<BOARD_GPIO_4CH_HIGH> {
+  static constexpr const char *id = "gpio-4ch-high";
+  static constexpr bool relayActiveLow = false;
+  static constexpr BoardChannel channels[] = {
+    {26, -1, true, "Relay1"},
+    {27, -1, true, "Relay2"},
+    {32, -1, true, "Relay3"},
+    {33, -1, true, "Relay4"},
+  };
+};
+
+template <> struct BoardProfile<BOARD_MCP23017_16CH> {
+  static constexpr const char *id = "mcp23017-16ch";
+  static constexpr bool relayActiveLow = true;
+  static constexpr BoardChannel channels[] = {
+    { 0,  4, true, "Relay1"},  { 1,  5, true, "Relay2"},  { 2, 13, true, "Relay3"},  { 3, 14, true, "Relay4"},
+    { 4, 16, true, "Relay5"},  { 5, 17, true, "Relay6"},  { 6, 18, true, "Relay7"},  { 7, 19, true, "Relay8"},
+    { 8, 23, true, "Relay9"},  { 9, 25, true, "Relay10"}, {10, 26, true, "Relay11"}, {11, 27, true, "Relay12"},
+    {12, 32, true, "Relay13"}, {13, 33, true, "Relay14"}, {14, -1, true, "Relay15"}, {15, -1, true, "Relay16"},
+  };
+};
+
+using Board = BoardProfile<BOARD_PROFILE>;
+#define DEFAULT_SWITCH_COUNT ((int)(sizeof(Board::channels) / sizeof(Board::channels[0])))
+
+#ifdef RELAY_ACTIVE_LOW
+constexpr bool kRelayActiveLow = RELAY_ACTIVE_LOW;
+#else
+constexpr bool kRelayActiveLow = Board::relayActiveLow;
+#endif
+
+// Pin level (true = HIGH) that puts a relay in the logical state on
+template <bool ActiveLow> constexpr bool relayLevelFor(bool on) { return on != ActiveLow; }
+constexpr bool relayLevel(bool on) { return relayLevelFor<kRelayActiveLow>(on); }
+
+// Logical state of a switch / sensor input read at level
+inline bool inputActive(int level, bool activeLow) { return (level != LOW) != activeLow; }
+
+// ========= Compile-time pin checks =========
+#if RELAY_DRIVER == RELAY_DRIVER_GPIO
+constexpr int kRelayDriverChannels = 40;
+#elif RELAY_DRIVER == RELAY_DRIVER_MCP23017
+constexpr int kRelayDriverChannels = MCP23017_COUNT * 16;
+#else
+constexpr int kRelayDriverChannels = HC595_COUNT * 8;
+#endif
+
+namespace boardcheck {
+constexpr bool flashPin(int p) { return p >= 6 && p <= 11; }   // SPI flash
+constexpr bool inputOnly(int p) { return p >= 34 && p <= 39; } // no output driver, no internal pull-up
+constexpr bool uartPin(int p) { return p == 1 || p == 3; }     // Serial
+constexpr bool busPin(int p) {
+#if RELAY_DRIVER == RELAY_DRIVER_MCP23017
+  return p == RELAY_I2C_SDA || p == RELAY_I2C_SCL;
+#elif RELAY_DRIVER == RELAY_DRIVER_74HC595
+  return p == HC595_DATA_PIN || p == HC595_CLOCK_PIN || p == HC595_LATCH_PIN || p == HC595_OE_PIN;
+#else
+  (void)p;
+  return false;
+#endif
+}
+constexpr bool reserved(int p) { return flashPin(p) || uartPin(p) || busPin(p) || p == LED_PIN; }
+
+template <typename P> constexpr int count() { return sizeof(P::channels) / sizeof(P::channels[0]); }
+
+template <typename P> constexpr bool relaysValid() {
+  for (int i = 0; i < count<P>(); i++) {
+    int r = P::channels[i].relay;
+    if (r < 0) continue;
+    if (r >= kRelayDriverChannels) return false;
+    if (RELAY_DRIVER == RELAY_DRIVER_GPIO && (reserved(r) || inputOnly(r))) return false;
+    for (int k = 0; k < i; k++) if (P::channels[k].relay == r) return false;
+  }
+  return true;
+}
+
+template <typename P> constexpr bool manualsValid() {
+  for (int i = 0; i < count<P>(); i++) {
+    int m = P::channels[i].manual;
+    if (m < 0) continue;
+    if (m >= 40 || reserved(m) || inputOnly(m)) return false; // inputs use INPUT_PULLUP
+    for (int k = 0; k < count<P>(); k++) {
+      if (k < i && P::channels[k].manual == m) return false;
+      if (RELAY_DRIVER == RELAY_DRIVER_GPIO && P::channels[k].relay == m) return false;
+    }
+  }
+  return true;
+}
+
+template <typename P> constexpr bool namesFit() {
+  for (int i = 0; i < count<P>(); i++) {
+    int n = 0;
+    while (P::channels[i].name[n]) n++;
+    if (!n || n >= SWITCH_NAME_LEN) return false;
+  }
+  return true;
+}
+}  // namespace boardcheck
+
+static_assert(DEFAULT_SWITCH_COUNT >= 1 && DEFAULT_SWITCH_COUNT <= MAX_SWITCHES, "board profile: 1..MAX_SWITCHES channels");
+static_assert(boardcheck::relaysValid<Board>(),
+              "board profile: relay outputs must be distinct, within the driver's channels and (GPIO) "
+              "output-capable, not flash/UART/LED pins");
+static_assert(boardcheck::manualsValid<Board>(),
+              "board profile: wall switch inputs must be distinct pull-up capable GPIOs, not relay, bus, "
+              "flash, UART or LED pins");
+static_assert(boardcheck::namesFit<Board>(), "board profile: names must be 1..SWITCH_NAME_LEN-1 characters");
+static_assert(relayLevel(true) != relayLevel(false), "relay polarity");
+
+#endif
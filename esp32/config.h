@@ -7,49 +7,285 @@
 #define WIFI_SSID       "AIMS-WIFI"
 #define WIFI_PASSWORD   "Aimswifi#2025"
 
+// Networks the WiFi manager may join (wifi_manager.h); the strongest scanned AP
+// of any of them wins. Add entries for other SSIDs in the building.
+struct WifiNetwork {
+  const char *ssid;
+  const char *password;
+};
+static const WifiNetwork wifiNetworks[] = {
+  {WIFI_SSID, WIFI_PASSWORD},
+};
+#define WIFI_NETWORK_COUNT (sizeof(wifiNetworks) / sizeof(wifiNetworks[0]))
+
+// Rejoin the last AP with its DHCP lease as static IP (skips DHCP at boot).
+// Disable on networks that hand out short leases to many clients.
+#ifndef WIFI_CACHE_IP
+#define WIFI_CACHE_IP 1
+#endif
+#define WIFI_CACHE_IP_MAX_AGE_S   3600  // reuse a lease this long after DHCP granted it (well inside common lease times)
+#define WIFI_CACHE_IP_MAX_JOINS      4  // static-IP joins before DHCP has to confirm the lease again
+#define WIFI_CACHE_IP_WS_FAILS       3  // failed backend connects on the cached IP before asking DHCP
+
 // ---------------- WebSocket ----------------
 #define WEBSOCKET_HOST  "smart-classroom-1wus.onrender.com"
 #define WEBSOCKET_PORT  443
 #define WEBSOCKET_PATH  "/esp32-ws"
 #define DEVICE_SECRET_KEY "9545c46f0f9f494a27412fce1f5b22095550c4e88d82868f"
 
+// Pin the server's root CA (PEM string, kept in flash and handed to the TLS client
+// once). Leave undefined to connect without certificate verification.
+// #define WEBSOCKET_CA_CERT "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"
+
 // ---------------- Pins ----------------
 #define LED_PIN 2                // Built-in LED on most ESP32 dev boards
-#define MAX_SWITCHES 6
+#define MAX_SWITCHES         32  // compile-time cap (relay masks are 32 bit); the active count is persisted
 
-// Most ESP32 relay boards are ACTIVE LOW
-#ifndef RELAY_ACTIVE_LOW
-#define RELAY_ACTIVE_LOW 1
+// ---------------- Board profile (board_profile.h) ----------------
+// Factory pin map, relay polarity and channel count per board variant, checked
+// for pin conflicts at compile time. DEFAULT_SWITCH_COUNT comes from the profile.
+#define BOARD_STOCK_6CH       0  // classroom board: 6 active-low relays on GPIOs, wall switches to GND
+#define BOARD_GPIO_4CH_HIGH   1  // 4-channel active-high relay module, no wall switches
+#define BOARD_MCP23017_16CH   2  // 16 active-low relays behind one MCP23017, wall switches on GPIOs
+#ifndef BOARD_PROFILE
+#define BOARD_PROFILE BOARD_STOCK_6CH
 #endif
-#if RELAY_ACTIVE_LOW
-  #define RELAY_ON_LEVEL  LOW
-  #define RELAY_OFF_LEVEL HIGH
+// Define RELAY_ACTIVE_LOW (0/1) to override the profile's relay polarity
+
+// ---------------- Relay driver (relay_driver.h) ----------------
+// With an expander backend, SwitchConfig.relayPin is the expander channel
+// (0 = first output of the first chip) instead of an ESP32 GPIO.
+#define RELAY_DRIVER_GPIO      0  // relays on ESP32 GPIOs
+#define RELAY_DRIVER_MCP23017  1  // MCP23017 I2C expanders, 16 channels each
+#define RELAY_DRIVER_74HC595   2  // daisy-chained 74HC595 shift registers, 8 channels each
+#ifndef RELAY_DRIVER
+#if BOARD_PROFILE == BOARD_MCP23017_16CH
+#define RELAY_DRIVER RELAY_DRIVER_MCP23017
 #else
-  #define RELAY_ON_LEVEL  HIGH
-  #define RELAY_OFF_LEVEL LOW
+#define RELAY_DRIVER RELAY_DRIVER_GPIO
+#endif
+#endif
+
+// GPIO backend: switch relays that turn ON in groups of RELAY_STAGGER_GROUP,
+// RELAY_STAGGER_MS apart, to spread inrush (0 = all in one register write).
+// Groups after the first are written from the GPIO task loop, not under cfgMutex.
+#ifndef RELAY_STAGGER_GROUP
+#define RELAY_STAGGER_GROUP    0
+#endif
+#define RELAY_STAGGER_MS      20
+
+#define MCP23017_BASE_ADDR  0x20   // chip k answers at BASE + k (A2..A0 strapped)
+#define MCP23017_COUNT         1
+#define RELAY_I2C_SDA         21
+#define RELAY_I2C_SCL         22
+#define RELAY_I2C_FREQ    400000
+
+#define HC595_DATA_PIN        23
+#define HC595_CLOCK_PIN       22
+#define HC595_LATCH_PIN       21
+#define HC595_OE_PIN          -1   // active-low output enable, -1 if tied to GND
+#define HC595_COUNT            2
+
+// ---------------- Boot restore ----------------
+// The last applied relay mask is kept in RTC memory on every change (survives
+// software, watchdog and panic resets) and in NVS once it has been stable for
+// RELAY_PERSIST_IDLE_MS (power loss). setup() drives the relays from it before
+// Serial and WiFi start. The policy decides how it meets the maintained switches:
+#define BOOT_RESTORE_MANUAL  0  // switch positions only, nothing restored (pre-restore behaviour)
+#define BOOT_RESTORE_LAST    1  // last state; a switch takes over again once it is flipped
+#define BOOT_RESTORE_MERGE   2  // last state, except switches flipped while the board was down
+#ifndef BOOT_RESTORE_POLICY
+#define BOOT_RESTORE_POLICY BOOT_RESTORE_MERGE
+#endif
+#define RELAY_PERSIST_IDLE_MS     10000
+#define RELAY_PERSIST_MIN_GAP_MS  60000  // flash wear bound: at most one write per minute
+
+// ---------------- PIR occupancy ----------------
+// Sensors come from config_update ("pir") and are stored with the switch table.
+// Motion switches the linked relays on; they go off locally once no motion has
+// been seen for the sensor's autoOff seconds. Only occupied/vacant transitions
+// are reported, at most one occupancy message per PIR_REPORT_MIN_MS.
+#define MAX_PIR_SENSORS         4
+#define PIR_DEBOUNCE_MS        50   // output glitch filter; the modules already hold HIGH for seconds
+#define PIR_DEFAULT_AUTO_OFF_S 30
+#define PIR_REPORT_MIN_MS    5000
+
+// ---------------- Offline journal (journal.h) ----------------
+// Relay / manual / PIR events while the backend is unreachable, replayed after
+// auth_success in acked batches
+#define JOURNAL_SLOTS         256   // RAM ring, 8 bytes per record
+#ifndef JOURNAL_FLASH_SPILL
+#define JOURNAL_FLASH_SPILL     1   // move the oldest records to NVS instead of overwriting them
+#endif
+#define JOURNAL_SPILL_CHUNK    32   // records per NVS blob
+#define JOURNAL_SPILL_CHUNKS    8   // NVS blobs at most; with all in use the RAM ring overwrites
+#define JOURNAL_SPILL_AT      (JOURNAL_SLOTS * 3 / 4)
+#define JOURNAL_BATCH          32   // records per journal message
+#define JOURNAL_ACK_TIMEOUT_MS 5000 // unacked batch is sent again
+
+// ---------------- Local scheduler (scheduler.h) ----------------
+// Rules from schedule_update run on the device against SNTP time. SCHEDULE_TZ is
+// a POSIX TZ string; rules are in local time.
+#ifndef SCHEDULE_TZ
+#define SCHEDULE_TZ "IST-5:30"
+#endif
+#define SCHEDULE_NTP_SERVER_1 "pool.ntp.org"
+#define SCHEDULE_NTP_SERVER_2 "time.google.com"
+#define SCHEDULE_MAX_RULES      32
+#define SCHEDULE_REPORT_SLOTS   16   // executions kept until the backend is reachable; oldest overwritten
+#define SCHEDULE_CATCHUP_S     300   // a rule missed by less than this (boot, clock step) still fires
+#define SCHEDULE_JUMP_S         30   // wall clock vs millis() disagreement treated as a clock step
+#define SCHEDULE_MIN_EPOCH 1700000000 // time() below this: not synced yet, nothing fires
+
+// ---------------- Logging (logger.h) ----------------
+// 0 none, 1 error, 2 warn, 3 info, 4 debug; lower levels compile out
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 3
+#endif
+#define LOG_RING_SLOTS     32   // pending lines (power of two); full ring drops new lines
+#define LOG_LINE_LEN       96   // bytes per line incl. timestamp/tag, longer lines are cut
+#define LOG_HISTORY_LINES  16   // drained lines kept for get_logs
+
+// Cycle-counter profiling of the task loops (profiling.h), reported via get_metrics
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 1
 #endif
 
+// Offer the compact binary protocol (binproto.h) at auth; JSON is used if the server declines
+#ifndef ENABLE_BIN_PROTO
+#define ENABLE_BIN_PROTO 1
+#endif
+
+// ---------------- Message buffers ----------------
+// Fixed-size JSON documents and TX buffer owned by the network task (no heap per message)
+// Sized for a full_state / config_update covering MAX_SWITCHES channels
+#define MSG_RX_DOC_SIZE  4096
+#define MSG_TX_DOC_SIZE  4096
+#define MSG_TX_BUF_SIZE  3072
+
+// ---------------- OTA update ----------------
+// ota_update streams a full image or an ODP1 delta over HTTPS into the inactive app
+// partition (ota.h). The image must be authenticated by a pinned CA (OTA_CA_CERT or
+// WEBSOCKET_CA_CERT, which also covers the WebSocket the URL and SHA-256 come over)
+// or by OTA_SIGNING_PUBKEY; with neither, ota_update is refused ("insecure").
+// #define OTA_CA_CERT "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"  // default: WEBSOCKET_CA_CERT
+// #define OTA_SIGNING_PUBKEY "-----BEGIN PUBLIC KEY-----\n...\n-----END PUBLIC KEY-----\n"  // ECDSA P-256; unsigned images refused
+#define OTA_CHUNK_BYTES        4096   // per read / flash write, one sector
+#define OTA_CHUNK_DELAY_MS       10   // pause after every chunk (caps the download near 400 KB/s)
+#define OTA_BUSY_WAIT_MS          5   // re-check interval while relay commands or outbound events are queued
+#define OTA_HTTP_TIMEOUT_MS   10000
+#define OTA_REPORT_PCT           10   // ota_status progress steps
+#define OTA_REBOOT_DELAY_MS    1500   // lets the final ota_status go out before the planned reboot
+#define OTA_URL_LEN             256
+
+// ---------------- Outbound queue ----------------
+// Serialized frames wait here until the net task drains them after ws.loop()
+// (txqueue.h). One byte ring per priority; each must hold a full MSG_TX_BUF_SIZE frame.
+#define TX_QUEUE_CONTROL_BYTES    6144  // acks, state, auth
+#define TX_QUEUE_TELEMETRY_BYTES  4096  // heartbeat, metrics, occupancy, journal
+#define TX_QUEUE_BULK_BYTES       3200  // logs
+#define TX_QUEUE_HIGH_WATER       4096  // telemetry/bulk dropped with this much queued at their priority or above
+#define TX_DRAIN_BUDGET_BYTES     4096  // per net loop pass (at least one frame), then ws.loop() runs again
+#define TX_SLOW_SEND_US          20000  // a send this slow means TCP is backed up: stop draining this pass
+
 // ---------------- Timers ----------------
-#define WIFI_RETRY_INTERVAL_MS   3000
-#define HEARTBEAT_INTERVAL_MS   15000
-#define DEBOUNCE_MS               80
+#define WIFI_RETRY_INTERVAL_MS   3000  // first rescan delay after a failed round, doubles up to 8x
+#define WIFI_FAST_TIMEOUT_MS     1500  // cached AP join before falling back to a scan
+#define WIFI_CONNECT_TIMEOUT_MS  8000  // join + DHCP for an AP picked from a scan
+#define WIFI_SCAN_TIMEOUT_MS    10000
+#define WIFI_ROAM_CHECK_MS      30000  // RSSI check interval while connected
+#define WIFI_ROAM_RSSI            -72  // scan for a better AP below this (dBm)
+#define WIFI_ROAM_HYSTERESIS_DB     8  // ...and move only if one is this much stronger
+#define HEARTBEAT_INTERVAL_MS   15000  // app heartbeat while active; see Keepalive / power for idle
+#define DEBOUNCE_MS               80  // esp_timer one-shot armed on every manual pin edge
+#define CONFIG_COMMIT_IDLE_MS   5000  // flush config to NVS once it stops changing for this long
+#define CONFIG_COMMIT_MAX_MS   30000  // ...or at the latest this long after the first unsaved change
+
+// Let the CPU drop into automatic light sleep while all tasks are blocked.
+// Needs an SDK built with CONFIG_PM_ENABLE (stock Arduino-ESP32 is not).
+#ifndef ENABLE_AUTO_LIGHT_SLEEP
+#define ENABLE_AUTO_LIGHT_SLEEP 0
+#endif
+
+// ---------------- Keepalive / power ----------------
+// One scheduler for everything that only proves the link is alive: the app heartbeat
+// (full telemetry, HEARTBEAT_INTERVAL_MS while active, stretching to the idle interval)
+// and a WebSocket ping carrying compact telemetry whenever nothing else went out for a
+// ping interval. The backend may override both intervals (auth_success / keepalive).
+// Modem sleep (wake for DTIM beacons) is on while idle; the extra latency it adds is
+// measured from ping round trips, and sleep is suspended if it exceeds the bound.
+#ifndef ENABLE_MODEM_SLEEP
+#define ENABLE_MODEM_SLEEP 1
+#endif
+#define HEARTBEAT_IDLE_INTERVAL_MS  60000  // no commands / state changes for KEEPALIVE_ACTIVE_MS
+#define HEARTBEAT_MAX_INTERVAL_MS  300000  // clamp for server hints
+#define KEEPALIVE_ACTIVE_MS         60000  // activity keeps the short heartbeat for this long
+#define KEEPALIVE_PING_MS           20000  // below the backend's 35 s offline cutoff and NAT timeouts
+#define KEEPALIVE_PING_MIN_MS        5000  // clamp for server hints
+#define KEEPALIVE_PING_MAX_MS       30000
+#define KEEPALIVE_PONG_TIMEOUT_MS    4000
+#define KEEPALIVE_MISSED_PONGS          2  // then the connection is dropped (nothing else received either)
+#define POWER_MAX_CMD_LATENCY_MS      250  // latency modem sleep may add to a command
+#define POWER_HOT_MS                30000  // radio stays fully awake this long after activity
+#define POWER_SLEEP_BACKOFF_MS     600000  // bound exceeded: stay awake this long, then measure again
+
+// ---------------- Reconnect policy ----------------
+// Backoff ceiling doubles per attempt; the actual delay is jittered in [ceil/2, ceil]
+// from a PRNG seeded by the MAC so a fleet does not reconnect in lockstep. The token
+// bucket caps reconnects regardless of backoff (refills one token per REFILL_MS).
+#define RECONNECT_BASE_MS        1000
+#define RECONNECT_MAX_MS        30000
+#define RECONNECT_BUCKET_SIZE       3
+#define RECONNECT_REFILL_MS     20000
+#define RETRY_AFTER_MAX_MS     600000   // clamp for server retry_after hints
+
+// ---------------- Tasks ----------------
+// GPIO/relay work runs on the app core, WiFi/TLS on the protocol core, so a
+// slow TLS write never delays switch handling.
+#define GPIO_TASK_CORE            1
+#define NET_TASK_CORE             0
+#define TELEMETRY_TASK_CORE       0
+#define GPIO_TASK_PRIORITY        5
+#define NET_TASK_PRIORITY         3
+#define TELEMETRY_TASK_PRIORITY   1
+#define GPIO_TASK_STACK        4096
+#define NET_TASK_STACK         8192
+#define TELEMETRY_TASK_STACK   3072
+#define OTA_TASK_CORE             0
+#define OTA_TASK_PRIORITY         1   // started by ota_update, below the net and GPIO tasks
+#define OTA_TASK_STACK         8192   // TLS client
+#define LOG_TASK_CORE             0
+#define LOG_TASK_PRIORITY         1
+#define LOG_TASK_STACK         3072
+#define LOG_TASK_PERIOD_MS       20
+#define GPIO_TASK_WAIT_MS      1000   // max block on cmdQueue (watchdog feed interval when idle)
+#define NET_TASK_PERIOD_MS        2
+#define TELEMETRY_TASK_PERIOD_MS 50
+#define CMD_QUEUE_DEPTH          32   // drained completely per GPIO task wakeup
+#define NET_QUEUE_DEPTH          16
+#define CMD_DEDUP_SLOTS          16   // recent switch_command ids: a repeat is re-acked, not re-applied
+#define SWITCH_RESULT_SLOTS      32   // applied switch_command results waiting for the net task
 
 // ---------------- Default switch map (factory) ----------------
+#define SWITCH_NAME_LEN 24  // including the terminator; longer names are truncated
+
 struct SwitchConfig {
   int relayPin;
   int manualPin;
-  String name;
+  char name[SWITCH_NAME_LEN];
   bool manualActiveLow; // true if LOW = ON (closed)
 };
 
-// Default/factory configuration
-static const SwitchConfig defaultSwitchConfigs[MAX_SWITCHES] = {
-  { 4, 25, "Fan1",       true},
-  {16, 27, "Fan2",       true},
-  {17, 32, "Light1",     true},
-  { 5, 33, "Light2",     true},
-  {19, 12, "Projector",  true},
-  {18, 14, "NComputing", true}
+struct PirConfig {
+  int pin;            // -1 = slot unused
+  bool activeLow;     // HC-SR501 / AM312 modules drive HIGH on motion
+  bool autoOn;        // motion switches the linked relays on (otherwise auto-off only)
+  uint16_t autoOffS;  // vacancy timeout; 0 = never switch off locally
+  uint32_t linked;    // relays (switch index) this sensor drives
 };
 
+// Default/factory switch map: the board profile's channels (board_profile.h);
+// channels past DEFAULT_SWITCH_COUNT start unwired, pins -1
+#include "board_profile.h"
+
 #endif
\ No newline at end of file
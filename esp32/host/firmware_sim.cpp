@@ -0,0 +1,982 @@
+// Host simulation / benchmark for the firmware hot paths. The sketch is compiled
+// in-place against the stubs and driven single-threaded: WebSocket traffic is
+// injected through the registered event callback and the task bodies
+// (gpioService, netService, telemetry ticks) are called directly on a virtual
+// clock. See README.md for the build line.
+//
+// Scenarios: JSON and binary command bursts, scene batches, config_update
+// storms, bouncing manual switches, WiFi link loss / roaming, boot restore, the
+// offline scheduler, PIR occupancy, the offline journal, a congested uplink,
+// pipelined commands with ids, OTA updates and the keepalive / modem sleep policy.
+// Each reports handler throughput, heap allocations per message and the worst
+// single call, and checks that the relays end in the expected state (non-zero
+// exit on a mismatch).
+#include "../websocket_example.cpp"
+#include "host_runtime.h"
+#include <esp_ota_ops.h>
+#include <HTTPClient.h>
+#include <mbedtls/sha256.h>
+#include <chrono>
+#include <set>
+
+namespace sim {
+
+struct Timer {
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  double ns() const { return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count(); }
+};
+
+struct Result {
+  const char *name;
+  uint64_t messages = 0;
+  double handlerNs = 0, handlerMaxNs = 0;   // onWsEvent / ISR side
+  double applyNs = 0, applyMaxNs = 0;       // gpioService + netService side
+  uint64_t allocs = 0;
+  uint64_t txFrames = 0;
+  uint32_t drops = 0;
+  bool ok = true;
+};
+
+static int failures = 0;
+static char frame[MSG_RX_DOC_SIZE];
+
+static void inject(Result &r, WStype_t type, const void *data, size_t len) {
+  memcpy(frame, data, len); // payload is parsed in place, like the library buffer
+  frame[len] = '\0';
+  uint64_t allocs = host::allocations;
+  Timer t;
+  ws.fire(type, (uint8_t *)frame, len);
+  double ns = t.ns();
+  r.allocs += host::allocations - allocs;
+  r.handlerNs += ns;
+  if (ns > r.handlerMaxNs) r.handlerMaxNs = ns;
+  r.messages++;
+}
+
+static void injectText(Result &r, const char *json) { inject(r, WStype_TEXT, json, strlen(json)); }
+
+// One round of the GPIO and network task bodies until both queues are empty
+static void pump(Result &r) {
+  uint64_t allocs = host::allocations;
+  Timer t;
+  do {
+    gpioService(0);
+    netService();
+  } while (uxQueueMessagesWaiting(cmdQueue) || uxQueueMessagesWaiting(netQueue));
+  double ns = t.ns();
+  r.allocs += host::allocations - allocs;
+  r.applyNs += ns;
+  if (ns > r.applyMaxNs) r.applyMaxNs = ns;
+  logDrain();
+}
+
+static void connect(bool binary) {
+  Result scratch;
+  ws.connected = true;
+  ws.fire(WStype_CONNECTED, nullptr, 0);
+  char msg[128];
+  snprintf(msg, sizeof(msg), "{\"type\":\"auth_success\",\"proto\":\"%s\",\"stateEpoch\":0,\"stateSeq\":0}",
+           binary ? BINPROTO_NAME : "json");
+  injectText(scratch, msg);
+  pump(scratch);
+}
+
+static void check(Result &r, bool cond, const char *what) {
+  if (cond) return;
+  printf("  FAIL %s: %s\n", r.name, what);
+  r.ok = false;
+  failures++;
+}
+
+static void report(const Result &r) {
+  double n = r.messages ? (double)r.messages : 1.0;
+  printf("%-18s %8llu msgs %10.0f msg/s  handler avg %7.0f ns max %8.0f ns  apply max %8.0f ns  %6.2f allocs/msg  tx %6llu  drops %u  %s\n",
+         r.name, (unsigned long long)r.messages, r.handlerNs ? n * 1e9 / (r.handlerNs + r.applyNs) : 0.0,
+         r.handlerNs / n, r.handlerMaxNs, r.applyMaxNs, r.allocs / n,
+         (unsigned long long)r.txFrames, r.drops, r.ok ? "ok" : "FAILED");
+}
+
+// ---- scenarios ----
+static void commandBurst(int count, int pumpEvery) {
+  Result r; r.name = "json commands";
+  uint64_t tx0 = ws.txFrames; uint32_t drops0 = cmdDrops;
+  bool expect[MAX_SWITCHES] = {};
+  for (int i = 0; i < numSwitches; i++) expect[i] = relayState[i];
+  char msg[128];
+  for (int k = 0; k < count; k++) {
+    int idx = rand() % numSwitches;
+    bool on = rand() & 1;
+    snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":%s}", switchCfg[idx].relayPin, on ? "true" : "false");
+    injectText(r, msg);
+    expect[idx] = on;
+    if ((k + 1) % pumpEvery == 0) pump(r);
+  }
+  pump(r);
+  r.txFrames = ws.txFrames - tx0; r.drops = cmdDrops - drops0;
+  for (int i = 0; i < numSwitches; i++) check(r, relayState[i] == expect[i], "relay state after burst");
+  check(r, r.drops == 0, "no queue drops with regular draining");
+#ifdef ARDUINOJSON_VERSION_MAJOR // the real library; a stand-in JSON parser allocates on its own
+  check(r, r.allocs == 0, "no heap allocation on the JSON command path");
+#endif
+  report(r);
+}
+
+static void batchBurst(int count) {
+  Result r; r.name = "json batches";
+  uint64_t tx0 = ws.txFrames; uint32_t drops0 = cmdDrops;
+  char msg[1024];
+  uint32_t last = 0;
+  for (int k = 0; k < count; k++) {
+    uint32_t values = (uint32_t)rand();
+    int n = snprintf(msg, sizeof(msg), "{\"type\":\"switch_command_batch\",\"seq\":%d,\"commands\":[", k + 1);
+    for (int i = 0; i < numSwitches; i++) {
+      n += snprintf(msg + n, sizeof(msg) - n, "%s{\"index\":%d,\"state\":%s}", i ? "," : "", i, (values >> i) & 1 ? "true" : "false");
+    }
+    snprintf(msg + n, sizeof(msg) - n, "]}");
+    injectText(r, msg);
+    last = values;
+    pump(r);
+  }
+  r.txFrames = ws.txFrames - tx0; r.drops = cmdDrops - drops0;
+  for (int i = 0; i < numSwitches; i++) check(r, relayState[i] == (bool)((last >> i) & 1), "relay state after last scene");
+  report(r);
+}
+
+static void binaryBurst(int count, int pumpEvery) {
+  connect(true);
+  Result r; r.name = "bin commands";
+  uint64_t tx0 = ws.txFrames; uint32_t drops0 = cmdDrops;
+  bool expect[MAX_SWITCHES] = {};
+  for (int i = 0; i < numSwitches; i++) expect[i] = relayState[i];
+  uint8_t buf[sizeof(BinHeader) + 4 * sizeof(BinCommandPair)];
+  for (int k = 0; k < count; k++) {
+    BinHeader *h = (BinHeader *)buf;
+    BinCommandPair *p = (BinCommandPair *)(buf + sizeof(BinHeader));
+    binHeader(*h, BIN_COMMAND, 4, (k % 4) ? 0 : k + 1); // every 4th asks for a batch ack
+    for (int j = 0; j < 4; j++) {
+      p[j].index = rand() % numSwitches;
+      p[j].state = rand() & 1;
+    }
+    // Later pairs for the same relay win
+    for (int j = 0; j < 4; j++) expect[p[j].index] = p[j].state;
+    inject(r, WStype_BIN, buf, sizeof(buf));
+    if ((k + 1) % pumpEvery == 0) pump(r);
+  }
+  pump(r);
+  r.txFrames = ws.txFrames - tx0; r.drops = cmdDrops - drops0;
+  for (int i = 0; i < numSwitches; i++) check(r, relayState[i] == expect[i], "relay state after binary burst");
+  check(r, r.allocs == 0, "no heap allocation on the binary command path");
+  report(r);
+  connect(false);
+}
+
+static void configStorm(int count) {
+  Result r; r.name = "config storm";
+  uint64_t nvs0 = host::nvsWrites;
+  char msg[512];
+  for (int k = 0; k < count; k++) {
+    int idx = k % numSwitches;
+    // Entries are positional; an empty object leaves that channel untouched
+    int n = snprintf(msg, sizeof(msg), "{\"type\":\"config_update\",\"switches\":[");
+    for (int i = 0; i < numSwitches; i++) {
+      if (i == idx) n += snprintf(msg + n, sizeof(msg) - n, "%s{\"name\":\"Edit%d\"}", i ? "," : "", k);
+      else n += snprintf(msg + n, sizeof(msg) - n, "%s{}", i ? "," : "");
+    }
+    snprintf(msg + n, sizeof(msg) - n, "]}");
+    injectText(r, msg);
+    pump(r);
+    host::advance(200 * 1000);      // admin edits every 200 ms
+    configCommitTick();
+  }
+  uint64_t during = host::nvsWrites - nvs0;
+  host::advance((CONFIG_COMMIT_IDLE_MS + 100) * 1000ULL);
+  configCommitTick();
+  uint64_t total = host::nvsWrites - nvs0;
+  printf("  config storm: %d updates -> %llu NVS writes while editing, %llu total\n",
+         count, (unsigned long long)during, (unsigned long long)total);
+  uint64_t allowed = 1 + (uint64_t)count * 200 / CONFIG_COMMIT_MAX_MS; // the max-defer flushes
+  check(r, total >= 1 && total <= allowed + 1, "config writes are coalesced");
+  report(r);
+}
+
+// Relays come back after a soft reset (RTC copy) and a power cycle (NVS copy); a
+// wall switch flipped while the board was down wins (BOOT_RESTORE_MERGE)
+static void bootRestore() {
+  Result r; r.name = "boot restore";
+  for (int i = 0; i < numSwitches; i++) setRelay(i, i & 1, false); // a mix the switches do not explain
+  relayDriverFlush();
+  retainRelayState();
+  uint32_t before = relayMask();
+  auto reboot = [](esp_reset_reason_t why) {
+    host::resetReason = why;
+    for (int i = 0; i < MAX_SWITCHES; i++) relayState[i] = false;
+    restoreBootState();
+  };
+#if BOOT_RESTORE_POLICY != BOOT_RESTORE_MANUAL
+  reboot(ESP_RST_SW);
+  check(r, relayMask() == before, "soft reset restores the RTC snapshot");
+
+  host::advance((RELAY_PERSIST_MIN_GAP_MS + RELAY_PERSIST_IDLE_MS + 100) * 1000ULL);
+  relayStateCommitTick();
+  reboot(ESP_RST_POWERON);
+  check(r, relayMask() == before, "power-on restores the NVS snapshot");
+#endif
+
+  int idx = 0;
+  int pin = switchCfg[idx].manualPin;
+  host::pinLevel[pin] = !host::pinLevel[pin]; // flipped while powered off (no ISR)
+  bool active = switchCfg[idx].manualActiveLow ? (host::pinLevel[pin] == LOW) : (host::pinLevel[pin] == HIGH);
+  reboot(ESP_RST_BROWNOUT);
+#if BOOT_RESTORE_POLICY == BOOT_RESTORE_MERGE
+  check(r, relayState[idx] == active && (relayMask() & ~1UL) == (before & ~1UL), "flipped switch wins, others restored");
+#endif
+  report(r);
+}
+
+// Boot joined via a scan; a lost link rejoins the cached AP without scanning and
+// a weak link roams to a stronger AP of the same network
+static void wifiRecovery() {
+  Result r; r.name = "wifi recovery";
+  check(r, wifiManagerConnected() && WiFi.scans == 1, "first boot joins after one scan");
+  wifiManagerCommit();
+  check(r, host::nvs.count("wificache/ap") == 1, "joined AP is cached");
+
+  int scans = WiFi.scans;
+  WiFi.dropLink();
+  netService();
+  check(r, wifiManagerConnected() && WiFi.scans == scans, "link loss rejoins the cached AP directly");
+
+  WiFi.aps[0].rssi = -80;
+  WiFi.aps.push_back({ WIFI_SSID, { 0x02, 0, 0, 0, 0, 2 }, 11, -50 });
+  host::advance((WIFI_ROAM_CHECK_MS + 100) * 1000ULL);
+  netService();
+  netService();
+  check(r, wifiManagerConnected() && wifiManagerRoams() == 1 && WiFi.channel() == 11, "weak link roams to the stronger AP");
+
+  // The DHCP lease as static IP: a few rejoins only, within its age, not past a dead backend
+  auto rejoin = []() { WiFi.dropLink(); netService(); return wifiManagerConnected() && WiFi.staticIp != 0; };
+  bool reused = true;
+  for (int k = 0; k < WIFI_CACHE_IP_MAX_JOINS; k++) reused &= rejoin();
+  check(r, reused, "link loss rejoins on the cached lease");
+  host::wallEpoch = 1760000000LL - (int64_t)(host::nowUs / 1000000); // clock synced: the next lease is dated
+  check(r, !rejoin() && wifiManagerConnected(), "DHCP confirms the lease after WIFI_CACHE_IP_MAX_JOINS reuses");
+  check(r, rejoin(), "a fresh lease is reused again");
+  host::advance(WIFI_CACHE_IP_MAX_AGE_S * 1000000ULL);
+  check(r, !rejoin() && wifiManagerConnected(), "a lease older than WIFI_CACHE_IP_MAX_AGE_S goes back to DHCP");
+  check(r, rejoin(), "cached lease in use");
+  reconnectionAttempts = 0;
+  for (int k = 0; k < WIFI_CACHE_IP_WS_FAILS; k++) inject(r, WStype_DISCONNECTED, "", 0);
+  netService();
+  check(r, wifiManagerConnected() && WiFi.staticIp == 0, "backend unreachable on the cached IP: rejoined with DHCP");
+  check(r, rejoin(), "the lease DHCP hands out instead is cached");
+
+  // Power cuts between joins: no clock at boot, so the join count kept in NVS is the bound
+  host::wallEpoch = 0;
+  auto reboot = []() {
+    wifiManagerCommit();              // what the telemetry task got to write before the cut
+    WiFi.disconnect();
+    wifiManagerBegin();
+    netService();
+    return wifiManagerConnected() && WiFi.staticIp != 0;
+  };
+  int boot = 0, reuses = 0;
+  while (boot < 2 * WIFI_CACHE_IP_MAX_JOINS && reboot()) boot++;       // rest of the budget
+  bool dhcp = boot < 2 * WIFI_CACHE_IP_MAX_JOINS && wifiManagerConnected();
+  while (reuses <= WIFI_CACHE_IP_MAX_JOINS && reboot()) reuses++;
+  check(r, dhcp && reuses == WIFI_CACHE_IP_MAX_JOINS, "WIFI_CACHE_IP_MAX_JOINS holds across reboots");
+
+  // A lease taken before SNTP is dated when the clock is set and ages from then
+  host::wallEpoch = 1760000000LL - (int64_t)(host::nowUs / 1000000);
+  netService();
+  host::advance(WIFI_CACHE_IP_MAX_AGE_S * 1000000ULL);
+  check(r, !rejoin() && wifiManagerConnected(), "a lease from before the clock was set still ages out");
+  reconnectionAttempts = 0;
+  host::wallEpoch = 0;
+  connect(false);
+  printf("  wifi recovery: %d begin calls, %d scans, last connect %lu ms\n", WiFi.beginCalls, WiFi.scans,
+         (unsigned long)wifiManagerLastConnectMs());
+  report(r);
+}
+
+// Rules pushed while online keep firing with the backend unreachable; the
+// executions are reported after the next auth
+static void offlineSchedule() {
+  Result r; r.name = "offline schedule";
+  injectText(r, "{\"type\":\"schedule_update\",\"version\":5,\"rules\":["
+                "{\"id\":7,\"at\":\"18:00\",\"commands\":[{\"index\":0,\"state\":true},{\"index\":1,\"state\":true}]},"
+                "{\"id\":8,\"days\":127,\"at\":\"18:01\",\"commands\":[{\"index\":0,\"state\":false}]},"
+                "{\"id\":9,\"at\":\"25:00\",\"commands\":[{\"index\":0,\"state\":true}]}]}");
+  pump(r);
+  schedulerTick();
+  check(r, schedulerRuleCount() == 2 && host::nvs.count("schedule/rules") == 1, "valid rules stored, bad time rejected");
+
+  setRelay(0, false, false);
+  setRelay(1, false, false);
+  relayDriverFlush();
+  struct tm t = {};
+  t.tm_year = 2026 - 1900; t.tm_mon = 2; t.tm_mday = 2; t.tm_hour = 17; t.tm_min = 59; t.tm_sec = 30; t.tm_isdst = -1;
+  host::wallEpoch = (int64_t)mktime(&t) - (int64_t)(host::nowUs / 1000000); // SNTP: 17:59:30 local
+
+  ws.disconnect();
+  std::vector<std::string> sent;
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) { if (!bin) sent.emplace_back((const char *)p, n); };
+  bool at1800 = false;
+  for (int s = 0; s < 60; s++) {       // 17:59:30 .. 18:00:30, backend down
+    host::advance(1000 * 1000);
+    schedulerTick();
+    pump(r);
+  }
+  at1800 = relayState[0] && relayState[1];
+  for (int s = 0; s < 60; s++) {       // .. 18:01:30
+    host::advance(1000 * 1000);
+    schedulerTick();
+    pump(r);
+  }
+  check(r, at1800, "18:00 rule switched relays 0 and 1 on offline");
+  check(r, !relayState[0] && relayState[1], "18:01 rule switched relay 0 off");
+
+  // SNTP steps the clock back 60 s to 18:00:30: nothing that already ran fires again
+  setRelay(0, true, false);
+  setRelay(1, false, false);
+  relayDriverFlush();
+  host::wallEpoch -= 60;
+  for (int s = 0; s < 90; s++) {       // .. 18:02
+    host::advance(1000 * 1000);
+    schedulerTick();
+    pump(r);
+  }
+  check(r, relayState[0] && !relayState[1], "backward clock step repeats no rule");
+
+  // Power blip at 18:02: boot catch-up covers 18:00 and 18:01, both already ran
+  schedulerBegin(fireScheduleRule);
+  for (int s = 0; s < 10; s++) {
+    host::advance(1000 * 1000);
+    schedulerTick();
+    pump(r);
+  }
+  check(r, relayState[0] && !relayState[1] && host::nvs.count("schedule/fired") == 1,
+        "a reboot right after a fire does not repeat it");
+
+  connect(false);
+  ws.sink = nullptr;
+  int reported = 0;
+  for (const std::string &m : sent) {
+    if (m.find("\"schedule_report\"") != std::string::npos && m.find("\"id\":7") != std::string::npos &&
+        m.find("\"id\":8") != std::string::npos) reported++;
+  }
+  check(r, reported == 1, "both executions reported once after reconnect");
+  report(r);
+}
+
+// Motion switches the linked relays on locally, retriggering keeps them on and the
+// vacancy timeout switches them off; an occupied/vacant burst is folded into
+// rate-limited occupancy messages
+static void pirOccupancy() {
+  Result r; r.name = "pir occupancy";
+  const int pin = 34;
+  injectText(r, "{\"type\":\"config_update\",\"switches\":[],\"pir\":[{\"gpio\":34,\"autoOff\":30,\"linked\":[2,3]}]}");
+  pump(r);
+  for (int i = 0; i < numSwitches; i++) setRelay(i, false, false);
+  relayDriverFlush();
+  std::vector<std::string> sent;
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) { if (!bin) sent.emplace_back((const char *)p, n); };
+  auto settle = [&](uint64_t ms) {
+    for (uint64_t t = 0; t < ms; t += 100) { host::advance(100 * 1000); pump(r); }
+  };
+
+  host::setPin(pin, HIGH);
+  settle(200);
+  check(r, relayState[2] && relayState[3] && !relayState[0], "motion switches the linked relays on");
+  for (int k = 0; k < 10; k++) {     // sitting still: the module drops and retriggers
+    host::setPin(pin, LOW);
+    settle(20 * 1000);
+    host::setPin(pin, HIGH);
+    settle(3 * 1000);
+  }
+  check(r, relayState[2] && relayState[3], "retriggered motion keeps the relays on");
+  host::setPin(pin, LOW);
+  settle(29 * 1000);
+  check(r, relayState[2], "still on inside the vacancy timeout");
+  settle(2 * 1000);
+  check(r, !relayState[2] && !relayState[3] && !occupiedMask, "vacancy timeout switches them off");
+  settle(PIR_REPORT_MIN_MS);
+
+  int reports = 0;
+  std::string last;
+  for (const std::string &m : sent) {
+    if (m.find("\"occupancy\"") == std::string::npos) continue;
+    reports++;
+    last = m;
+  }
+  check(r, reports == 2 && last.find("\"occupied\":0") != std::string::npos, "one occupied and one vacant report");
+  ws.sink = nullptr;
+  printf("  pir occupancy: %llu motion starts -> %d occupancy messages, %zu frames total\n",
+         (unsigned long long)pirMotionCount[0], reports, sent.size());
+  report(r);
+}
+
+// Manual activity during an outage is journaled (some of it spilled to NVS) and
+// replayed oldest first in acked batches after the next auth; a lost ack resends
+// Reconnects and acks every journal batch (the first ack lost if dropFirst) until
+// nothing is pending; returns the records acked and adds each one (absolute uptime,
+// kind, idx, state) to seen. The telemetry task's journalCommit() runs between a
+// batch going out and its ack.
+static int journalDrain(Result &r, bool dropFirst, int &acks, std::set<std::string> &seen) {
+  std::vector<std::string> batches;
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) {
+    std::string m((const char *)p, n);
+    if (!bin && m.find("\"journal\"") != std::string::npos) batches.push_back(m);
+  };
+  connect(false);
+  int records = 0;
+  for (int round = 0; round < 200 && journalPending(); round++) {
+    size_t sent = batches.size();
+    netService();
+    journalCommit();
+    if (batches.size() == sent) { host::advance(100 * 1000); continue; }
+    if (dropFirst) { // first ack lost: the batch must come again after the timeout
+      dropFirst = false;
+      host::advance((JOURNAL_ACK_TIMEOUT_MS + 10) * 1000ULL);
+      continue;
+    }
+    const std::string &m = batches.back();
+    long long up = atoll(m.c_str() + m.find("\"up\":") + 5);
+    for (size_t at = m.find("[", m.find("\"events\"")) + 1; (at = m.find("[", at)) != std::string::npos; at++) {
+      long long d; int kind, idx, state;
+      if (sscanf(m.c_str() + at, "[%lld,%d,%d,%d]", &d, &kind, &idx, &state) != 4) continue;
+      up += d;
+      char key[48];
+      snprintf(key, sizeof(key), "%lld/%d/%d/%d", up, kind, idx, state);
+      seen.insert(key);
+      records++;
+    }
+    char ack[64];
+    snprintf(ack, sizeof(ack), "{\"type\":\"journal_ack\",\"seq\":%lu}", (unsigned long)journalSeq);
+    injectText(r, ack);
+    acks++;
+  }
+  ws.sink = nullptr;
+  return records;
+}
+
+static void journalToggles(Result &r, int pin, int toggles, bool commit) {
+  for (int k = 0; k < toggles; k++) {
+    host::setPin(pin, !host::pinLevel[pin]);
+    host::advance((DEBOUNCE_MS + 5) * 1000ULL);
+    pump(r);
+    if (commit) journalCommit();
+  }
+}
+
+static void journalReplay() {
+  Result r; r.name = "journal replay";
+  int pin = switchCfg[0].manualPin;
+  bool active = switchCfg[0].manualActiveLow ? (host::pinLevel[pin] == LOW) : (host::pinLevel[pin] == HIGH);
+  setRelay(0, active, false); // relay follows the switch, so every toggle changes it
+  relayDriverFlush();
+  ws.disconnect();
+  uint32_t seq0 = journalSeq;
+  uint32_t before = journalPending(); // offline schedule executions nobody acked yet
+  // Manual edge + relay change per toggle: enough to spill, less than RAM + flash hold
+  const int toggles = (JOURNAL_SLOTS + JOURNAL_SPILL_CHUNK * JOURNAL_SPILL_CHUNKS) / 2 - JOURNAL_SPILL_CHUNK;
+  journalToggles(r, pin, toggles, true);
+  uint32_t pending = journalPending();
+  check(r, pending == before + 2 * toggles && host::nvs.count("journal/c0") == 1,
+        "outage events journaled, oldest spilled to NVS");
+  check(r, journalDropped() == 0, "nothing overwritten while flash has room");
+
+  int acks = 0;
+  std::set<std::string> seen;
+  int records = journalDrain(r, true, acks, seen);
+  check(r, journalPending() == 0 && host::nvs.count("journal/c0") == 0, "journal drained, spill chunks removed");
+  check(r, records == (int)(before + 2 * toggles), "every record acked exactly once");
+
+  // Ring at the watermark with flash empty (the telemetry task was busy): the first
+  // batch comes from the ring and journalCommit() runs before its ack
+  ws.disconnect();
+  const int late = JOURNAL_SPILL_AT / 2;
+  journalToggles(r, pin, late, false);
+  check(r, journalPending() == 2 * late && host::nvs.count("journal/meta") == 1, "ring at the spill watermark");
+  seen.clear();
+  int lateRecords = journalDrain(r, false, acks, seen);
+  check(r, lateRecords == 2 * late && (int)seen.size() == lateRecords && journalPending() == 0,
+        "no record lost or repeated when a spill is due mid-batch");
+  printf("  journal replay: %d + %d records in %d acked batches (%lu sent)\n", records, lateRecords, acks,
+         (unsigned long)(journalSeq - seq0));
+  report(r);
+}
+
+// Commands with ids sent back to back: one switch_result each with the applied state
+// and no state_update for them; a resent id is re-acked without being applied again
+static void commandResults() {
+  Result r; r.name = "command results";
+  uint64_t tx0 = ws.txFrames;
+  std::vector<std::string> sent;
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) { if (!bin) sent.emplace_back((const char *)p, n); };
+  const int count = 8;
+  uint32_t id0 = 5000;
+  char msg[160];
+  for (int k = 0; k < count; k++) { // pipelined: nothing waits for the previous result
+    int idx = k % numSwitches;
+    snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":%s,\"seq\":%lu}",
+             switchCfg[idx].relayPin, (k & 1) ? "false" : "true", (unsigned long)(id0 + k));
+    injectText(r, msg);
+  }
+  pump(r);
+  int results = 0, states = 0;
+  bool applied = true;
+  for (const std::string &m : sent) {
+    if (m.find("\"state_update\"") != std::string::npos) states++;
+    if (m.find("\"switch_result\"") == std::string::npos) continue;
+    results++;
+    applied &= m.find("\"success\":true") != std::string::npos && m.find("\"us\":") != std::string::npos;
+  }
+  check(r, results == count && applied, "one successful switch_result per command");
+  check(r, states == 0, "no state_update for relays a result covered");
+
+  // Relay 0 was switched on by id0; id0 + 100 turns it off, then id0 arrives again
+  int gpio0 = switchCfg[0].relayPin;
+  snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":false,\"seq\":%lu}", gpio0,
+           (unsigned long)(id0 + 100));
+  injectText(r, msg);
+  pump(r);
+  sent.clear();
+  snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":true,\"seq\":%lu}", gpio0,
+           (unsigned long)id0);
+  injectText(r, msg);
+  injectText(r, "{\"type\":\"switch_command\",\"gpio\":99,\"state\":true,\"seq\":7}");
+  pump(r);
+  ws.sink = nullptr;
+  check(r, !relayState[0], "resent id not applied again");
+  check(r, sent.size() == 2 && sent[0].find("\"dup\":true") != std::string::npos &&
+           sent[0].find("\"actualState\":false") != std::string::npos, "resent id re-acked with the current state");
+  check(r, sent.size() == 2 && sent[1].find("unknown_gpio") != std::string::npos, "unknown switch answered");
+  r.txFrames = ws.txFrames - tx0;
+  printf("  command results: %d pipelined commands -> %d switch_result, %d state_update; %lu duplicate\n", count,
+         results, states, (unsigned long)dupCommands);
+  report(r);
+}
+
+// Slow socket writes with logs and metrics already queued: state goes out first,
+// superseded deltas are merged and low-priority frames above the watermark dropped
+static void congestedUplink() {
+  Result r; r.name = "congested uplink";
+  uint64_t tx0 = ws.txFrames;
+  TxQueueStats before;
+  txQueueStats(before);
+  std::vector<std::string> types;
+  ws.sink = [&](bool, const uint8_t *p, size_t n) {
+    std::string m((const char *)p, n);
+    size_t at = m.find("\"type\":\"");
+    types.push_back(at == std::string::npos ? "?" : m.substr(at + 8, m.find('"', at + 8) - at - 8));
+    host::advance((TX_SLOW_SEND_US + 5000) * 1ULL); // every write blocks for a while
+  };
+  for (int k = 0; k < 4; k++) injectText(r, "{\"type\":\"get_logs\"}");
+  injectText(r, "{\"type\":\"get_metrics\"}");
+  bool expect[MAX_SWITCHES] = {};
+  for (int i = 0; i < numSwitches; i++) expect[i] = relayState[i];
+  const int changes = NET_QUEUE_DEPTH - 2;
+  char msg[128];
+  for (int k = 0; k < changes; k++) { // one state event per command, none sent yet
+    int idx = k % numSwitches;
+    expect[idx] = !expect[idx];
+    snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":%s}",
+             switchCfg[idx].relayPin, expect[idx] ? "true" : "false");
+    injectText(r, msg);
+    gpioService(0);
+  }
+  check(r, ws.txFrames == tx0, "nothing written from the receive callback");
+  int passes = 0;
+  Timer t;
+  netService();
+  passes++;
+  check(r, types.size() == 1 && types[0] == "state_update", "state goes out before queued logs, one frame per slow pass");
+  while (txQueueFrames() && passes < 100) { netService(); passes++; }
+  double ns = t.ns();
+  r.applyNs += ns; r.applyMaxNs = ns;
+  ws.sink = nullptr;
+
+  TxQueueStats after;
+  txQueueStats(after);
+  int states = 0, logs = 0;
+  for (const std::string &m : types) {
+    if (m == "state_update") states++;
+    if (m == "logs") logs++;
+  }
+  r.txFrames = ws.txFrames - tx0;
+  r.drops = (after.drops[TX_PRIO_BULK] - before.drops[TX_PRIO_BULK]) +
+            (after.drops[TX_PRIO_TELEMETRY] - before.drops[TX_PRIO_TELEMETRY]);
+  check(r, states == 1 && after.merged - before.merged == (uint32_t)changes - 1, "superseded deltas merged into one");
+  check(r, logs >= 1 && logs < 4 && r.drops == (uint32_t)(4 - logs), "logs over the watermark dropped and counted");
+  check(r, types.size() > 1 && types[1] == "metrics", "telemetry before bulk");
+  check(r, after.drops[TX_PRIO_CONTROL] == before.drops[TX_PRIO_CONTROL], "no control frame dropped");
+  for (int i = 0; i < numSwitches; i++) check(r, relayState[i] == expect[i], "relay state after the burst");
+  printf("  congested uplink: %d state changes, %zu frames in %d passes (%d state, %d logs), %u dropped\n",
+         changes, types.size(), passes, states, logs, r.drops);
+  report(r);
+}
+
+static std::string hex(const uint8_t *p, size_t n) {
+  std::string s;
+  char b[3];
+  for (size_t k = 0; k < n; k++) { snprintf(b, sizeof(b), "%02x", p[k]); s += b; }
+  return s;
+}
+
+static void put32(std::vector<uint8_t> &v, uint32_t x) {
+  for (int k = 0; k < 4; k++) v.push_back((uint8_t)(x >> (8 * k)));
+}
+
+// Runs the OTA task body one step at a time with relay commands in between; false once it ended
+static bool otaDownload(Result &r, int &commands, bool &yielded) {
+  char msg[128];
+  for (int step = 0; step < 10000; step++) {
+    if (step % 3 == 1) { // a command arrives mid-download: the next step must not write
+      int idx = step % numSwitches;
+      snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":%s}",
+               switchCfg[idx].relayPin, relayState[idx] ? "false" : "true");
+      bool before = relayState[idx];
+      injectText(r, msg);
+      size_t at = host::flashUpdate.size();
+      otaStep();
+      yielded &= host::flashUpdate.size() == at;
+      pump(r);
+      commands += relayState[idx] != before;
+    }
+    bool more = otaStep();
+    netService();
+    if (!more) return true;
+  }
+  return false;
+}
+
+// ota_update with a corrupted hash, a delta for another build, then a delta with
+// COPY ops against the running image: relays keep switching while it streams, only
+// a verified image is set for boot, and the planned reboot follows
+static void otaUpdate() {
+  Result r; r.name = "ota update";
+  uint64_t tx0 = ws.txFrames;
+  std::vector<std::string> sent;
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) {
+    std::string m((const char *)p, n);
+    if (!bin && m.find("\"ota_status\"") != std::string::npos) sent.push_back(m);
+  };
+  host::flashRunning.resize(64 * 1024);
+  for (uint8_t &b : host::flashRunning) b = (uint8_t)rand();
+  mbedtls_sha256(host::flashRunning.data(), host::flashRunning.size(), host::appDesc.app_elf_sha256, 0);
+
+  // New build: the running image with one region changed and 5000 bytes appended
+  std::vector<uint8_t> image(host::flashRunning);
+  for (int k = 0; k < 3000; k++) image[20000 + k] = (uint8_t)rand();
+  for (int k = 0; k < 5000; k++) image.push_back((uint8_t)rand());
+  uint8_t digest[32];
+  mbedtls_sha256(image.data(), image.size(), digest, 0);
+
+  std::vector<uint8_t> patch = { 'O', 'D', 'P', '1' };
+  put32(patch, image.size());
+  patch.push_back(0x01); put32(patch, 0); put32(patch, 20000);
+  patch.push_back(0x02); put32(patch, 3000); patch.insert(patch.end(), image.begin() + 20000, image.begin() + 23000);
+  patch.push_back(0x01); put32(patch, 23000); put32(patch, host::flashRunning.size() - 23000);
+  patch.push_back(0x02); put32(patch, 5000); patch.insert(patch.end(), image.end() - 5000, image.end());
+  patch.push_back(0xFF);
+  host::httpBodies["https://fw.local/app.bin"] = image;
+  host::httpBodies["https://fw.local/app.odp"] = patch;
+
+  std::string sha = hex(digest, 32), base = hex(host::appDesc.app_elf_sha256, 32);
+  std::string bad = sha;
+  bad[0] = bad[0] == '0' ? '1' : '0';
+  char msg[512];
+  int commands = 0;
+  bool yielded = true;
+
+#if !defined(OTA_CA_CERT) && !defined(OTA_SIGNING_PUBKEY)
+  // No CA and no signing key: nothing authenticates the image, refused before any fetch
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.bin\",\"version\":\"1.1.0\",\"sha256\":\"%s\",\"size\":%zu}",
+           sha.c_str(), image.size());
+  uint32_t gets0 = host::httpGets;
+  injectText(r, msg);
+  pump(r);
+  check(r, host::httpGets == gets0 && sent.size() == 1 && sent[0].find("\"insecure\"") != std::string::npos && !otaBusy(),
+        "unauthenticated update refused");
+  ws.sink = nullptr;
+  r.txFrames = ws.txFrames - tx0;
+  printf("  ota update: refused, built without OTA_CA_CERT / OTA_SIGNING_PUBKEY\n");
+  report(r);
+  return;
+#endif
+
+  // No memory for the OTA task: refused once, nothing left running
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.bin\",\"version\":\"1.1.0\",\"sha256\":\"%s\",\"size\":%zu}",
+           sha.c_str(), image.size());
+  host::failTaskCreate = true;
+  injectText(r, msg);
+  pump(r);
+  host::failTaskCreate = false;
+  check(r, sent.size() == 1 && sent[0].find("\"no_task\"") != std::string::npos && !otaBusy(),
+        "task creation failure reported once");
+  sent.clear();
+
+  // Full image whose hash does not match: written, then rejected
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.bin\",\"version\":\"1.1.0\",\"sha256\":\"%s\",\"size\":%zu}",
+           bad.c_str(), image.size());
+  injectText(r, msg);
+  pump(r);
+  check(r, otaDownload(r, commands, yielded), "full image download ends");
+  check(r, !sent.empty() && sent.back().find("\"reason\":\"sha256\"") != std::string::npos, "hash mismatch reported");
+  check(r, host::bootPartition == &host::partRunning && !host::otaWriting, "rejected image not set for boot");
+  size_t fullReports = sent.size();
+
+  // Delta for a different build: refused before anything is fetched
+  uint32_t gets = host::httpGets;
+  std::string other = base;
+  other[0] = other[0] == '0' ? '1' : '0';
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.odp\",\"version\":\"1.1.0\",\"sha256\":\"%s\",\"size\":%zu,\"delta\":{\"base\":\"%s\"}}",
+           sha.c_str(), image.size(), other.c_str());
+  injectText(r, msg);
+  pump(r);
+  check(r, host::httpGets == gets && sent.size() == fullReports + 1 &&
+           sent.back().find("base_mismatch") != std::string::npos, "delta for another build refused");
+
+  // The real delta
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.odp\",\"version\":\"1.1.0\",\"sha256\":\"%s\",\"size\":%zu,\"delta\":{\"base\":\"%s\"}}",
+           sha.c_str(), image.size(), base.c_str());
+  injectText(r, msg);
+  pump(r);
+  check(r, otaDownload(r, commands, yielded), "delta download ends");
+  check(r, host::flashUpdate == image, "delta rebuilt the new image");
+  check(r, host::bootPartition == &host::partUpdate, "verified image set for boot");
+  check(r, !sent.empty() && sent.back().find("\"state\":\"done\"") != std::string::npos, "done reported");
+  check(r, commands > 0 && yielded, "relays switch during the download, OTA waits for them");
+
+  const HostTask *task = nullptr;
+  for (const HostTask &t : host::tasks) if (!strcmp(t.name, "ota")) task = &t;
+  check(r, task && task->prio < GPIO_TASK_PRIORITY, "OTA runs as a low-priority task");
+  if (task) task->fn(nullptr); // job already finished: waits OTA_REBOOT_DELAY_MS, then the done callback
+  check(r, rebootRequested, "planned reboot requested");
+  snprintf(msg, sizeof(msg), "{\"type\":\"ota_update\",\"url\":\"https://fw.local/app.bin\",\"sha256\":\"%s\"}", sha.c_str());
+  injectText(r, msg);
+  pump(r);
+  check(r, sent.back().find("reboot_pending") != std::string::npos, "no second update before the reboot");
+  ws.sink = nullptr;
+  rebootRequested = false;
+  host::bootPartition = &host::partRunning;
+
+  r.txFrames = ws.txFrames - tx0;
+  printf("  ota update: %zu byte image from a %zu byte delta, %zu ota_status, %d commands applied while downloading\n",
+         image.size(), patch.size(), sent.size(), commands);
+  report(r);
+}
+
+// Virtual time with the net task body every 10 ms and the backend answering pings
+// after pongMs (+ sleepPongMs while modem sleep is on; 0 = it stopped answering)
+struct KeepaliveRun {
+  uint32_t heartbeats = 0, pings = 0, maxGapMs = 0;
+  bool pingOk = true;
+};
+
+static KeepaliveRun keepaliveRun(uint32_t ms, uint32_t pongMs, uint32_t sleepPongMs) {
+  KeepaliveRun k;
+  uint64_t pings0 = ws.pings;
+  uint32_t lastKeep = millis();
+  ws.sink = [&](bool bin, const uint8_t *p, size_t n) {
+    bool hb = bin ? n > 2 && p[2] == BIN_HEARTBEAT : std::string((const char *)p, n).find("\"type\":\"heartbeat\"") != std::string::npos;
+    if (!hb) return;
+    k.heartbeats++;
+    k.maxGapMs = max(k.maxGapMs, (uint32_t)(millis() - lastKeep));
+    lastKeep = millis();
+  };
+  uint64_t seenPings = ws.pings;
+  ws.autoPong = false;
+  uint32_t pongAt = 0;
+  std::vector<uint8_t> pong;
+  for (uint32_t t = 0; t < ms && ws.connected; t += 10) {
+    host::advance(10000);
+    netService();
+    if (ws.pings != seenPings) {
+      seenPings = ws.pings;
+      k.maxGapMs = max(k.maxGapMs, (uint32_t)(millis() - lastKeep));
+      lastKeep = millis();
+      const BinPing *bp = (const BinPing *)ws.lastPing.data();
+      uint32_t relays = 0;
+      for (int i = 0; i < numSwitches; i++) if (relayState[i]) relays |= 1UL << i;
+      k.pingOk &= ws.lastPing.size() == sizeof(BinPing) && bp->h.magic == BINPROTO_MAGIC && bp->h.type == BIN_PING &&
+                  bp->relays == relays;
+      bool asleep = WiFi.psMode != WIFI_PS_NONE;
+      pongAt = pongMs ? millis() + pongMs + (asleep ? sleepPongMs : 0) : 0;
+      pong = ws.lastPing;
+    }
+    if (pongAt && (int32_t)(millis() - pongAt) >= 0) {
+      pongAt = 0;
+      ws.fire(WStype_PONG, pong.data(), pong.size());
+    }
+  }
+  ws.sink = nullptr;
+  ws.autoPong = true;
+  k.pings = ws.pings - pings0;
+  return k;
+}
+
+// Ten idle minutes, a command, modem sleep that turns out too slow, a server hint,
+// then a backend that stops answering
+static void keepaliveCadence() {
+  Result r; r.name = "keepalive";
+  connect(false);
+  uint64_t pings0 = ws.pings;
+  sendKeepalivePing();
+  check(r, ws.pings == pings0 && txQueueFrames() == 1, "ping queued, not written from the caller");
+  txQueueDrain();
+  check(r, ws.pings == pings0 + 1 && ws.lastPing.size() == sizeof(BinPing), "drain writes the ping");
+  uint64_t tx0 = ws.txFrames;
+  const uint32_t idleMs = 600000;
+  KeepaliveRun idle = keepaliveRun(idleMs, 30, 100); // DTIM ~100 ms: within the bound
+  check(r, idle.pingOk, "ping carries BinPing telemetry with the relay mask");
+  check(r, idle.maxGapMs <= KEEPALIVE_PING_MS + 20, "something reaches the backend every ping interval");
+  check(r, idle.heartbeats <= KEEPALIVE_ACTIVE_MS / HEARTBEAT_INTERVAL_MS + idleMs / HEARTBEAT_IDLE_INTERVAL_MS + 1,
+        "idle heartbeats stretched");
+  check(r, idle.heartbeats + idle.pings < 2 * idleMs / HEARTBEAT_INTERVAL_MS, "less than heartbeat + library ping");
+  check(r, WiFi.psMode == WIFI_PS_MIN_MODEM, "modem sleep while idle");
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "{\"type\":\"switch_command\",\"gpio\":%d,\"state\":%s}", switchCfg[0].relayPin,
+           relayState[0] ? "false" : "true");
+  injectText(r, msg);
+  pump(r);
+  check(r, WiFi.psMode == WIFI_PS_NONE, "radio awake right after a command");
+  KeepaliveRun active = keepaliveRun(KEEPALIVE_ACTIVE_MS, 30, 100);
+  check(r, active.heartbeats >= KEEPALIVE_ACTIVE_MS / HEARTBEAT_INTERVAL_MS - 1, "short heartbeat while active");
+
+  KeepaliveStats ka0;
+  keepaliveStats(ka0);
+  KeepaliveRun slow = keepaliveRun(POWER_HOT_MS + 2 * KEEPALIVE_PING_MS, 30, POWER_MAX_CMD_LATENCY_MS + 150);
+  KeepaliveStats ka;
+  keepaliveStats(ka);
+  check(r, ka.sleepBackoffs == ka0.sleepBackoffs + 1 && WiFi.psMode == WIFI_PS_NONE, "sleep over the latency bound suspended");
+
+  injectText(r, "{\"type\":\"keepalive\",\"heartbeatMs\":120000,\"pingMs\":25000}");
+  pump(r);
+  KeepaliveRun hinted = keepaliveRun(idleMs, 30, 100);
+  check(r, hinted.heartbeats <= idleMs / 120000 + 1 && hinted.maxGapMs <= 25000 + 20, "server hint followed");
+
+  uint32_t t0 = millis();
+  keepaliveRun(idleMs, 0, 0);
+  uint32_t detectMs = millis() - t0;
+  check(r, !ws.connected && detectMs <= 25000 + KEEPALIVE_MISSED_PONGS * KEEPALIVE_PONG_TIMEOUT_MS + 100,
+        "dead link dropped after the missed pongs");
+  keepaliveHint(KEEPALIVE_PING_MS, HEARTBEAT_IDLE_INTERVAL_MS);
+  connect(false);
+
+  r.txFrames = ws.txFrames - tx0;
+  r.messages = 2;
+  printf("  keepalive: idle 10 min %u heartbeats + %u pings (was %u), active 1 min %u heartbeats, sleep adds %lu ms -> %lu ms (backoff), dead link found in %lu ms\n",
+         idle.heartbeats, idle.pings, 2 * idleMs / HEARTBEAT_INTERVAL_MS, active.heartbeats, (unsigned long)ka0.sleepAddedMs,
+         (unsigned long)ka.sleepAddedMs, (unsigned long)detectMs);
+  (void)slow;
+  report(r);
+}
+
+// Factory config comes from the selected board profile and relays are driven
+// with its polarity (the pin checks themselves are static_asserts)
+static void boardProfile() {
+  Result r; r.name = "board profile";
+  check(r, numSwitches == DEFAULT_SWITCH_COUNT, "channel count from the profile");
+  for (int i = 0; i < DEFAULT_SWITCH_COUNT; i++) {
+    const BoardChannel &ch = Board::channels[i];
+    check(r, switchCfg[i].relayPin == ch.relay && switchCfg[i].manualPin == ch.manual &&
+             switchCfg[i].manualActiveLow == ch.manualActiveLow && !strcmp(switchCfg[i].name, ch.name),
+          "factory channel matches the profile table");
+  }
+#if RELAY_DRIVER == RELAY_DRIVER_GPIO
+  bool was[MAX_SWITCHES];
+  for (int i = 0; i < numSwitches; i++) was[i] = relayState[i];
+  for (int on = 0; on < 2; on++) {
+    for (int i = 0; i < numSwitches; i++) setRelay(i, on, false);
+#if RELAY_STAGGER_GROUP > 0
+    while (uint32_t ms = relayDriverService()) host::advance(ms * 1000ULL);
+    host::advance(RELAY_STAGGER_MS * 1000ULL); // no group went out just before
+#endif
+    relayDriverFlush();
+#if RELAY_STAGGER_GROUP > 0
+    int switched = 0;
+    for (int i = 0; i < numSwitches; i++) switched += switchCfg[i].relayPin >= 0 && host::pinLevel[switchCfg[i].relayPin] == (on != kRelayActiveLow ? HIGH : LOW);
+    check(r, !on || switched == min(numSwitches, RELAY_STAGGER_GROUP), "only the first ON group switches in the flush");
+    while (uint32_t ms = relayDriverService()) host::advance(ms * 1000ULL); // the GPIO task loop
+#endif
+    for (int i = 0; i < numSwitches; i++) {
+      int pin = switchCfg[i].relayPin;
+      if (pin >= 0) check(r, host::pinLevel[pin] == (on != kRelayActiveLow ? HIGH : LOW), "relay pin level follows the profile polarity");
+    }
+  }
+  for (int i = 0; i < numSwitches; i++) setRelay(i, was[i], false);
+  relayDriverFlush();
+  while (uint32_t ms = relayDriverService()) host::advance(ms * 1000ULL);
+#endif
+  printf("  board profile: %s, %d channels, relays active-%s\n", Board::id, DEFAULT_SWITCH_COUNT,
+         kRelayActiveLow ? "low" : "high");
+  report(r);
+}
+
+static void bouncingSwitches(int toggles) {
+  Result r; r.name = "bouncing switches";
+  uint64_t tx0 = ws.txFrames; uint32_t drops0 = cmdDrops;
+  uint64_t edges = 0;
+  for (int k = 0; k < toggles; k++) {
+    int idx = rand() % numSwitches;
+    int pin = switchCfg[idx].manualPin;
+    if (pin < 0) continue;
+    int target = !digitalRead(pin);
+    int bounces = 3 + rand() % 12;
+    uint64_t allocs = host::allocations;
+    Timer t;
+    for (int b = 0; b < bounces; b++) { // contact chatter, ending on the new level
+      host::setPin(pin, (b & 1) ? !target : target);
+      host::advance(200 + rand() % 2500);
+      edges++;
+    }
+    host::setPin(pin, target);
+    double ns = t.ns();
+    r.allocs += host::allocations - allocs;
+    r.handlerNs += ns;
+    if (ns > r.handlerMaxNs) r.handlerMaxNs = ns;
+    r.messages++;
+    host::advance((DEBOUNCE_MS + 5) * 1000ULL); // window expires, debounced edge is queued
+    pump(r);
+    bool active = switchCfg[idx].manualActiveLow ? (target == LOW) : (target == HIGH);
+    check(r, relayState[idx] == active, "relay follows the settled switch position");
+  }
+  r.txFrames = ws.txFrames - tx0; r.drops = cmdDrops - drops0;
+  const LatencyHist &h = latency[LAT_MANUAL_RELAY];
+  printf("  bouncing switches: %llu edges, manual edge->relay (virtual) p50 %lu us p99 %lu us max %lu us\n",
+         (unsigned long long)edges, (unsigned long)h.percentile(50), (unsigned long)h.percentile(99), (unsigned long)h.maxUs);
+  report(r);
+}
+
+}  // namespace sim
+
+int main(int argc, char **argv) {
+  int scale = argc > 1 ? atoi(argv[1]) : 1;
+  if (scale < 1) scale = 1;
+  srand(12345);
+  WiFi.aps.push_back({ WIFI_SSID, { 0x02, 0, 0, 0, 0, 1 }, 6, -55 });
+
+  setup();
+  sim::connect(false);
+
+  sim::boardProfile();
+  sim::commandBurst(20000 * scale, 8);
+  sim::batchBurst(2000 * scale);
+  sim::binaryBurst(20000 * scale, 8);
+  sim::configStorm(200 * scale);  // 40 s of edits: spans one max-defer flush
+  sim::bouncingSwitches(500 * scale);
+  sim::wifiRecovery();
+  sim::bootRestore();
+  sim::offlineSchedule();
+  sim::pirOccupancy();
+  sim::journalReplay();
+  sim::congestedUplink();
+  sim::commandResults();
+  sim::otaUpdate();
+  sim::keepaliveCadence();
+
+  printf("%s (%d failure%s)\n", sim::failures ? "FAILED" : "PASSED", sim::failures, sim::failures == 1 ? "" : "s");
+  return sim::failures ? 1 : 0;
+}
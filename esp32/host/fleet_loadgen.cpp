@@ -0,0 +1,896 @@
+// Fleet load generator for backend/ws-server.js: emulates many ESP32 devices over
+// plain ws:// from one epoll loop, plus one UI "controller" connection that
+// sends switch_command and times the round trip until the device's
+// state_update comes back through the server broadcast.
+//
+// Each emulated device speaks the websocket_example.cpp protocol: auth
+// (mac, secretKey, optional proto bin1), full_state after auth_success,
+// periodic heartbeat, state_update on manual toggles and on switch_command /
+// switch_command_batch (or BIN_COMMAND), state_ack tracking and retry_after.
+// Disconnects reconnect with the firmware's jittered backoff.
+//
+// The fleet is grown through --steps; at each size the tool measures for
+// --step-secs and prints command RTT percentiles, losses and message rates.
+// --storm-frac drops that share of the fleet at once in the middle of each
+// step and reports how long the server takes to re-auth them.
+//
+// Linux only, no dependencies (see README.md). The server handshake reply is
+// checked for "101" only; Sec-WebSocket-Accept is not verified.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../binproto.h"
+
+namespace {
+
+// ---------------- Options ----------------
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 4000;
+  std::string path = "/";
+  std::string secret = "9545c46f0f9f494a27412fce1f5b22095550c4e88d82868f"; // DEVICE_SECRET_KEY
+  std::vector<int> steps = { 100, 500, 1000, 2000 };
+  int stepSecs = 20;
+  int rampPerSec = 500;          // new connections per second while growing
+  int heartbeatMs = 15000;       // HEARTBEAT_INTERVAL_MS
+  double togglesPerMin = 1.0;    // manual toggles per device per minute
+  double cmdPerSec = 20;         // controller switch_command rate
+  double batchShare = 0.1;       // share of controller commands sent as switch_command_batch
+  double stormFrac = 0;          // share of the fleet dropped at once mid-step
+  bool stormJitter = true;       // false: reconnect immediately (lockstep fleet)
+  bool binary = false;           // offer bin1 at auth
+  int cmdTimeoutMs = 5000;
+};
+
+Options opt;
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::mt19937_64 rng(0x5eed);
+double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+uint64_t expDelayUs(double perSec) { return perSec > 0 ? (uint64_t)(-std::log(1 - uniform()) / perSec * 1e6) : UINT64_MAX; }
+
+// Stock board map (board_profile.h, BOARD_STOCK_6CH)
+const int kSwitches = 6;
+const int kRelayGpio[kSwitches] = { 4, 16, 17, 5, 19, 18 };
+const int kManualGpio[kSwitches] = { 25, 27, 32, 33, 12, 14 };
+const char *kNames[kSwitches] = { "Fan1", "Fan2", "Light1", "Light2", "Projector", "NComputing" };
+
+// ---------------- Tiny JSON field scanner ----------------
+// The server's messages are flat and machine-written; a key search is enough.
+const char *jsonFind(const char *s, const char *end, const char *key) {
+  size_t k = strlen(key);
+  for (const char *p = s; p + k + 3 <= end; p++) {
+    if (p[0] == '"' && !memcmp(p + 1, key, k) && p[k + 1] == '"') {
+      p += k + 2;
+      while (p < end && (*p == ':' || *p == ' ')) p++;
+      return p;
+    }
+  }
+  return nullptr;
+}
+bool jsonInt(const char *s, const char *end, const char *key, long &out) {
+  const char *p = jsonFind(s, end, key);
+  if (!p) return false;
+  out = strtol(p, nullptr, 10);
+  return true;
+}
+bool jsonBool(const char *s, const char *end, const char *key, bool &out) {
+  const char *p = jsonFind(s, end, key);
+  if (!p) return false;
+  out = (*p == 't' || *p == '1');
+  return true;
+}
+bool jsonStr(const char *s, const char *end, const char *key, std::string &out) {
+  const char *p = jsonFind(s, end, key);
+  if (!p || *p != '"') return false;
+  const char *q = (const char *)memchr(p + 1, '"', end - p - 1);
+  if (!q) return false;
+  out.assign(p + 1, q);
+  return true;
+}
+// End of the object/array starting at p ('{' or '['), ignoring strings
+const char *jsonClose(const char *p, const char *end) {
+  int depth = 0;
+  bool str = false;
+  for (; p < end; p++) {
+    if (str) { if (*p == '\\') p++; else if (*p == '"') str = false; continue; }
+    if (*p == '"') str = true;
+    else if (*p == '{' || *p == '[') depth++;
+    else if ((*p == '}' || *p == ']') && --depth == 0) return p + 1;
+  }
+  return end;
+}
+
+// ---------------- Connection / WebSocket framing ----------------
+enum ConnState { IDLE, CONNECTING, HANDSHAKE, OPEN };
+
+struct Conn {
+  int fd = -1;
+  ConnState state = IDLE;
+  std::string rx;
+  std::string tx;       // unsent bytes (kept only when the socket is full)
+  bool wantOut = false;
+};
+
+int epfd = -1;
+sockaddr_in serverAddr;
+
+struct Stats {
+  uint64_t txMsgs = 0, rxMsgs = 0, txBytes = 0, rxBytes = 0;
+  uint64_t connects = 0, connectFails = 0, disconnects = 0, auths = 0, retryAfter = 0;
+  void reset() { *this = Stats(); }
+} stats;
+
+void epollSet(Conn &c, void *tag, bool add) {
+  epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLRDHUP | (c.wantOut ? (uint32_t)EPOLLOUT : 0u);
+  ev.data.ptr = tag;
+  epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+bool openSocket(Conn &c, void *tag) {
+  c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c.fd < 0) return false;
+  int one = 1;
+  setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int rc = connect(c.fd, (sockaddr *)&serverAddr, sizeof(serverAddr));
+  if (rc < 0 && errno != EINPROGRESS) {
+    close(c.fd);
+    c.fd = -1;
+    return false;
+  }
+  c.state = CONNECTING;
+  c.wantOut = true; // writable = connect finished
+  c.rx.clear();
+  c.tx.clear();
+  epollSet(c, tag, true);
+  stats.connects++;
+  return true;
+}
+
+void closeSocket(Conn &c) {
+  if (c.fd >= 0) close(c.fd); // also removes it from the epoll set
+  c.fd = -1;
+  c.state = IDLE;
+  c.rx.clear();
+  c.tx.clear();
+  c.wantOut = false;
+}
+
+void flushTx(Conn &c, void *tag) {
+  while (!c.tx.empty()) {
+    ssize_t n = send(c.fd, c.tx.data(), c.tx.size(), MSG_NOSIGNAL);
+    if (n <= 0) break;
+    c.tx.erase(0, n);
+  }
+  bool want = !c.tx.empty();
+  if (want != c.wantOut) {
+    c.wantOut = want;
+    epollSet(c, tag, false);
+  }
+}
+
+void sendRaw(Conn &c, void *tag, const char *data, size_t len) {
+  stats.txBytes += len;
+  if (c.tx.empty()) {
+    ssize_t n = send(c.fd, data, len, MSG_NOSIGNAL);
+    if (n == (ssize_t)len) return;
+    if (n < 0) n = 0;
+    data += n;
+    len -= n;
+  }
+  c.tx.append(data, len);
+  flushTx(c, tag);
+}
+
+// Client frames are masked (RFC 6455 5.3)
+void sendFrame(Conn &c, void *tag, uint8_t opcode, const void *payload, size_t len) {
+  char buf[16 + 2048];
+  std::string big;
+  char *out = buf;
+  if (len > 2048) { big.resize(len + 16); out = &big[0]; }
+  size_t h = 0;
+  out[h++] = (char)(0x80 | opcode);
+  if (len < 126) {
+    out[h++] = (char)(0x80 | len);
+  } else if (len < 65536) {
+    out[h++] = (char)(0x80 | 126);
+    out[h++] = (char)(len >> 8);
+    out[h++] = (char)len;
+  } else {
+    out[h++] = (char)(0x80 | 127);
+    for (int i = 7; i >= 0; i--) out[h++] = (char)((uint64_t)len >> (8 * i));
+  }
+  uint32_t key = (uint32_t)rng();
+  memcpy(out + h, &key, 4);
+  const uint8_t *m = (const uint8_t *)(out + h);
+  h += 4;
+  const uint8_t *p = (const uint8_t *)payload;
+  for (size_t i = 0; i < len; i++) out[h + i] = (char)(p[i] ^ m[i & 3]);
+  sendRaw(c, tag, out, h + len);
+  if (opcode == 0x1 || opcode == 0x2) stats.txMsgs++;
+}
+
+void sendText(Conn &c, void *tag, const std::string &s) { sendFrame(c, tag, 0x1, s.data(), s.size()); }
+
+void sendHandshake(Conn &c, void *tag) {
+  char req[512];
+  int n = snprintf(req, sizeof(req),
+                   "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                   opt.path.c_str(), opt.host.c_str(), opt.port);
+  c.state = HANDSHAKE;
+  sendRaw(c, tag, req, n);
+}
+
+// Frame callback: opcode + payload; return false to drop the connection
+template <typename OnFrame>
+bool readFrames(Conn &c, void *tag, OnFrame onFrame) {
+  char buf[65536];
+  for (;;) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if (n == 0) return false;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    stats.rxBytes += n;
+    c.rx.append(buf, n);
+  }
+  if (c.state == HANDSHAKE) {
+    size_t end = c.rx.find("\r\n\r\n");
+    if (end == std::string::npos) return true;
+    if (c.rx.compare(0, 12, "HTTP/1.1 101") != 0) return false;
+    c.rx.erase(0, end + 4);
+    c.state = OPEN;
+    if (!onFrame(0xFF, nullptr, 0)) return false; // "open" pseudo-frame
+    if (c.fd < 0) return true;
+  }
+  size_t off = 0;
+  while (c.rx.size() - off >= 2) {
+    const uint8_t *b = (const uint8_t *)c.rx.data() + off;
+    size_t avail = c.rx.size() - off;
+    uint8_t opcode = b[0] & 0x0F;
+    uint64_t len = b[1] & 0x7F;
+    size_t h = 2;
+    if (len == 126) { if (avail < 4) break; len = (b[2] << 8) | b[3]; h = 4; }
+    else if (len == 127) {
+      if (avail < 10) break;
+      len = 0;
+      for (int i = 0; i < 8; i++) len = (len << 8) | b[2 + i];
+      h = 10;
+    }
+    if (avail < h + len) break;
+    const char *payload = (const char *)b + h;
+    if (opcode == 0x9) sendFrame(c, tag, 0xA, payload, len);   // ping -> pong
+    else if (opcode == 0x8) return false;                       // close
+    else if (opcode == 0x1 || opcode == 0x2) {
+      stats.rxMsgs++;
+      if (!onFrame(opcode, payload, len)) return false;
+      if (c.fd < 0) return true; // the handler closed it (rx is gone)
+    }
+    off += h + len;
+  }
+  c.rx.erase(0, off);
+  return true;
+}
+
+// ---------------- Emulated device ----------------
+struct Device {
+  int id;
+  Conn conn;
+  char mac[18];
+  bool authed = false;
+  bool binMode = false;
+  bool wanted = false;          // part of the current fleet size
+  bool relay[kSwitches] = {};
+  uint32_t epoch = 0, seq = 0, acked = 0;
+  uint32_t changeSeq[kSwitches] = {};
+  int attempts = 0;
+  uint64_t nextConnectUs = 0, nextHeartbeatUs = 0, nextToggleUs = 0;
+  uint64_t droppedAtUs = 0;     // storm victim waiting for re-auth
+  uint64_t bootUs = 0;
+};
+
+std::vector<Device> fleet;
+std::unordered_map<std::string, int> byMac;
+uint64_t stormVictims = 0, stormRecovered = 0, stormLastUs = 0;
+
+// Jittered exponential backoff like nextReconnectDelay() (equal jitter)
+uint64_t reconnectDelayUs(Device &d) {
+  if (!opt.stormJitter) return 0;
+  uint64_t ceil = 1000ULL << std::min(d.attempts, 5);
+  ceil = std::min<uint64_t>(ceil, 30000);
+  return (ceil / 2 + (uint64_t)(uniform() * (ceil / 2))) * 1000;
+}
+
+void deviceDrop(Device &d, uint64_t now, uint64_t delayUs) {
+  closeSocket(d.conn);
+  if (d.authed) stats.disconnects++;
+  d.authed = false;
+  d.binMode = false;
+  d.attempts++;
+  d.nextConnectUs = now + delayUs;
+}
+
+uint32_t changedSince(const Device &d, uint32_t seq) {
+  uint32_t m = 0;
+  for (int i = 0; i < kSwitches; i++) if (d.changeSeq[i] > seq) m |= 1u << i;
+  return m;
+}
+
+void sendFullState(Device &d) {
+  std::string s = "{\"type\":\"full_state\",\"mac\":\"";
+  s += d.mac;
+  s += "\",\"seq\":" + std::to_string(d.seq) + ",\"epoch\":" + std::to_string(d.epoch) + ",\"switches\":[";
+  for (int i = 0; i < kSwitches; i++) {
+    char e[128];
+    snprintf(e, sizeof(e), "%s{\"name\":\"%s\",\"gpio\":%d,\"manual\":%d,\"state\":%s}", i ? "," : "",
+             kNames[i], kRelayGpio[i], kManualGpio[i], d.relay[i] ? "true" : "false");
+    s += e;
+  }
+  s += "]}";
+  sendText(d.conn, &d, s);
+}
+
+void sendStateDelta(Device &d, uint32_t include) {
+  uint32_t changed = include | changedSince(d, d.acked);
+  if (!changed) return;
+  if (d.binMode) {
+    BinDelta f;
+    uint32_t mask = 0;
+    for (int i = 0; i < kSwitches; i++) if (d.relay[i]) mask |= 1u << i;
+    binHeader(f.h, BIN_DELTA, kSwitches, d.seq);
+    f.epoch = d.epoch;
+    f.base = d.acked;
+    f.changed = changed;
+    f.state = mask;
+    sendFrame(d.conn, &d, 0x2, &f, sizeof(f));
+    return;
+  }
+  char buf[1024];
+  int n = snprintf(buf, sizeof(buf), "{\"type\":\"state_update\",\"seq\":%u,\"epoch\":%u,\"base\":%u,\"changed\":%u,\"switches\":[",
+                   d.seq, d.epoch, d.acked, changed);
+  int last = -1, count = 0;
+  for (int i = 0; i < kSwitches; i++) {
+    if (!(changed & (1u << i))) continue;
+    n += snprintf(buf + n, sizeof(buf) - n, "%s{\"name\":\"%s\",\"gpio\":%d,\"state\":%s}", count ? "," : "",
+                  kNames[i], kRelayGpio[i], d.relay[i] ? "true" : "false");
+    last = i;
+    count++;
+  }
+  n += snprintf(buf + n, sizeof(buf) - n, "]");
+  if (count == 1) {
+    n += snprintf(buf + n, sizeof(buf) - n, ",\"name\":\"%s\",\"gpio\":%d,\"state\":%s", kNames[last],
+                  kRelayGpio[last], d.relay[last] ? "true" : "false");
+  }
+  n += snprintf(buf + n, sizeof(buf) - n, "}");
+  sendFrame(d.conn, &d, 0x1, buf, n);
+}
+
+void sendHeartbeat(Device &d, uint64_t now) {
+  uint32_t uptime = (uint32_t)((now - d.bootUs) / 1000000);
+  if (d.binMode) {
+    BinHeartbeat f;
+    binHeader(f.h, BIN_HEARTBEAT, 0, 0);
+    f.uptime = uptime;
+    f.rssi = -60;
+    f.tls10ms = 0;
+    f.storms = 0;
+    f.freeHeap = 180000;
+    sendFrame(d.conn, &d, 0x2, &f, sizeof(f));
+    return;
+  }
+  char buf[256];
+  int n = snprintf(buf, sizeof(buf),
+                   "{\"type\":\"heartbeat\",\"mac\":\"%s\",\"uptime\":%u,\"rssi\":-60,\"storms\":0,"
+                   "\"tls\":{\"ms\":0,\"maxMs\":0,\"heap\":0},\"heapMax\":110000,\"loopMaxUs\":0,\"cmdQHwm\":0,\"lat\":{}}",
+                   d.mac, uptime);
+  sendFrame(d.conn, &d, 0x1, buf, n);
+}
+
+// Apply (index, state) pairs; returns the mask of relays that changed
+uint32_t applyCommands(Device &d, const int *idx, const bool *state, int n) {
+  uint32_t mask = 0;
+  for (int k = 0; k < n; k++) {
+    int i = idx[k];
+    if (i < 0 || i >= kSwitches) continue;
+    if (d.relay[i] != state[k]) {
+      d.relay[i] = state[k];
+      d.changeSeq[i] = ++d.seq;
+    }
+    mask |= 1u << i;
+  }
+  return mask;
+}
+
+int gpioToIndex(long gpio) {
+  for (int i = 0; i < kSwitches; i++) if (kRelayGpio[i] == gpio) return i;
+  return -1;
+}
+
+void sendBatchAck(Device &d, uint32_t seq, uint32_t mask, int rejected) {
+  if (d.binMode) {
+    BinBatchAck f;
+    uint32_t state = 0;
+    for (int i = 0; i < kSwitches; i++) if (d.relay[i]) state |= 1u << i;
+    binHeader(f.h, BIN_BATCH_ACK, rejected, seq);
+    f.applied = mask;
+    f.state = state;
+    sendFrame(d.conn, &d, 0x2, &f, sizeof(f));
+    return;
+  }
+  std::string s = "{\"type\":\"switch_batch_ack\",\"seq\":" + std::to_string(seq) +
+                  ",\"rejected\":" + std::to_string(rejected) + ",\"switches\":[";
+  int applied = 0;
+  for (int i = 0; i < kSwitches; i++) {
+    if (!(mask & (1u << i))) continue;
+    char e[64];
+    snprintf(e, sizeof(e), "%s{\"gpio\":%d,\"state\":%s}", applied ? "," : "", kRelayGpio[i], d.relay[i] ? "true" : "false");
+    s += e;
+    applied++;
+  }
+  s += "],\"applied\":" + std::to_string(applied) + "}";
+  sendText(d.conn, &d, s);
+}
+
+bool deviceFrame(Device &d, uint8_t opcode, const char *p, size_t len, uint64_t now) {
+  if (opcode == 0xFF) { // socket open: auth
+    std::string s = "{\"type\":\"auth\",\"mac\":\"";
+    s += d.mac;
+    s += "\",\"secretKey\":\"" + opt.secret + "\"";
+    if (opt.binary) s += ",\"proto\":\"" BINPROTO_NAME "\"";
+    s += "}";
+    sendText(d.conn, &d, s);
+    return true;
+  }
+  if (opcode == 0x2) {
+    if (!binHeaderValid((const uint8_t *)p, len)) return true;
+    const BinHeader *h = (const BinHeader *)p;
+    if (h->type == BIN_STATE_ACK) {
+      if (h->seq <= d.seq && h->seq > d.acked) d.acked = h->seq;
+    } else if (h->type == BIN_COMMAND) {
+      int idx[256]; bool state[256]; int n = 0;
+      const BinCommandPair *pairs = (const BinCommandPair *)(p + sizeof(BinHeader));
+      for (int k = 0; k < h->count && sizeof(BinHeader) + (k + 1) * sizeof(BinCommandPair) <= len; k++) {
+        idx[n] = pairs[k].index;
+        state[n++] = pairs[k].state;
+      }
+      uint32_t mask = applyCommands(d, idx, state, n);
+      if (h->seq) sendBatchAck(d, h->seq, mask, h->count - __builtin_popcount(mask));
+      sendStateDelta(d, mask);
+    }
+    return true;
+  }
+  const char *end = p + len;
+  std::string type;
+  if (!jsonStr(p, end, "type", type)) return true;
+  if (type == "auth_success") {
+    d.authed = true;
+    d.attempts = 0;
+    stats.auths++;
+    std::string proto;
+    d.binMode = jsonStr(p, end, "proto", proto) && proto == BINPROTO_NAME;
+    d.acked = 0;
+    sendFullState(d);
+    d.nextHeartbeatUs = now + (uint64_t)(uniform() * opt.heartbeatMs * 1000);
+    if (d.droppedAtUs) {
+      stormRecovered++;
+      stormLastUs = now;
+      d.droppedAtUs = 0;
+    }
+  } else if (type == "state_ack") {
+    long seq, epoch = d.epoch;
+    jsonInt(p, end, "stateEpoch", epoch);
+    if (jsonInt(p, end, "seq", seq) && (uint32_t)epoch == d.epoch && seq <= d.seq && seq > d.acked) d.acked = seq;
+  } else if (type == "switch_command") {
+    long gpio = -1, index = -1;
+    bool state = false;
+    jsonBool(p, end, "state", state);
+    int i = jsonInt(p, end, "index", index) ? (int)index : (jsonInt(p, end, "gpio", gpio) ? gpioToIndex(gpio) : -1);
+    uint32_t mask = applyCommands(d, &i, &state, 1);
+    sendStateDelta(d, mask);
+  } else if (type == "switch_command_batch") {
+    const char *arr = jsonFind(p, end, "commands");
+    int idx[64]; bool state[64]; int n = 0, total = 0;
+    if (arr && *arr == '[') {
+      const char *arrEnd = jsonClose(arr, end);
+      for (const char *q = arr + 1; q < arrEnd && n < 64;) {
+        const char *o = (const char *)memchr(q, '{', arrEnd - q);
+        if (!o) break;
+        const char *oe = jsonClose(o, arrEnd);
+        long v;
+        bool s = false;
+        jsonBool(o, oe, "state", s);
+        idx[n] = jsonInt(o, oe, "index", v) ? (int)v : (jsonInt(o, oe, "gpio", v) ? gpioToIndex(v) : -1);
+        state[n++] = s;
+        total++;
+        q = oe;
+      }
+    }
+    long seq = 0;
+    jsonInt(p, end, "seq", seq);
+    uint32_t mask = applyCommands(d, idx, state, n);
+    sendBatchAck(d, (uint32_t)seq, mask, total - __builtin_popcount(mask));
+    sendStateDelta(d, mask);
+  } else if (type == "retry_after") {
+    long ms = 0;
+    jsonInt(p, end, "ms", ms);
+    stats.retryAfter++;
+    // The firmware waits retry_after..1.5x before its next attempt
+    deviceDrop(d, now, (uint64_t)ms * 1000 + (uint64_t)(uniform() * ms * 500));
+    return true;
+  } else if (type == "auth_failed") {
+    deviceDrop(d, now, 30000000);
+    return true;
+  }
+  return true;
+}
+
+void deviceToggle(Device &d) {
+  int i = (int)(rng() % kSwitches);
+  bool s = !d.relay[i];
+  uint32_t mask = applyCommands(d, &i, &s, 1);
+  sendStateDelta(d, mask);
+}
+
+// ---------------- Controller (UI client) ----------------
+struct Pending {
+  uint64_t sentUs;
+  bool state;
+};
+
+Conn controller;
+int controllerTag; // epoll tag address
+bool controllerOpen = false;
+std::unordered_map<uint64_t, Pending> pending; // (device << 8 | relay) -> outstanding command
+std::vector<uint32_t> rttUs;
+uint64_t cmdSent = 0, cmdAnswered = 0, cmdLost = 0;
+uint64_t nextCmdUs = 0;
+uint64_t batchSeq = 0;
+
+void controllerSend(uint64_t now) {
+  // Pick a random authed device; a few probes are enough at any sane fleet size
+  Device *target = nullptr;
+  for (int tries = 0; tries < 16 && !target; tries++) {
+    Device &d = fleet[rng() % fleet.size()];
+    if (d.authed && d.wanted) target = &d;
+  }
+  if (!target) return;
+  Device &d = *target;
+  char buf[512];
+  int n;
+  if (uniform() < opt.batchShare) {
+    // Scene across all relays; timed on the last relay's state_update
+    bool on = rng() & 1;
+    n = snprintf(buf, sizeof(buf), "{\"type\":\"switch_command_batch\",\"mac\":\"%s\",\"seq\":%llu,\"commands\":[",
+                 d.mac, (unsigned long long)++batchSeq);
+    for (int i = 0; i < kSwitches; i++) {
+      n += snprintf(buf + n, sizeof(buf) - n, "%s{\"gpio\":%d,\"state\":%s}", i ? "," : "", kRelayGpio[i], on ? "true" : "false");
+      pending[((uint64_t)d.id << 8) | i] = { now, on };
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "]}");
+    cmdSent += kSwitches;
+  } else {
+    int i = (int)(rng() % kSwitches);
+    bool on = !d.relay[i]; // always a change, so the device has to report it
+    n = snprintf(buf, sizeof(buf), "{\"type\":\"switch_command\",\"mac\":\"%s\",\"gpio\":%d,\"state\":%s}",
+                 d.mac, kRelayGpio[i], on ? "true" : "false");
+    pending[((uint64_t)d.id << 8) | i] = { now, on };
+    cmdSent++;
+  }
+  sendFrame(controller, &controllerTag, 0x1, buf, n);
+}
+
+// Broadcast state_update / full_state from the fleet: match outstanding commands
+bool controllerFrame(uint8_t opcode, const char *p, size_t len, uint64_t now) {
+  if (opcode == 0xFF) { controllerOpen = true; return true; }
+  if (opcode != 0x1) return true;
+  const char *end = p + len;
+  std::string type, mac;
+  if (!jsonStr(p, end, "type", type) || type != "state_update") return true;
+  if (!jsonStr(p, end, "mac", mac)) return true;
+  auto it = byMac.find(mac);
+  if (it == byMac.end()) return true;
+  const char *arr = jsonFind(p, end, "switches");
+  if (!arr || *arr != '[') return true;
+  const char *arrEnd = jsonClose(arr, end);
+  for (const char *q = arr + 1; q < arrEnd;) {
+    const char *o = (const char *)memchr(q, '{', arrEnd - q);
+    if (!o) break;
+    const char *oe = jsonClose(o, arrEnd);
+    long gpio;
+    bool state;
+    if (jsonInt(o, oe, "gpio", gpio) && jsonBool(o, oe, "state", state)) {
+      int i = gpioToIndex(gpio);
+      auto pit = pending.find(((uint64_t)it->second << 8) | (uint64_t)i);
+      if (i >= 0 && pit != pending.end() && pit->second.state == state) {
+        rttUs.push_back((uint32_t)(now - pit->second.sentUs));
+        cmdAnswered++;
+        pending.erase(pit);
+      }
+    }
+    q = oe;
+  }
+  return true;
+}
+
+void expirePending(uint64_t now) {
+  for (auto it = pending.begin(); it != pending.end();) {
+    if (now - it->second.sentUs > (uint64_t)opt.cmdTimeoutMs * 1000) {
+      cmdLost++;
+      it = pending.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// ---------------- Event loop ----------------
+void pollOnce(int timeoutMs) {
+  epoll_event events[512];
+  int n = epoll_wait(epfd, events, 512, timeoutMs);
+  uint64_t now = nowUs();
+  for (int e = 0; e < n; e++) {
+    bool isController = events[e].data.ptr == &controllerTag;
+    Conn &c = isController ? controller : ((Device *)events[e].data.ptr)->conn;
+    void *tag = events[e].data.ptr;
+    bool ok = true;
+    if (c.state == CONNECTING && (events[e].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+      int err = 0;
+      socklen_t l = sizeof(err);
+      getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &l);
+      if (err) { ok = false; stats.connectFails++; }
+      else sendHandshake(c, tag);
+    } else if (events[e].events & EPOLLOUT) {
+      flushTx(c, tag);
+    }
+    if (ok && (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && c.state >= HANDSHAKE) {
+      if (isController) {
+        ok = readFrames(c, tag, [&](uint8_t op, const char *p, size_t len) { return controllerFrame(op, p, len, now); });
+      } else {
+        Device &d = *(Device *)tag;
+        ok = readFrames(c, tag, [&](uint8_t op, const char *p, size_t len) { return deviceFrame(d, op, p, len, now); });
+        if (d.conn.fd < 0) continue; // dropped itself (retry_after / auth_failed)
+      }
+    }
+    if (!ok) {
+      if (isController) {
+        closeSocket(controller);
+        controllerOpen = false;
+      } else {
+        Device &d = *(Device *)tag;
+        deviceDrop(d, now, reconnectDelayUs(d));
+      }
+    }
+  }
+}
+
+// Timers: connects (ramp-limited), heartbeats, manual toggles, controller commands
+uint64_t lastRampUs = 0;
+double rampBudget = 0;
+
+void tick(uint64_t now) {
+  rampBudget = std::min(rampBudget + (now - lastRampUs) * opt.rampPerSec / 1e6, (double)opt.rampPerSec);
+  lastRampUs = now;
+  for (Device &d : fleet) {
+    if (!d.wanted) {
+      if (d.conn.fd >= 0) { closeSocket(d.conn); d.authed = false; }
+      continue;
+    }
+    if (d.conn.fd < 0) {
+      if (now >= d.nextConnectUs && rampBudget >= 1) {
+        rampBudget -= 1;
+        if (!openSocket(d.conn, &d)) { stats.connectFails++; deviceDrop(d, now, reconnectDelayUs(d)); }
+      }
+      continue;
+    }
+    if (!d.authed) continue;
+    if (now >= d.nextHeartbeatUs) {
+      sendHeartbeat(d, now);
+      d.nextHeartbeatUs = now + (uint64_t)opt.heartbeatMs * 1000;
+    }
+    if (now >= d.nextToggleUs) {
+      if (d.nextToggleUs) deviceToggle(d);
+      d.nextToggleUs = now + expDelayUs(opt.togglesPerMin / 60.0);
+    }
+  }
+  if (controller.fd < 0) openSocket(controller, &controllerTag);
+  if (controllerOpen && opt.cmdPerSec > 0) {
+    while (now >= nextCmdUs) {
+      if (nextCmdUs) controllerSend(now);
+      nextCmdUs = (nextCmdUs ? nextCmdUs : now) + expDelayUs(opt.cmdPerSec);
+    }
+  }
+  expirePending(now);
+}
+
+void runFor(uint64_t us, const std::function<void(uint64_t)> *hook = nullptr) {
+  uint64_t end = nowUs() + us;
+  uint64_t lastTick = 0;
+  for (uint64_t now = nowUs(); now < end; now = nowUs()) {
+    pollOnce(2);
+    now = nowUs();
+    if (now - lastTick >= 2000) {
+      tick(now);
+      lastTick = now;
+      if (hook) (*hook)(now);
+    }
+  }
+}
+
+int authedCount() {
+  int n = 0;
+  for (const Device &d : fleet) n += d.wanted && d.authed;
+  return n;
+}
+
+uint32_t pct(std::vector<uint32_t> &v, double p) {
+  if (v.empty()) return 0;
+  size_t k = std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+void usage() {
+  fprintf(stderr,
+          "fleet_loadgen [--host=127.0.0.1] [--port=4000] [--path=/] [--steps=100,500,1000,2000]\n"
+          "              [--step-secs=20] [--ramp=500] [--heartbeat-ms=15000] [--toggles-per-min=1]\n"
+          "              [--cmd-rate=20] [--batch-share=0.1] [--storm-frac=0] [--storm-jitter=1]\n"
+          "              [--bin] [--cmd-timeout-ms=5000] [--secret=KEY]\n");
+}
+
+bool parseArgs(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    size_t eq = a.find('=');
+    std::string key = a.substr(0, eq), val = eq == std::string::npos ? "" : a.substr(eq + 1);
+    if (key == "--host") opt.host = val;
+    else if (key == "--port") opt.port = atoi(val.c_str());
+    else if (key == "--path") opt.path = val;
+    else if (key == "--secret") opt.secret = val;
+    else if (key == "--step-secs") opt.stepSecs = atoi(val.c_str());
+    else if (key == "--ramp") opt.rampPerSec = std::max(1, atoi(val.c_str()));
+    else if (key == "--heartbeat-ms") opt.heartbeatMs = std::max(100, atoi(val.c_str()));
+    else if (key == "--toggles-per-min") opt.togglesPerMin = atof(val.c_str());
+    else if (key == "--cmd-rate") opt.cmdPerSec = atof(val.c_str());
+    else if (key == "--batch-share") opt.batchShare = atof(val.c_str());
+    else if (key == "--storm-frac") opt.stormFrac = atof(val.c_str());
+    else if (key == "--storm-jitter") opt.stormJitter = atoi(val.c_str()) != 0;
+    else if (key == "--bin") opt.binary = true;
+    else if (key == "--cmd-timeout-ms") opt.cmdTimeoutMs = atoi(val.c_str());
+    else if (key == "--steps") {
+      opt.steps.clear();
+      for (const char *p = val.c_str(); *p;) {
+        opt.steps.push_back(atoi(p));
+        const char *c = strchr(p, ',');
+        if (!c) break;
+        p = c + 1;
+      }
+    } else {
+      usage();
+      return false;
+    }
+  }
+  return !opt.steps.empty();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (!parseArgs(argc, argv)) return 2;
+
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  addrinfo hints{}, *res = nullptr;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(opt.host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+    fprintf(stderr, "cannot resolve %s\n", opt.host.c_str());
+    return 2;
+  }
+  serverAddr = *(sockaddr_in *)res->ai_addr;
+  serverAddr.sin_port = htons(opt.port);
+  freeaddrinfo(res);
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  int maxDevices = *std::max_element(opt.steps.begin(), opt.steps.end());
+  fleet.resize(maxDevices);
+  uint64_t boot = nowUs();
+  for (int i = 0; i < maxDevices; i++) {
+    Device &d = fleet[i];
+    d.id = i;
+    snprintf(d.mac, sizeof(d.mac), "LG:%02X:%02X:%02X:%02X:%02X", (i >> 24) & 0xFF, (i >> 16) & 0xFF,
+             (i >> 8) & 0xFF, i & 0xFF, 0x5A);
+    d.epoch = (uint32_t)rng() | 1;
+    d.bootUs = boot;
+    byMac[d.mac] = i;
+  }
+
+  printf("target ws://%s:%d%s  proto %s  heartbeat %d ms  toggles %.2f/min/device  commands %.1f/s\n",
+         opt.host.c_str(), opt.port, opt.path.c_str(), opt.binary ? "bin1" : "json", opt.heartbeatMs,
+         opt.togglesPerMin, opt.cmdPerSec);
+  printf("%8s %8s %8s %8s %8s %8s %8s %8s %10s %10s %8s %8s\n", "devices", "authed", "cmds", "answered", "lost",
+         "p50 ms", "p99 ms", "max ms", "tx msg/s", "rx msg/s", "disc", "storm s");
+
+  lastRampUs = nowUs();
+  const int rampPerSec = opt.rampPerSec;
+  for (int step : opt.steps) {
+    opt.rampPerSec = rampPerSec;
+    for (int i = 0; i < maxDevices; i++) fleet[i].wanted = i < step;
+
+    // Grow (or shrink) to the step size; give up waiting after 60 s + ramp time
+    uint64_t deadline = nowUs() + 60000000ULL + (uint64_t)step * 1000000 / opt.rampPerSec;
+    while (authedCount() < step && nowUs() < deadline) runFor(50000);
+
+    stats.reset();
+    rttUs.clear();
+    pending.clear();
+    cmdSent = cmdAnswered = cmdLost = 0;
+    stormVictims = stormRecovered = 0;
+    uint64_t stormAtUs = 0;
+
+    uint64_t start = nowUs();
+    uint64_t half = start + (uint64_t)opt.stepSecs * 500000;
+    bool stormed = false;
+    std::function<void(uint64_t)> hook = [&](uint64_t now) {
+      if (stormed || opt.stormFrac <= 0 || now < half) return;
+      stormed = true;
+      stormAtUs = now;
+      for (Device &d : fleet) {
+        if (!d.wanted || !d.authed || uniform() >= opt.stormFrac) continue;
+        d.droppedAtUs = now;
+        stormVictims++;
+        deviceDrop(d, now, reconnectDelayUs(d));
+      }
+      // The ramp limit models the tool, not the fleet: let the storm through at once
+      rampBudget = std::max(rampBudget, (double)stormVictims);
+      opt.rampPerSec = std::max<int>(opt.rampPerSec, (int)stormVictims);
+    };
+    runFor((uint64_t)opt.stepSecs * 1000000, &hook);
+    uint64_t elapsed = nowUs() - start;
+
+    double secs = elapsed / 1e6;
+    char storm[32] = "-";
+    if (stormVictims) {
+      if (stormRecovered == stormVictims) snprintf(storm, sizeof(storm), "%.2f", (stormLastUs - stormAtUs) / 1e6);
+      else snprintf(storm, sizeof(storm), "%llu/%llu", (unsigned long long)stormRecovered, (unsigned long long)stormVictims);
+    }
+    uint32_t p50 = pct(rttUs, 50), p99 = pct(rttUs, 99);
+    uint32_t mx = rttUs.empty() ? 0 : *std::max_element(rttUs.begin(), rttUs.end());
+    printf("%8d %8d %8llu %8llu %8llu %8.1f %8.1f %8.1f %10.0f %10.0f %8llu %8s\n", step, authedCount(),
+           (unsigned long long)cmdSent, (unsigned long long)cmdAnswered, (unsigned long long)cmdLost, p50 / 1000.0,
+           p99 / 1000.0, mx / 1000.0, stats.txMsgs / secs, stats.rxMsgs / secs,
+           (unsigned long long)stats.disconnects, storm);
+    fflush(stdout);
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Definitions behind the host stubs (stubs/*.h): virtual clock, pins + ISRs,
+// esp_timer queue, in-memory NVS, and a global allocation counter.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+#include <esp_ota_ops.h>
+#include <HTTPClient.h>
+#include <new>
+#include "host_runtime.h"
+
+namespace host {
+uint64_t nowUs = 1000000;  // start at 1 s: 0 doubles as "no timestamp" in the firmware
+int pinLevel[64];
+int pinMode[64];
+bool quietSerial = true;
+std::vector<HostTask> tasks;
+bool failTaskCreate = false;             // xTaskCreatePinnedToCore() returns pdFAIL
+std::map<std::string, std::vector<uint8_t>> nvs;
+uint64_t nvsWrites = 0;
+uint64_t allocations = 0;
+uint64_t allocatedBytes = 0;
+uint64_t registerWrites = 0;
+bool restartRequested = false;
+esp_reset_reason_t resetReason = ESP_RST_POWERON;
+int64_t wallEpoch = 0;
+std::vector<uint8_t> flashRunning, flashUpdate;
+esp_partition_t partRunning = { "app0", 0x1E0000, &flashRunning };
+esp_partition_t partUpdate = { "app1", 0x1E0000, &flashUpdate };
+esp_app_desc_t appDesc = { "1.0.0-host", {} };
+const esp_partition_t* bootPartition = &partRunning;
+esp_ota_img_states_t runningImgState = ESP_OTA_IMG_VALID;
+bool otaWriting = false;
+std::map<std::string, std::vector<uint8_t>> httpBodies;
+bool httpChunked = false;
+size_t httpCutAt = 0;
+uint32_t httpGets = 0;
+
+struct Isr { voidFuncPtrArg fn; void* arg; };
+static Isr isrs[64];
+static std::vector<HostTimer*> timers;
+
+void setPin(int pin, int level) {
+  if (pinLevel[pin] == level) return;
+  pinLevel[pin] = level;
+  if (isrs[pin].fn) isrs[pin].fn(isrs[pin].arg);  // every attach in the firmware is CHANGE
+}
+
+void runTimers() {
+  for (;;) {
+    HostTimer* next = nullptr;
+    for (HostTimer* t : timers) {
+      if (t->armed && t->due <= nowUs && (!next || t->due < next->due)) next = t;
+    }
+    if (!next) return;
+    if (next->period) next->due += next->period;
+    else next->armed = false;
+    next->cb(next->arg);
+  }
+}
+
+void advance(uint64_t us) {
+  uint64_t end = nowUs + us;
+  // Step through timer deadlines so callbacks see the time they were due at
+  for (;;) {
+    uint64_t due = end;
+    for (HostTimer* t : timers) if (t->armed && t->due < due) due = t->due;
+    nowUs = due;
+    runTimers();
+    if (due == end) return;
+  }
+}
+
+void regWrite(uint32_t reg, uint32_t value) {
+  registerWrites++;
+  int base = (reg == GPIO_OUT1_W1TS_REG || reg == GPIO_OUT1_W1TC_REG) ? 32 : 0;
+  int level = (reg == GPIO_OUT_W1TS_REG || reg == GPIO_OUT1_W1TS_REG) ? HIGH : LOW;
+  for (int b = 0; b < 32 && base + b < 64; b++) {
+    if (value & (1UL << b)) pinLevel[base + b] = level;
+  }
+}
+}  // namespace host
+
+HostSerial Serial;
+EspClass ESP;
+HostWiFi WiFi;
+TwoWire Wire;
+SPIClass SPI;
+
+void EspClass::restart() { host::restartRequested = true; }
+
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg fn, void* arg, int) { host::isrs[pin] = { fn, arg }; }
+void detachInterrupt(uint8_t pin) { host::isrs[pin] = { nullptr, nullptr }; }
+
+void vTaskDelay(TickType_t ticks) { host::advance((uint64_t)ticks * 1000); }
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+  HostTimer* t = new HostTimer{ args->callback, args->arg, 0, 0, false };
+  host::timers.push_back(t);
+  *out = t;
+  return ESP_OK;
+}
+
+// ---- allocation counter (operator new is the only heap entry point the firmware reaches) ----
+void* operator new(size_t n) {
+  host::allocations++;
+  host::allocatedBytes += n;
+  if (void* p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
@@ -0,0 +1,17 @@
+// Simulator-side controls for the host stubs (definitions in host_runtime.cpp).
+#pragma once
+#include <cstdint>
+#include "Arduino.h"
+
+namespace host {
+extern uint64_t allocations;     // operator new calls since start
+extern uint64_t allocatedBytes;
+extern uint64_t nvsWrites;       // Preferences put* calls that reached "flash"
+extern uint64_t registerWrites;  // GPIO W1TS/W1TC writes (relay driver fast path)
+extern bool restartRequested;    // ESP.restart() was called
+extern esp_reset_reason_t resetReason;  // what esp_reset_reason() reports
+
+void setPin(int pin, int level);  // drive an input; fires the attached CHANGE ISR
+void advance(uint64_t us);        // move the virtual clock, firing esp_timers on the way
+void runTimers();
+}
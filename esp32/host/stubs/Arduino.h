@@ -0,0 +1,119 @@
+// Host stand-in for the Arduino-ESP32 core: virtual clock, GPIO levels,
+// Serial, and just enough FreeRTOS for the firmware to run single-threaded.
+#pragma once
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include "WString.h"
+
+// newlib provides strlcpy on the device; glibc only since 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char* dst, const char* src, size_t n) {
+  size_t len = strlen(src);
+  if (n) { size_t c = len < n - 1 ? len : n - 1; memcpy(dst, src, c); dst[c] = 0; }
+  return len;
+}
+#endif
+
+using std::min;
+using std::max;
+template <typename T, typename L, typename H> inline T constrain(T v, L lo, H hi) { return v < (T)lo ? (T)lo : (v > (T)hi ? (T)hi : v); }
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+
+// ---- virtual clock / pins (driven by the simulator) ----
+namespace host {
+extern uint64_t nowUs;
+extern int pinLevel[64];
+extern int pinMode[64];
+extern bool quietSerial;
+}
+inline unsigned long millis() { return (unsigned long)(host::nowUs / 1000); }
+inline unsigned long micros() { return (unsigned long)host::nowUs; }
+inline void delay(unsigned long ms) { host::nowUs += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { host::nowUs += us; }
+inline void yield() {}
+inline void pinMode(uint8_t pin, uint8_t mode) { host::pinMode[pin] = mode; }
+inline void digitalWrite(uint8_t pin, uint8_t val) { host::pinLevel[pin] = val ? HIGH : LOW; }
+inline int digitalRead(uint8_t pin) { return host::pinLevel[pin]; }
+inline uint32_t esp_random() { return (uint32_t)rand() * 2654435761u; }
+inline long random(long lo, long hi) { return hi > lo ? lo + (long)(esp_random() % (uint32_t)(hi - lo)) : lo; }
+inline long random(long hi) { return random(0, hi); }
+
+typedef enum { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_INT_WDT,
+               ESP_RST_TASK_WDT, ESP_RST_WDT, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT } esp_reset_reason_t;
+namespace host { extern esp_reset_reason_t resetReason; }
+inline esp_reset_reason_t esp_reset_reason() { return host::resetReason; }
+
+// ---- wall clock: 1970 until the simulator "syncs" SNTP by setting host::wallEpoch ----
+namespace host { extern int64_t wallEpoch; } // epoch seconds at nowUs == 0, 0 = not synced
+inline time_t hostTime(time_t* out) {
+  time_t t = host::wallEpoch ? (time_t)(host::wallEpoch + (int64_t)(host::nowUs / 1000000)) : 0;
+  if (out) *out = t;
+  return t;
+}
+#define time(out) hostTime(out)
+inline void configTzTime(const char* tz, const char*, const char* = nullptr, const char* = nullptr) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+typedef void (*voidFuncPtrArg)(void*);
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg fn, void* arg, int mode);
+void detachInterrupt(uint8_t pin);
+inline int digitalPinToInterrupt(int pin) { return pin; }
+
+class HostSerial {
+ public:
+  void begin(unsigned long) {}
+  size_t write(const uint8_t* b, size_t n) { if (!host::quietSerial) fwrite(b, 1, n, stdout); return n; }
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const String& s) { return print(s.c_str()); }
+  size_t print(char c) { return write((const uint8_t*)&c, 1); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned int v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v) { return printf("%.2f", v); }
+  template <typename T> size_t println(const T& v) { size_t n = print(v); return n + print("\n"); }
+  size_t println() { return print("\n"); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[512]; va_list ap; va_start(ap, fmt); int n = vsnprintf(buf, sizeof buf, fmt, ap); va_end(ap);
+    if (n < 0) return 0;
+    return write((const uint8_t*)buf, std::min((size_t)n, sizeof buf - 1));
+  }
+  int available() { return 0; }
+  void flush() {}
+  int availableForWrite() { return 128; }
+};
+extern HostSerial Serial;
+
+class EspClass {
+ public:
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getMaxAllocHeap() { return 110000; }
+  uint32_t getCycleCount() { return (uint32_t)(host::nowUs * 240); }
+  uint32_t getCpuFreqMHz() { return 240; }
+  void restart();
+  const char* getSdkVersion() { return "host"; }
+};
+extern EspClass ESP;
+
+#include "freertos_host.h"
@@ -0,0 +1,53 @@
+// Host stand-in for HTTPClient: GET serves the body registered for the URL in
+// host::httpBodies. httpChunked hides Content-Length; httpCutAt ends the body
+// early so reads time out.
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "WiFiClientSecure.h"
+
+namespace host {
+extern std::map<std::string, std::vector<uint8_t>> httpBodies;
+extern bool httpChunked;
+extern size_t httpCutAt;  // 0 = whole body
+extern uint32_t httpGets;
+}
+
+class Stream {
+ public:
+  void setTimeout(unsigned long) {}
+  size_t readBytes(uint8_t* dst, size_t n) {
+    size_t end = cut && cut < body->size() ? cut : body->size();
+    size_t c = pos < end ? std::min(n, end - pos) : 0;
+    if (c) memcpy(dst, body->data() + pos, c);
+    pos += c;
+    return c;
+  }
+  const std::vector<uint8_t>* body = nullptr;
+  size_t pos = 0, cut = 0;
+};
+
+class HTTPClient {
+ public:
+  void setReuse(bool) {}
+  void setTimeout(uint16_t) {}
+  bool begin(WiFiClientSecure&, const char* url) { url_ = url; return !url_.empty(); }
+  int GET() {
+    host::httpGets++;
+    auto it = host::httpBodies.find(url_);
+    if (it == host::httpBodies.end()) return 404;
+    stream_.body = &it->second;
+    stream_.pos = 0;
+    stream_.cut = host::httpCutAt;
+    return 200;
+  }
+  int getSize() { return host::httpChunked || !stream_.body ? -1 : (int)stream_.body->size(); }
+  Stream* getStreamPtr() { return &stream_; }
+  void end() { stream_.body = nullptr; }
+
+ private:
+  std::string url_;
+  Stream stream_;
+};
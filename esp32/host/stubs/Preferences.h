@@ -0,0 +1,37 @@
+// Host stand-in for the NVS-backed Preferences class (in-memory, counts writes).
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+namespace host {
+extern std::map<std::string, std::vector<uint8_t>> nvs;
+extern uint64_t nvsWrites;
+}
+
+class Preferences {
+ public:
+  bool begin(const char* ns, bool readOnly = false) { ns_ = ns; ro_ = readOnly; return true; }
+  void end() {}
+  bool isKey(const char* k) { return host::nvs.count(key(k)) > 0; }
+  bool remove(const char* k) { return host::nvs.erase(key(k)) > 0; }
+  bool clear() { for (auto it = host::nvs.begin(); it != host::nvs.end();) { if (it->first.rfind(ns_ + "/", 0) == 0) it = host::nvs.erase(it); else ++it; } return true; }
+  size_t putBytes(const char* k, const void* v, size_t n) { if (ro_) return 0; host::nvsWrites++; auto& d = host::nvs[key(k)]; d.assign((const uint8_t*)v, (const uint8_t*)v + n); return n; }
+  size_t getBytes(const char* k, void* out, size_t n) { auto it = host::nvs.find(key(k)); if (it == host::nvs.end()) return 0; size_t c = std::min(n, it->second.size()); memcpy(out, it->second.data(), c); return c; }
+  size_t getBytesLength(const char* k) { auto it = host::nvs.find(key(k)); return it == host::nvs.end() ? 0 : it->second.size(); }
+  size_t putInt(const char* k, int32_t v) { return putBytes(k, &v, sizeof v); }
+  int32_t getInt(const char* k, int32_t def = 0) { int32_t v = def; getBytes(k, &v, sizeof v); return v; }
+  size_t putUInt(const char* k, uint32_t v) { return putBytes(k, &v, sizeof v); }
+  uint32_t getUInt(const char* k, uint32_t def = 0) { uint32_t v = def; getBytes(k, &v, sizeof v); return v; }
+  size_t putUChar(const char* k, uint8_t v) { return putBytes(k, &v, sizeof v); }
+  uint8_t getUChar(const char* k, uint8_t def = 0) { uint8_t v = def; getBytes(k, &v, sizeof v); return v; }
+  size_t putBool(const char* k, bool v) { return putUChar(k, v ? 1 : 0); }
+  bool getBool(const char* k, bool def = false) { return getUChar(k, def ? 1 : 0) != 0; }
+  size_t putString(const char* k, const char* v) { return putBytes(k, v, strlen(v) + 1); }
+  String getString(const char* k, const String& def = String()) { auto it = host::nvs.find(key(k)); if (it == host::nvs.end()) return def; return String((const char*)it->second.data()); }
+ private:
+  std::string key(const char* k) const { return ns_ + "/" + k; }
+  std::string ns_;
+  bool ro_ = false;
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include <Arduino.h>
+#define MSBFIRST 1
+#define SPI_MODE0 0
+struct SPISettings { SPISettings(uint32_t, uint8_t, uint8_t) {} };
+struct SPIClass {
+  void begin(int8_t = -1, int8_t = -1, int8_t = -1, int8_t = -1) {}
+  void beginTransaction(const SPISettings &) {}
+  void endTransaction() {}
+  void transfer(void *, uint32_t) {}
+};
+extern SPIClass SPI;
@@ -0,0 +1,34 @@
+// Host stand-in for the Arduino String class (std::string backed).
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned int v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* o) const { return s_ == (o ? o : ""); }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o) { s_ += o; return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.s_ + b.s_); }
+  friend String operator+(const char* a, const String& b) { return String(std::string(a) + b.s_); }
+  friend String operator+(const String& a, const char* b) { return String(a.s_ + b); }
+  char operator[](unsigned int i) const { return s_[i]; }
+  bool startsWith(const char* p) const { return s_.rfind(p, 0) == 0; }
+  int toInt() const { return atoi(s_.c_str()); }
+  void reserve(unsigned int n) { s_.reserve(n); }
+ private:
+  std::string s_;
+};
@@ -0,0 +1,62 @@
+// Host stand-in for Links2004 WebSocketsClient. Outbound frames are counted
+// and handed to the simulator; inbound traffic is injected by calling the
+// registered event callback.
+#pragma once
+#include <functional>
+#include <vector>
+#include "Arduino.h"
+
+typedef enum {
+  WStype_ERROR, WStype_DISCONNECTED, WStype_CONNECTED, WStype_TEXT, WStype_BIN,
+  WStype_FRAGMENT_TEXT_START, WStype_FRAGMENT_BIN_START, WStype_FRAGMENT, WStype_FRAGMENT_FIN,
+  WStype_PING, WStype_PONG,
+} WStype_t;
+
+class WebSocketsClient {
+ public:
+  typedef std::function<void(WStype_t type, uint8_t* payload, size_t length)> WebSocketClientEvent;
+  typedef std::function<void(bool bin, const uint8_t* payload, size_t length)> HostSink;
+
+  void begin(const char*, uint16_t, const char* = "/", const char* = "arduino") {}
+  void beginSSL(const char*, uint16_t, const char* = "/", const char* = "", const char* = "arduino") {}
+  void beginSslWithCA(const char*, uint16_t, const char* = "/", const char* = nullptr, const char* = "arduino") {}
+  void onEvent(WebSocketClientEvent cb) { cb_ = cb; }
+  void setReconnectInterval(unsigned long ms) { reconnectIntervalMs = ms; }
+  void enableHeartbeat(uint32_t, uint32_t, uint8_t) {}
+  void disableHeartbeat() {}
+  void loop() { if (pongDue) { pongDue = false; fire(WStype_PONG, lastPing.data(), lastPing.size()); } }
+  void disconnect() { if (connected) { connected = false; fire(WStype_DISCONNECTED, nullptr, 0); } }
+  bool isConnected() { return connected; }
+
+  bool sendTXT(const char* p, size_t n = 0) { if (!n) n = strlen(p); return out(false, (const uint8_t*)p, n); }
+  bool sendTXT(uint8_t* p, size_t n = 0) { return sendTXT((const char*)p, n); }
+  bool sendTXT(String& s) { return sendTXT(s.c_str(), s.length()); }
+  bool sendBIN(const uint8_t* p, size_t n) { return out(true, p, n); }
+  bool sendPing(uint8_t* p = nullptr, size_t n = 0) {
+    if (!connected) return false;
+    pings++; txBytes += n;
+    lastPing.assign(p, p + n);
+    pongDue = autoPong;
+    return true;
+  }
+
+  // ---- simulator side ----
+  void fire(WStype_t t, uint8_t* p, size_t n) { if (cb_) cb_(t, p, n); }
+  bool connected = false;
+  bool failSends = false;
+  unsigned long reconnectIntervalMs = 0;
+  uint64_t txFrames = 0, txBytes = 0, pings = 0;
+  HostSink sink;
+  std::vector<uint8_t> lastPing;  // payload
+  bool autoPong = true;           // answer on the next loop(); off = the simulator fires WStype_PONG itself
+  bool pongDue = false;
+
+ private:
+  bool out(bool bin, const uint8_t* p, size_t n) {
+    if (!connected || failSends) return false;
+    txFrames++; txBytes += n;
+    if (sink) sink(bin, p, n);
+    return true;
+  }
+  WebSocketClientEvent cb_;
+};
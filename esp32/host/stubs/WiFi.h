@@ -0,0 +1,125 @@
+// Host stand-in for the ESP32 WiFi class. The simulator lists the APs in range
+// (aps); begin() and scanNetworks() raise the events the firmware registered for
+// synchronously, as if the driver answered instantly.
+#pragma once
+#include <vector>
+#include "Arduino.h"
+
+typedef enum { WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL = 1, WL_CONNECTED = 3, WL_CONNECT_FAILED = 4, WL_DISCONNECTED = 6 } wl_status_t;
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1 } wifi_mode_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED  (-2)
+#define WIFI_REASON_ASSOC_LEAVE 8
+#define WIFI_REASON_NO_AP_FOUND 201
+
+class IPAddress {
+ public:
+  IPAddress(uint32_t v = 0) : v_(v) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : v_(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+  operator uint32_t() const { return v_; }
+  String toString() const { char b[16]; snprintf(b, sizeof b, "%u.%u.%u.%u", v_ & 255, (v_ >> 8) & 255, (v_ >> 16) & 255, v_ >> 24); return String(b); }
+ private:
+  uint32_t v_;
+};
+#define INADDR_NONE IPAddress((uint32_t)0)
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_WIFI_SCAN_DONE,
+} arduino_event_id_t;
+
+struct host_ip4 { uint32_t addr; };
+typedef struct {
+  struct { uint8_t reason; } wifi_sta_disconnected;
+  struct { struct { host_ip4 ip, netmask, gw; } ip_info; } got_ip;
+} arduino_event_info_t;
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t, arduino_event_info_t);
+
+struct HostAp {
+  const char* ssid;
+  uint8_t bssid[6];
+  uint8_t channel;
+  int8_t rssi;
+};
+
+class HostWiFi {
+ public:
+  wl_status_t status() { return st; }
+  wl_status_t begin(const char* ssid, const char* = nullptr, int32_t channel = 0, const uint8_t* bssid = nullptr, bool = true) {
+    beginCalls++;
+    for (const HostAp& ap : aps) {
+      if (strcmp(ap.ssid, ssid) || (bssid && memcmp(bssid, ap.bssid, 6)) || (channel && channel != ap.channel)) continue;
+      joined = &ap - aps.data();
+      st = WL_CONNECTED;
+      arduino_event_info_t info = {};
+      fire(ARDUINO_EVENT_WIFI_STA_CONNECTED, info);
+      info.got_ip.ip_info.ip.addr = staticIp ? staticIp : (uint32_t)IPAddress(192, 168, 1, 50);
+      info.got_ip.ip_info.gw.addr = IPAddress(192, 168, 1, 1);
+      info.got_ip.ip_info.netmask.addr = IPAddress(255, 255, 255, 0);
+      fire(ARDUINO_EVENT_WIFI_STA_GOT_IP, info);
+      return st;
+    }
+    st = WL_NO_SSID_AVAIL;
+    arduino_event_info_t info = {};
+    info.wifi_sta_disconnected.reason = WIFI_REASON_NO_AP_FOUND;
+    fire(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+    return st;
+  }
+  bool config(IPAddress ip, IPAddress, IPAddress, IPAddress = INADDR_NONE) { staticIp = ip; return true; }
+  bool disconnect(bool = false, bool = false) { st = WL_DISCONNECTED; joined = -1; return true; }
+  void onEvent(WiFiEventFuncCb cb) { cb_ = cb; }
+  void persistent(bool) {}
+  bool setAutoReconnect(bool) { return true; }
+  bool mode(wifi_mode_t) { return true; }
+  bool setSleep(bool on) { return setSleep(on ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE); }
+  bool setSleep(wifi_ps_type_t ps) { if (ps != psMode) psChanges++; psMode = ps; return true; }
+
+  int16_t scanNetworks(bool async = false, bool = false, bool = false, uint32_t = 300) {
+    scans++;
+    scanned = (int)aps.size();
+    if (async) { arduino_event_info_t info = {}; fire(ARDUINO_EVENT_WIFI_SCAN_DONE, info); return WIFI_SCAN_RUNNING; }
+    return scanned;
+  }
+  int16_t scanComplete() { return scanned; }
+  void scanDelete() { scanned = 0; }
+  String SSID(uint8_t i) { return String(aps[i].ssid); }
+  int32_t RSSI(uint8_t i) { return aps[i].rssi; }
+  int32_t channel(uint8_t i) { return aps[i].channel; }
+  uint8_t* BSSID(uint8_t i) { return aps[i].bssid; }
+
+  String macAddress() { return String(mac); }
+  uint8_t* macAddress(uint8_t* out) { static const uint8_t m[6] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x01 }; memcpy(out, m, 6); return out; }
+  int8_t RSSI() { return joined >= 0 ? aps[joined].rssi : 0; }
+  uint8_t* BSSID() { return joined >= 0 ? aps[joined].bssid : nullptr; }
+  int32_t channel() { return joined >= 0 ? aps[joined].channel : 0; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(192, 168, 1, 1); }
+
+  std::vector<HostAp> aps;
+  wifi_ps_type_t psMode = WIFI_PS_MIN_MODEM;  // the driver's default
+  uint32_t psChanges = 0;
+  wl_status_t st = WL_DISCONNECTED;
+  int joined = -1;
+  int scanned = 0;
+  int beginCalls = 0, scans = 0;
+  uint32_t staticIp = 0;
+  char mac[18] = "24:6F:28:00:00:01";
+
+  // Simulator: the AP vanished (beacon timeout)
+  void dropLink() {
+    st = WL_DISCONNECTED;
+    joined = -1;
+    arduino_event_info_t info = {};
+    info.wifi_sta_disconnected.reason = 200;
+    fire(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+  }
+
+ private:
+  void fire(arduino_event_id_t e, arduino_event_info_t info) { if (cb_) cb_(e, info); }
+  WiFiEventFuncCb cb_ = nullptr;
+};
+extern HostWiFi WiFi;
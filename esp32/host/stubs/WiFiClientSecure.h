@@ -0,0 +1,11 @@
+// Host stand-in for WiFiClientSecure: only records how TLS was configured.
+#pragma once
+#include "Arduino.h"
+
+class WiFiClientSecure {
+ public:
+  void setCACert(const char* ca) { caCert = ca; insecure = false; }
+  void setInsecure() { caCert = nullptr; insecure = true; }
+  const char* caCert = nullptr;
+  bool insecure = false;
+};
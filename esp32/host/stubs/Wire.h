@@ -0,0 +1,9 @@
+#pragma once
+#include <Arduino.h>
+struct TwoWire {
+  bool begin(int = -1, int = -1, uint32_t = 0) { return true; }
+  void beginTransmission(int) {}
+  size_t write(uint8_t) { return 1; }
+  uint8_t endTransmission(bool = true) { return 0; }
+};
+extern TwoWire Wire;
@@ -0,0 +1,59 @@
+// Host stand-in for esp_ota_ops / esp_app_desc: writes go to host::flashUpdate,
+// the boot choice and the rollback state are plain variables the simulator reads.
+#pragma once
+#include "esp_partition.h"
+
+typedef uint32_t esp_ota_handle_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+
+typedef enum {
+  ESP_OTA_IMG_NEW = 0,
+  ESP_OTA_IMG_PENDING_VERIFY = 1,
+  ESP_OTA_IMG_VALID = 2,
+  ESP_OTA_IMG_INVALID = 3,
+  ESP_OTA_IMG_ABORTED = 4,
+  ESP_OTA_IMG_UNDEFINED = -1,
+} esp_ota_img_states_t;
+
+typedef struct {
+  char version[32];
+  uint8_t app_elf_sha256[32];
+} esp_app_desc_t;
+
+namespace host {
+extern esp_app_desc_t appDesc;
+extern const esp_partition_t* bootPartition;
+extern esp_ota_img_states_t runningImgState;
+extern bool otaWriting;
+}
+
+inline const esp_app_desc_t* esp_app_get_description() { return &host::appDesc; }
+inline const esp_partition_t* esp_ota_get_running_partition() { return &host::partRunning; }
+inline const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t*) { return &host::partUpdate; }
+
+inline esp_err_t esp_ota_begin(const esp_partition_t* p, size_t, esp_ota_handle_t* out) {
+  if (host::otaWriting) return ESP_ERR_INVALID_STATE;
+  p->data->clear();
+  host::otaWriting = true;
+  *out = 1;
+  return ESP_OK;
+}
+inline esp_err_t esp_ota_write(esp_ota_handle_t, const void* data, size_t n) {
+  if (!host::otaWriting || host::flashUpdate.size() + n > host::partUpdate.size) return ESP_ERR_INVALID_ARG;
+  host::flashUpdate.insert(host::flashUpdate.end(), (const uint8_t*)data, (const uint8_t*)data + n);
+  return ESP_OK;
+}
+inline esp_err_t esp_ota_abort(esp_ota_handle_t) { host::otaWriting = false; return ESP_OK; }
+inline esp_err_t esp_ota_end(esp_ota_handle_t) {
+  if (!host::otaWriting) return ESP_ERR_INVALID_STATE;
+  host::otaWriting = false;
+  return ESP_OK;
+}
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t* p) { host::bootPartition = p; return ESP_OK; }
+inline esp_err_t esp_ota_get_state_partition(const esp_partition_t* p, esp_ota_img_states_t* st) {
+  if (p != &host::partRunning) return ESP_ERR_NOT_FOUND;
+  *st = host::runningImgState;
+  return ESP_OK;
+}
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback() { host::runningImgState = ESP_OTA_IMG_VALID; return ESP_OK; }
@@ -0,0 +1,24 @@
+// Host stand-in for esp_partition: the two app slots are byte vectors the
+// simulator fills (running image) and inspects (what the OTA wrote).
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "esp_err.h"
+
+typedef struct {
+  const char* label;
+  uint32_t size;
+  std::vector<uint8_t>* data;  // host only
+} esp_partition_t;
+
+namespace host {
+extern std::vector<uint8_t> flashRunning, flashUpdate;
+extern esp_partition_t partRunning, partUpdate;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t off, void* dst, size_t n) {
+  if (off + n > p->size) return ESP_ERR_INVALID_ARG;
+  for (size_t k = 0; k < n; k++) ((uint8_t*)dst)[k] = off + k < p->data->size() ? (*p->data)[off + k] : 0xFF;
+  return ESP_OK;
+}
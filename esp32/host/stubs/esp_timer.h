@@ -0,0 +1,26 @@
+// Host esp_timer: one-shot/periodic timers on the virtual clock. The
+// simulator calls host::runTimers() after advancing host::nowUs.
+#pragma once
+#include <cstdint>
+#include "esp_err.h"
+
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct HostTimer { esp_timer_cb_t cb; void* arg; uint64_t due; uint64_t period; bool armed; };
+typedef HostTimer* esp_timer_handle_t;
+
+namespace host { extern uint64_t nowUs; void runTimers(); }
+inline int64_t esp_timer_get_time() { return (int64_t)host::nowUs; }
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out);
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t us) { if (t->armed) return ESP_ERR_INVALID_STATE; t->due = host::nowUs + us; t->period = 0; t->armed = true; return ESP_OK; }
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t us) { if (t->armed) return ESP_ERR_INVALID_STATE; t->due = host::nowUs + us; t->period = us; t->armed = true; return ESP_OK; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t t) { if (!t->armed) return ESP_ERR_INVALID_STATE; t->armed = false; return ESP_OK; }
+inline bool esp_timer_is_active(esp_timer_handle_t t) { return t->armed; }
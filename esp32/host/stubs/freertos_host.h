@@ -0,0 +1,81 @@
+// FreeRTOS API subset for host runs. Tasks are recorded, not started: the
+// simulator calls the firmware's *Service() functions directly, so every
+// queue operation is non-blocking and deterministic.
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portNUM_PROCESSORS 2
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m) ((void)(m))
+#define portEXIT_CRITICAL(m) ((void)(m))
+#define portENTER_CRITICAL_ISR(m) ((void)(m))
+#define portEXIT_CRITICAL_ISR(m) ((void)(m))
+#define portYIELD_FROM_ISR(...) ((void)0)
+typedef int portMUX_TYPE;
+
+// Fixed ring allocated once at create time, like a real FreeRTOS queue: sends and
+// receives never touch the heap, so the simulator's allocation count is the firmware's
+struct HostQueue {
+  size_t itemSize, depth;
+  uint8_t* buf;
+  size_t head, count;
+};
+typedef HostQueue* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t itemSize) {
+  return new HostQueue{ itemSize, depth, new uint8_t[(size_t)depth * itemSize], 0, 0 };
+}
+inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t) {
+  if (q->count >= q->depth) return pdFALSE;
+  memcpy(q->buf + ((q->head + q->count) % q->depth) * q->itemSize, item, q->itemSize);
+  q->count++;
+  return pdTRUE;
+}
+inline BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t t) { return xQueueSend(q, item, t); }
+inline BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken) { if (woken) *woken = pdFALSE; return xQueueSend(q, item, 0); }
+inline BaseType_t xQueueReceive(QueueHandle_t q, void* out, TickType_t) {
+  if (!q->count) return pdFALSE;
+  memcpy(out, q->buf + q->head * q->itemSize, q->itemSize);
+  q->head = (q->head + 1) % q->depth;
+  q->count--;
+  return pdTRUE;
+}
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return (UBaseType_t)q->count; }
+inline UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) { return (UBaseType_t)(q->depth - q->count); }
+inline BaseType_t xQueueReset(QueueHandle_t q) { q->head = q->count = 0; return pdPASS; }
+
+typedef int* SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new int(0); }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+struct HostTask { TaskFunction_t fn; const char* name; uint32_t stack; UBaseType_t prio; int core; };
+namespace host { extern std::vector<HostTask> tasks; extern bool failTaskCreate; }
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void*,
+                                          UBaseType_t prio, TaskHandle_t* handle, BaseType_t core) {
+  if (host::failTaskCreate) return pdFAIL;
+  host::tasks.push_back({ fn, name, stack, prio, (int)core });
+  if (handle) *handle = (TaskHandle_t)(uintptr_t)host::tasks.size();
+  return pdPASS;
+}
+inline void vTaskDelete(TaskHandle_t) {}
+void vTaskDelay(TickType_t ticks);
+namespace host { extern uint64_t nowUs; }
+inline TickType_t xTaskGetTickCount() { return (TickType_t)(host::nowUs / 1000); }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) { return 1024; }
+inline BaseType_t xPortGetCoreID() { return 0; }
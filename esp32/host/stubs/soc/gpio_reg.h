@@ -0,0 +1,11 @@
+// Host stand-in for the GPIO W1TS/W1TC registers used by the relay driver fast path.
+#pragma once
+#include <cstdint>
+
+#define GPIO_OUT_W1TS_REG   0
+#define GPIO_OUT_W1TC_REG   1
+#define GPIO_OUT1_W1TS_REG  2
+#define GPIO_OUT1_W1TC_REG  3
+
+namespace host { void regWrite(uint32_t reg, uint32_t value); }
+#define REG_WRITE(reg, value) host::regWrite((reg), (value))
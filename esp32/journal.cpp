@@ -0,0 +1,209 @@
+#include "journal.h"
+#include <Preferences.h>
+#include <stddef.h>
+#include <time.h>
+#include "logger.h"
+
+// ========= RAM ring =========
+static JournalEvent ring[JOURNAL_SLOTS];
+static uint32_t ringHead = 0, ringCount = 0;
+static uint32_t ringSeq = 0;            // sequence number of ring[ringHead]; advances with every record that leaves
+static uint32_t peekSeq = 0;            // net task: ringSeq when the last ring batch was peeked
+static volatile bool ringInFlight = false; // a ring batch was sent and is not acked yet: no spilling
+static uint32_t dropped = 0;
+static uint32_t bootId = 0;
+static portMUX_TYPE journalMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ========= Flash spill =========
+// Chunks live in NVS keys c0..c(N-1) used as a ring; "meta" holds first + count.
+// Spilled records are always older than the RAM ring, so replay drains them first:
+// the telemetry task stages the oldest chunk in RAM, the net task reads it from there.
+#define JOURNAL_NVS_NS      "journal"
+#define JOURNAL_CHUNK_MAGIC 0x10E7
+
+struct __attribute__((packed)) SpillChunk {
+  uint16_t      magic;
+  uint8_t       count;
+  uint8_t       reserved;
+  JournalAnchor anchor;
+  JournalEvent  ev[JOURNAL_SPILL_CHUNK];
+};
+struct __attribute__((packed)) SpillMeta {
+  uint8_t first;
+  uint8_t chunks;
+};
+
+static SpillMeta meta = { 0, 0 };       // chunks: written under journalMux, read by the net task
+static SpillChunk outChunk;             // telemetry task: being written
+static SpillChunk staged;               // oldest chunk, loaded for replay
+static volatile bool stagedValid = false;  // telemetry sets, net reads
+static volatile bool stagedDone = false;   // net sets once every record was acked
+static int stagedOffset = 0;            // net task
+static bool lastPeekStaged = false;     // net task
+
+static void spillKey(uint8_t slot, char *key) { snprintf(key, 8, "c%u", (unsigned)slot); }
+
+static JournalAnchor liveAnchor() {
+  time_t now = time(nullptr);
+  return { bootId, now >= SCHEDULE_MIN_EPOCH ? (uint32_t)now : 0, (uint32_t)millis() };
+}
+
+void journalBegin(uint32_t boot) {
+  bootId = boot;
+#if JOURNAL_FLASH_SPILL
+  Preferences p;
+  p.begin(JOURNAL_NVS_NS, true);
+  if (p.getBytes("meta", &meta, sizeof(meta)) != sizeof(meta) ||
+      meta.first >= JOURNAL_SPILL_CHUNKS || meta.chunks > JOURNAL_SPILL_CHUNKS) {
+    meta = { 0, 0 };
+  }
+  p.end();
+  if (meta.chunks) LOGI("JRNL", "%u spilled chunks from a previous boot", (unsigned)meta.chunks);
+#endif
+}
+
+void journalRecord(JournalKind kind, int idx, bool state) {
+  JournalEvent e = { (uint32_t)millis(), (uint8_t)kind, (uint8_t)idx, (uint8_t)state, 0 };
+  portENTER_CRITICAL(&journalMux);
+  if (ringCount == JOURNAL_SLOTS) { // oldest goes
+    ringHead = (ringHead + 1) % JOURNAL_SLOTS;
+    ringCount--;
+    ringSeq++;
+    dropped++;
+  }
+  ring[(ringHead + ringCount) % JOURNAL_SLOTS] = e;
+  ringCount++;
+  portEXIT_CRITICAL(&journalMux);
+}
+
+#if JOURNAL_FLASH_SPILL
+static void saveMeta(Preferences &p) { p.putBytes("meta", &meta, sizeof(meta)); }
+
+// Oldest chunk acked: delete it, then stage the next one
+static void serviceStaged() {
+  char key[8];
+  if (stagedDone) {
+    Preferences p;
+    p.begin(JOURNAL_NVS_NS, false);
+    spillKey(meta.first, key);
+    p.remove(key);
+    portENTER_CRITICAL(&journalMux);
+    meta.first = (meta.first + 1) % JOURNAL_SPILL_CHUNKS;
+    meta.chunks--;
+    portEXIT_CRITICAL(&journalMux);
+    saveMeta(p);
+    p.end();
+    stagedValid = false;
+    stagedDone = false;
+  }
+  while (!stagedValid && meta.chunks) {
+    Preferences p;
+    p.begin(JOURNAL_NVS_NS, false);
+    spillKey(meta.first, key);
+    bool ok = p.getBytes(key, &staged, sizeof(staged)) >= offsetof(SpillChunk, ev) &&
+              staged.magic == JOURNAL_CHUNK_MAGIC && staged.count && staged.count <= JOURNAL_SPILL_CHUNK;
+    if (!ok) { // write never finished (power cut): skip the slot
+      LOGW("JRNL", "Spill chunk %u unreadable, skipped", (unsigned)meta.first);
+      p.remove(key);
+      portENTER_CRITICAL(&journalMux);
+      meta.first = (meta.first + 1) % JOURNAL_SPILL_CHUNKS;
+      meta.chunks--;
+      portEXIT_CRITICAL(&journalMux);
+      saveMeta(p);
+    }
+    p.end();
+    if (ok) {
+      stagedOffset = 0;
+      stagedValid = true;
+    }
+  }
+}
+
+// Ring past the high watermark: move its oldest records to the next free slot.
+// Not while a batch read from the ring waits for its ack: those records are the
+// oldest ones and would be replayed a second time from flash.
+static void spillOldest() {
+  portENTER_CRITICAL(&journalMux);
+  if (ringInFlight || ringCount < JOURNAL_SPILL_AT || meta.chunks >= JOURNAL_SPILL_CHUNKS) {
+    portEXIT_CRITICAL(&journalMux);
+    return;
+  }
+  int n = 0;
+  while (n < JOURNAL_SPILL_CHUNK) {
+    outChunk.ev[n++] = ring[ringHead];
+    ringHead = (ringHead + 1) % JOURNAL_SLOTS;
+    ringCount--;
+  }
+  ringSeq += n;
+  uint8_t slot = (meta.first + meta.chunks) % JOURNAL_SPILL_CHUNKS;
+  meta.chunks++; // replay now waits for this chunk before it reads the ring
+  portEXIT_CRITICAL(&journalMux);
+
+  outChunk.magic = JOURNAL_CHUNK_MAGIC;
+  outChunk.count = n;
+  outChunk.reserved = 0;
+  outChunk.anchor = liveAnchor();
+  char key[8];
+  spillKey(slot, key);
+  Preferences p;
+  p.begin(JOURNAL_NVS_NS, false);
+  size_t size = offsetof(SpillChunk, ev) + n * sizeof(JournalEvent);
+  if (p.putBytes(key, &outChunk, size) != size) LOGE("JRNL", "Spill to %s failed", key);
+  saveMeta(p);
+  p.end();
+  LOGI("JRNL", "Spilled %d records to %s (%u chunks)", n, key, (unsigned)meta.chunks);
+}
+#endif
+
+void journalCommit() {
+#if JOURNAL_FLASH_SPILL
+  serviceStaged();
+  spillOldest();
+#endif
+}
+
+int journalPeek(JournalEvent *out, int max, JournalAnchor &anchor) {
+  if (stagedValid && !stagedDone) {
+    int n = min(max, (int)staged.count - stagedOffset);
+    memcpy(out, &staged.ev[stagedOffset], n * sizeof(JournalEvent));
+    anchor = staged.anchor;
+    lastPeekStaged = true;
+    return n;
+  }
+  lastPeekStaged = false;
+  if (meta.chunks) return 0; // older records still in flash, staged by the telemetry task
+  anchor = liveAnchor();
+  portENTER_CRITICAL(&journalMux);
+  int n = min(max, (int)ringCount);
+  for (int k = 0; k < n; k++) out[k] = ring[(ringHead + k) % JOURNAL_SLOTS];
+  peekSeq = ringSeq;
+  ringInFlight = n > 0;
+  portEXIT_CRITICAL(&journalMux);
+  return n;
+}
+
+void journalConsume(int n) {
+  if (lastPeekStaged) {
+    stagedOffset += n;
+    if (stagedOffset >= staged.count) stagedDone = true;
+    return;
+  }
+  // By sequence number: records that left the ring since the peek are not the
+  // ones at the head any more
+  portENTER_CRITICAL(&journalMux);
+  int32_t acked = (int32_t)(peekSeq + n - ringSeq);
+  int drop = acked > 0 ? min((int)acked, (int)ringCount) : 0;
+  ringHead = (ringHead + drop) % JOURNAL_SLOTS;
+  ringCount -= drop;
+  ringSeq += drop;
+  ringInFlight = false;
+  portEXIT_CRITICAL(&journalMux);
+}
+
+void journalAbandon() {
+  ringInFlight = false;
+}
+
+uint32_t journalPending() { return ringCount + (uint32_t)meta.chunks * JOURNAL_SPILL_CHUNK; } // chunks counted full
+
+uint32_t journalDropped() { return dropped; }
@@ -0,0 +1,51 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Offline event journal ----------------
+// Relay changes, manual switch edges and PIR transitions that happen while the
+// backend is unreachable go into a bounded RAM ring of 8-byte records instead of
+// being lost. With JOURNAL_FLASH_SPILL the oldest JOURNAL_SPILL_CHUNK records are
+// moved to NVS once the ring fills up (and survive a power cut); otherwise a full
+// ring overwrites its oldest record and counts it.
+//
+// After auth_success the net task replays the journal oldest first: it peeks a
+// batch, sends it, and consumes it only once the server acks it. The ring is not
+// spilled while such a batch is in flight.
+//
+// journalRecord() from any task (not ISRs); journalCommit() only from the
+// telemetry task (NVS); journalPeek() / journalConsume() from the net task.
+
+enum JournalKind : uint8_t {
+  JOURNAL_RELAY,   // idx = switch, state = relay on
+  JOURNAL_MANUAL,  // idx = switch, state = wall switch active
+  JOURNAL_PIR,     // idx = sensor, state = occupied
+};
+
+struct __attribute__((packed)) JournalEvent {
+  uint32_t upMs;   // millis() when it happened
+  uint8_t  kind;
+  uint8_t  idx;
+  uint8_t  state;
+  uint8_t  reserved;
+};
+
+// Ties upMs to wall time for the boot the events come from
+struct JournalAnchor {
+  uint32_t boot;   // stateEpoch of that boot
+  uint32_t epoch;  // wall clock seconds at upMs (0 = clock was not set)
+  uint32_t upMs;
+};
+
+void journalBegin(uint32_t boot);
+void journalRecord(JournalKind kind, int idx, bool state);
+void journalCommit();
+int journalPeek(JournalEvent *out, int max, JournalAnchor &anchor);  // oldest first, 0 = nothing ready
+void journalConsume(int n);          // drop the first n records of the last peek
+void journalAbandon();               // the last peek will not be acked (connection lost)
+uint32_t journalPending();           // records in RAM + flash
+uint32_t journalDropped();           // records overwritten since boot
+
+#endif
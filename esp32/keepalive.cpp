@@ -0,0 +1,127 @@
+#include "keepalive.h"
+#include "logger.h"
+
+// ========= State =========
+static uint32_t pingMs = KEEPALIVE_PING_MS;
+static uint32_t idleHeartbeatMs = HEARTBEAT_IDLE_INTERVAL_MS;
+
+static uint32_t lastActivity = 0;
+static uint32_t lastRx = 0;
+static uint32_t lastHeartbeat = 0;
+static uint32_t lastKeepalive = 0;    // heartbeat or ping
+static bool heartbeatNow = false;     // first one right after auth
+
+static uint32_t pingSentAt = 0;
+static bool pingOutstanding = false;
+static bool pingAsleep = false;       // sent with modem sleep in effect
+static bool pingRetry = false;        // ping without waiting: pong missed, or the baseline after auth
+static uint8_t missed = 0;
+
+static bool sleeping = false;
+static bool backoff = false;
+static uint32_t backoffUntil = 0;
+
+static KeepaliveStats stats;
+
+static bool isActive(uint32_t now) { return now - lastActivity < KEEPALIVE_ACTIVE_MS; }
+
+static uint32_t heartbeatInterval(uint32_t now) {
+  return isActive(now) ? HEARTBEAT_INTERVAL_MS : idleHeartbeatMs;
+}
+
+// ========= Connection =========
+void keepaliveReset(uint32_t now) {
+  lastRx = lastKeepalive = lastHeartbeat = now;
+  lastActivity = now; // the backend just got the device back: short heartbeat, radio awake
+  heartbeatNow = true;
+  pingRetry = true; // first round trip with the radio awake: the baseline for sleep
+  pingOutstanding = false;
+  missed = 0;
+  stats.awakeRttMs = 0; // the path may have changed
+}
+
+void keepaliveHint(uint32_t ping, uint32_t heartbeat) {
+  if (ping) pingMs = constrain(ping, (uint32_t)KEEPALIVE_PING_MIN_MS, (uint32_t)KEEPALIVE_PING_MAX_MS);
+  if (heartbeat) idleHeartbeatMs = constrain(heartbeat, (uint32_t)HEARTBEAT_INTERVAL_MS, (uint32_t)HEARTBEAT_MAX_INTERVAL_MS);
+}
+
+void keepaliveActivity(uint32_t now) { lastActivity = now; }
+
+void keepaliveRx(uint32_t now) {
+  lastRx = now;
+  missed = 0;
+}
+
+void keepalivePong(uint32_t now) {
+  if (!pingOutstanding) return;
+  pingOutstanding = false;
+  uint32_t rtt = now - pingSentAt;
+  stats.rttMs = rtt;
+  stats.pongs++;
+  if (!pingAsleep) {
+    if (!stats.awakeRttMs || rtt < stats.awakeRttMs) stats.awakeRttMs = rtt;
+    return;
+  }
+  // No awake sample yet: count the whole round trip against sleep
+  stats.sleepAddedMs = rtt > stats.awakeRttMs ? rtt - stats.awakeRttMs : 0;
+  if (stats.sleepAddedMs > POWER_MAX_CMD_LATENCY_MS && !backoff) {
+    backoff = true;
+    backoffUntil = now + POWER_SLEEP_BACKOFF_MS;
+    stats.sleepBackoffs++;
+    LOGW("KA", "Modem sleep adds %lu ms (bound %u ms), staying awake for %lu s", (unsigned long)stats.sleepAddedMs,
+         POWER_MAX_CMD_LATENCY_MS, (unsigned long)(POWER_SLEEP_BACKOFF_MS / 1000));
+  }
+}
+
+// ========= Scheduling =========
+KeepaliveAction keepaliveTick(uint32_t now) {
+  if (pingOutstanding && now - pingSentAt >= KEEPALIVE_PONG_TIMEOUT_MS) {
+    pingOutstanding = false;
+    if ((int32_t)(lastRx - pingSentAt) < 0) { // nothing at all since the ping
+      if (++missed >= KEEPALIVE_MISSED_PONGS) {
+        LOGW("KA", "No pong for %u pings, dropping the connection", (unsigned)missed);
+        missed = 0;
+        return KEEPALIVE_DEAD;
+      }
+      pingRetry = true;
+    }
+  }
+  if (heartbeatNow || now - lastHeartbeat >= heartbeatInterval(now)) return KEEPALIVE_HEARTBEAT;
+  if (!pingOutstanding && (pingRetry || now - lastKeepalive >= pingMs)) return KEEPALIVE_PING;
+  return KEEPALIVE_NONE;
+}
+
+void keepaliveSent(KeepaliveAction a, uint32_t now) {
+  lastKeepalive = now;
+  if (a == KEEPALIVE_HEARTBEAT) {
+    lastHeartbeat = now;
+    heartbeatNow = false;
+    stats.heartbeats++;
+  } else if (a == KEEPALIVE_PING) {
+    pingSentAt = now;
+    pingOutstanding = true;
+    pingAsleep = sleeping;
+    pingRetry = false;
+    stats.pings++;
+  }
+}
+
+// ========= Power =========
+bool keepaliveSleep(uint32_t now, bool stayAwake) {
+#if ENABLE_MODEM_SLEEP
+  if (backoff && (int32_t)(now - backoffUntil) >= 0) backoff = false;
+  sleeping = !stayAwake && !backoff && now - lastActivity >= POWER_HOT_MS;
+#else
+  sleeping = false;
+#endif
+  return sleeping;
+}
+
+void keepaliveStats(KeepaliveStats &out) {
+  uint32_t now = millis();
+  out = stats;
+  out.heartbeatMs = heartbeatInterval(now);
+  out.pingMs = pingMs;
+  out.active = isActive(now);
+  out.sleeping = sleeping;
+}
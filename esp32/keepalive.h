@@ -0,0 +1,48 @@
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Keepalive / power ----------------
+// Decides when the link needs proof of life and how awake the radio has to be.
+//
+//  - App heartbeat: every HEARTBEAT_INTERVAL_MS for KEEPALIVE_ACTIVE_MS after a
+//    command or state change, otherwise the idle interval (server hint or
+//    HEARTBEAT_IDLE_INTERVAL_MS).
+//  - Ping: only when neither a heartbeat nor a ping went out for the ping interval,
+//    so an active device does not pay for both. The caller puts compact telemetry in
+//    its payload. Pongs that stop coming while nothing else is received either
+//    (KEEPALIVE_MISSED_PONGS) mean the TCP connection is dead.
+//  - Modem sleep: allowed once POWER_HOT_MS passed without activity and nothing
+//    asked to stay awake. A ping sent asleep measures what sleep adds to a downlink
+//    frame (its round trip minus the fastest one seen awake); above
+//    POWER_MAX_CMD_LATENCY_MS sleep is suspended for POWER_SLEEP_BACKOFF_MS.
+//
+// Net task only; times are millis().
+
+enum KeepaliveAction : uint8_t { KEEPALIVE_NONE, KEEPALIVE_HEARTBEAT, KEEPALIVE_PING, KEEPALIVE_DEAD };
+
+struct KeepaliveStats {
+  uint32_t heartbeatMs;   // interval in effect
+  uint32_t pingMs;
+  uint32_t rttMs;         // last ping round trip
+  uint32_t awakeRttMs;    // fastest round trip with the radio awake (0 = none yet)
+  uint32_t sleepAddedMs;  // last measured extra latency while asleep
+  uint32_t heartbeats, pings, pongs;
+  uint32_t sleepBackoffs; // bound exceeded
+  bool active;            // short heartbeat interval
+  bool sleeping;          // modem sleep in effect
+};
+
+void keepaliveReset(uint32_t now);                 // authenticated connection (re)established
+void keepaliveHint(uint32_t pingMs, uint32_t heartbeatMs); // 0 = keep the default
+void keepaliveActivity(uint32_t now);              // command, state change
+void keepaliveRx(uint32_t now);                    // any frame from the backend
+void keepalivePong(uint32_t now);
+KeepaliveAction keepaliveTick(uint32_t now);       // at most one action per call
+void keepaliveSent(KeepaliveAction a, uint32_t now);
+bool keepaliveSleep(uint32_t now, bool stayAwake); // modem sleep wanted now; records the mode in effect
+void keepaliveStats(KeepaliveStats &out);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// ---------------- Latency histograms ----------------
+// Fixed log2 buckets: bucket b counts samples in [2^b, 2^(b+1)) us, bucket 0 also
+// takes 0 us and the last bucket everything above ~8 s. Percentiles are reported
+// as the upper bound of the bucket that reaches them (capped at the observed max),
+// so they are at most 2x pessimistic and cost nothing to compute.
+//
+// Each histogram has a single writer task; the network task reads and resets them
+// once per heartbeat. A sample racing the reset may be lost, which is acceptable
+// for telemetry and avoids a lock on the actuation path.
+
+#define LAT_BUCKETS 24
+
+struct LatencyHist {
+  uint32_t bucket[LAT_BUCKETS];
+  uint32_t count;
+  uint32_t maxUs;
+
+  void add(uint32_t us) {
+    int b = us ? 31 - __builtin_clz(us) : 0;
+    if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+    bucket[b]++;
+    count++;
+    if (us > maxUs) maxUs = us;
+  }
+
+  uint32_t percentile(uint32_t pct) const {
+    if (!count) return 0;
+    uint32_t target = (uint32_t)(((uint64_t)count * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+      seen += bucket[b];
+      if (seen >= target) {
+        uint32_t upper = (b >= 31) ? 0xFFFFFFFFUL : ((2UL << b) - 1);
+        return upper < maxUs ? upper : maxUs;
+      }
+    }
+    return maxUs;
+  }
+};
+
+// Stages measured (names are the JSON heartbeat keys)
+enum LatencyStage : uint8_t {
+  LAT_QUEUE,          // cmdQueue enqueue -> GPIO task dequeue
+  LAT_CMD_RELAY,      // backend frame received -> relay outputs written
+  LAT_CMD_ACK,        // backend frame received -> state_update / batch ack sent
+  LAT_MANUAL_RELAY,   // first manual pin edge -> relay written (includes DEBOUNCE_MS)
+  LAT_MANUAL_ACK,     // first manual pin edge -> state_update sent
+  LAT_COUNT
+};
+
+static const char *const latencyStageNames[LAT_COUNT] = { "queue", "cmd", "cmdAck", "manual", "manualAck" };
+
+#endif
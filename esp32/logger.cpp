@@ -0,0 +1,102 @@
+#include "logger.h"
+#include <atomic>
+#include <stdarg.h>
+
+static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be a power of two");
+
+struct LogSlot {
+  std::atomic<uint32_t> ready;  // claim index + 1 once the text is complete
+  uint16_t len;
+  char text[LOG_LINE_LEN];
+};
+
+static LogSlot ring[LOG_RING_SLOTS];
+static std::atomic<uint32_t> head{0};   // next index to claim (producers)
+static std::atomic<uint32_t> tail{0};   // next index to drain (log task only writes it)
+static std::atomic<uint32_t> dropped{0};
+static uint32_t droppedReported = 0;
+
+// Recent lines for get_logs, written by the log task only
+static char history[LOG_HISTORY_LINES][LOG_LINE_LEN];
+static uint32_t historyCount = 0;
+static portMUX_TYPE historyMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char levelChar[] = { '-', 'E', 'W', 'I', 'D' };
+
+void logWrite(uint8_t level, const char *tag, const char *fmt, ...) {
+  uint32_t idx = head.load(std::memory_order_relaxed);
+  do {
+    if (idx - tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  } while (!head.compare_exchange_weak(idx, idx + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+  LogSlot &s = ring[idx & (LOG_RING_SLOTS - 1)];
+  int n = snprintf(s.text, LOG_LINE_LEN, "%c %lu [%s] ", levelChar[level], (unsigned long)millis(), tag);
+  if (n < 0) n = 0;
+  if (n < LOG_LINE_LEN - 1) {
+    va_list ap;
+    va_start(ap, fmt);
+    int m = vsnprintf(s.text + n, LOG_LINE_LEN - n, fmt, ap);
+    va_end(ap);
+    if (m > 0) n += m;
+  }
+  if (n > LOG_LINE_LEN - 2) n = LOG_LINE_LEN - 2; // truncated: keep room for the newline
+  s.text[n++] = '\n';
+  s.text[n] = '\0';
+  s.len = n;
+  s.ready.store(idx + 1, std::memory_order_release);
+}
+
+static void remember(const LogSlot &s) {
+  portENTER_CRITICAL(&historyMux);
+  char *dst = history[historyCount % LOG_HISTORY_LINES];
+  memcpy(dst, s.text, s.len - 1); // without the newline
+  dst[s.len - 1] = '\0';
+  historyCount++;
+  portEXIT_CRITICAL(&historyMux);
+}
+
+// Drain in claim order; stop at a slot still being formatted or when the UART is full
+static void drain(bool block) {
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  for (;;) {
+    uint32_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != droppedReported && (block || Serial.availableForWrite() >= 32)) {
+      Serial.printf("W %lu [LOG] %lu lines dropped\n", (unsigned long)millis(), (unsigned long)(lost - droppedReported));
+      droppedReported = lost;
+    }
+    LogSlot &s = ring[t & (LOG_RING_SLOTS - 1)];
+    if (s.ready.load(std::memory_order_acquire) != t + 1) break;
+    if (!block && Serial.availableForWrite() < s.len) break;
+    Serial.write((const uint8_t *)s.text, s.len);
+    remember(s);
+    tail.store(++t, std::memory_order_release);
+  }
+}
+
+void logDrain() { drain(false); }
+
+void logFlushBlocking() {
+  drain(true);
+  Serial.flush();
+}
+
+uint32_t logDropped() { return dropped.load(std::memory_order_relaxed); }
+
+int logRecent(int max, LogLineSink emit, void *ctx) {
+  char line[LOG_LINE_LEN];
+  uint32_t end = historyCount;
+  uint32_t avail = end < LOG_HISTORY_LINES ? end : LOG_HISTORY_LINES;
+  uint32_t n = (uint32_t)max < avail ? (uint32_t)max : avail;
+  int emitted = 0;
+  for (uint32_t i = end - n; i != end; i++) {
+    portENTER_CRITICAL(&historyMux);
+    bool live = historyCount - i <= LOG_HISTORY_LINES; // not overwritten meanwhile
+    if (live) memcpy(line, history[i % LOG_HISTORY_LINES], LOG_LINE_LEN);
+    portEXIT_CRITICAL(&historyMux);
+    if (live) { emit(line, ctx); emitted++; }
+  }
+  return emitted;
+}
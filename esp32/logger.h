@@ -0,0 +1,53 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Asynchronous logger ----------------
+// Producers format into a fixed ring of lines and return; nothing touches the UART
+// on the caller's task. The ring is multi-producer / single-consumer and lock free
+// (slot claim by CAS on the head index). A full ring drops the new line and counts
+// it instead of blocking. The log task drains the ring to Serial, writing only
+// what fits the UART FIFO, and keeps the most recent lines for get_logs.
+//
+// Lines below LOG_LEVEL are removed by the preprocessor, arguments included.
+// Not for ISRs (vsnprintf is not IRAM safe).
+
+#define LOG_LEVEL_NONE   0
+#define LOG_LEVEL_ERROR  1
+#define LOG_LEVEL_WARN   2
+#define LOG_LEVEL_INFO   3
+#define LOG_LEVEL_DEBUG  4
+
+void logWrite(uint8_t level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+void logDrain();                  // log task: move ready lines to Serial (non-blocking)
+void logFlushBlocking();          // before a reboot: write everything out, waiting on the UART
+uint32_t logDropped();            // lines lost to a full ring since boot
+
+// Copies up to max recent lines (oldest first) into out via emit; returns lines emitted
+typedef void (*LogLineSink)(const char *line, void *ctx);
+int logRecent(int max, LogLineSink emit, void *ctx);
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(tag, ...) logWrite(LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#else
+#define LOGE(tag, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(tag, ...) logWrite(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#else
+#define LOGW(tag, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(tag, ...) logWrite(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#else
+#define LOGI(tag, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(tag, ...) logWrite(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#else
+#define LOGD(tag, ...) do {} while (0)
+#endif
+
+#endif
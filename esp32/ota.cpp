@@ -0,0 +1,373 @@
+#include "ota.h"
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#ifdef OTA_SIGNING_PUBKEY
+#include <mbedtls/pk.h>
+#endif
+#include "logger.h"
+
+#if !defined(OTA_CA_CERT) && defined(WEBSOCKET_CA_CERT)
+#define OTA_CA_CERT WEBSOCKET_CA_CERT
+#endif
+
+// ========= Job =========
+// Written by otaStart() while no task runs, then owned by the OTA task; the net
+// task only reads the volatile status fields.
+static OtaRequest job;
+static volatile OtaState state = OTA_IDLE;
+static volatile uint32_t written = 0;
+static volatile uint32_t total = 0;
+static const char *volatile error = nullptr;
+static volatile bool reportPending = false;
+static uint32_t reportedPct = 0;
+static char errBuf[24];
+
+static OtaBusyFn busyFn = nullptr;
+static OtaDoneFn doneFn = nullptr;
+
+// ========= Transfer =========
+static WiFiClientSecure client;
+static HTTPClient http;
+static Stream *in = nullptr;
+static bool connected = false;
+static uint32_t inLeft = 0;               // body bytes still to read
+static uint8_t chunk[OTA_CHUNK_BYTES];    // last read from the body
+static uint32_t chunkPos = 0, chunkLen = 0;
+
+static const esp_partition_t *target = nullptr;
+static const esp_partition_t *running = nullptr;
+static esp_ota_handle_t handle = 0;
+static bool otaOpen = false;
+static mbedtls_sha256_context sha;
+
+// ========= ODP1 decoder =========
+#define PATCH_MAGIC     0x3150444F  // "ODP1"
+#define PATCH_OP_COPY   0x01
+#define PATCH_OP_DATA   0x02
+#define PATCH_OP_END    0xFF
+
+enum PatchPhase : uint8_t { PATCH_HEADER, PATCH_OP, PATCH_ARGS, PATCH_DATA, PATCH_FINISHED };
+static PatchPhase phase;
+static uint8_t op;
+static uint8_t args[8];
+static uint8_t argLen;
+static uint32_t dataLeft;
+static uint32_t copySrc = 0, copyLeft = 0;
+static uint8_t copyBuf[1024];
+
+static uint32_t le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static void report() {
+  reportPending = true;
+}
+
+static void fail(const char *why) {
+  if (otaOpen) esp_ota_abort(handle);
+  otaOpen = false;
+  if (connected) http.end();
+  connected = false;
+  mbedtls_sha256_free(&sha);
+  error = why;
+  state = OTA_FAILED;
+  LOGE("OTA", "Failed: %s (%lu/%lu bytes)", why, (unsigned long)written, (unsigned long)total);
+  report();
+}
+
+// Append to the new image
+static bool emit(const uint8_t *p, size_t n) {
+  if (written + n > total) {
+    fail("too_long");
+    return false;
+  }
+  if (esp_ota_write(handle, p, n) != ESP_OK) {
+    fail("flash_write");
+    return false;
+  }
+  mbedtls_sha256_update(&sha, p, n);
+  written += n;
+  uint32_t pct = (uint64_t)written * 100 / total;
+  if (pct >= reportedPct + OTA_REPORT_PCT) {
+    reportedPct = pct - pct % OTA_REPORT_PCT;
+    report();
+  }
+  return true;
+}
+
+// Consume delta bytes from chunk until the input runs out or a COPY is pending
+static bool patchFeed() {
+  while (chunkPos < chunkLen && !copyLeft) {
+    switch (phase) {
+      case PATCH_HEADER:
+      case PATCH_ARGS: {
+        uint8_t need = phase == PATCH_HEADER ? 8 : (op == PATCH_OP_COPY ? 8 : 4);
+        while (argLen < need && chunkPos < chunkLen) args[argLen++] = chunk[chunkPos++];
+        if (argLen < need) return true;
+        argLen = 0;
+        if (phase == PATCH_HEADER) {
+          if (le32(args) != PATCH_MAGIC || le32(args + 4) != total) {
+            fail("patch_header");
+            return false;
+          }
+          phase = PATCH_OP;
+        } else if (op == PATCH_OP_COPY) {
+          copySrc = le32(args);
+          copyLeft = le32(args + 4);
+          if (copySrc > running->size || copyLeft > running->size - copySrc) {
+            fail("patch_range");
+            return false;
+          }
+          phase = PATCH_OP;
+        } else {
+          dataLeft = le32(args);
+          phase = dataLeft ? PATCH_DATA : PATCH_OP;
+        }
+      } break;
+      case PATCH_OP:
+        op = chunk[chunkPos++];
+        if (op == PATCH_OP_END) {
+          phase = PATCH_FINISHED;
+        } else if (op == PATCH_OP_COPY || op == PATCH_OP_DATA) {
+          phase = PATCH_ARGS;
+        } else {
+          fail("patch_op");
+          return false;
+        }
+        break;
+      case PATCH_DATA: {
+        uint32_t n = min(dataLeft, chunkLen - chunkPos);
+        if (!emit(chunk + chunkPos, n)) return false;
+        chunkPos += n;
+        dataLeft -= n;
+        if (!dataLeft) phase = PATCH_OP;
+      } break;
+      case PATCH_FINISHED:
+        fail("patch_trailing");
+        return false;
+    }
+  }
+  return true;
+}
+
+// At most one chunk of a pending COPY per step, like a chunk of download
+static bool patchCopy() {
+  uint32_t budget = OTA_CHUNK_BYTES;
+  while (copyLeft && budget) {
+    uint32_t n = min(min(copyLeft, budget), (uint32_t)sizeof(copyBuf));
+    if (esp_partition_read(running, copySrc, copyBuf, n) != ESP_OK) {
+      fail("base_read");
+      return false;
+    }
+    if (!emit(copyBuf, n)) return false;
+    copySrc += n;
+    copyLeft -= n;
+    budget -= n;
+  }
+  return true;
+}
+
+// ========= Verify + switch =========
+static bool verifySignature(const uint8_t *digest) {
+#ifdef OTA_SIGNING_PUBKEY
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  bool ok = mbedtls_pk_parse_public_key(&pk, (const unsigned char *)OTA_SIGNING_PUBKEY, strlen(OTA_SIGNING_PUBKEY) + 1) == 0 &&
+            mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, digest, 32, job.sig, job.sigLen) == 0;
+  mbedtls_pk_free(&pk);
+  return ok;
+#else
+  (void)digest;
+  return true;
+#endif
+}
+
+static void finish() {
+  http.end();
+  connected = false;
+  if (job.delta && (phase != PATCH_FINISHED || copyLeft)) return fail("patch_truncated");
+  if (written != total) return fail("truncated");
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  if (memcmp(digest, job.sha256, sizeof(digest))) return fail("sha256");
+  if (!verifySignature(digest)) return fail("signature");
+  otaOpen = false;
+  if (esp_ota_end(handle) != ESP_OK) return fail("image_invalid"); // esp_ota_end also checks the image
+  if (esp_ota_set_boot_partition(target) != ESP_OK) return fail("boot_partition");
+  state = OTA_DONE;
+  LOGI("OTA", "%s written to %s (%lu bytes), rebooting", job.version, target->label, (unsigned long)written);
+  report();
+}
+
+static bool connect() {
+#ifdef OTA_CA_CERT
+  client.setCACert(OTA_CA_CERT);
+#else
+  client.setInsecure(); // only with OTA_SIGNING_PUBKEY (otaStart): the signature vouches for the image
+#endif
+  http.setReuse(false);
+  http.setTimeout(OTA_HTTP_TIMEOUT_MS);
+  if (!http.begin(client, job.url)) {
+    fail("url");
+    return false;
+  }
+  connected = true;
+  int code = http.GET();
+  if (code != 200) {
+    snprintf(errBuf, sizeof(errBuf), "http_%d", code);
+    fail(errBuf);
+    return false;
+  }
+  int length = http.getSize();
+  if (length <= 0) {
+    fail("no_length"); // chunked transfer: the end of the body could not be told from a cut
+    return false;
+  }
+  if (!job.delta && job.size && (uint32_t)length != job.size) {
+    fail("size_mismatch");
+    return false;
+  }
+  total = job.size ? job.size : length;
+  if (total > target->size) {
+    fail("too_large");
+    return false;
+  }
+  inLeft = length;
+  in = http.getStreamPtr();
+  in->setTimeout(OTA_HTTP_TIMEOUT_MS);
+  // Sequential writes erase one sector at a time instead of the whole partition up front
+  if (esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+    fail("ota_begin");
+    return false;
+  }
+  otaOpen = true;
+  LOGI("OTA", "%s %s: %lu bytes -> %lu byte image", job.version, job.delta ? "delta" : "image",
+       (unsigned long)length, (unsigned long)total);
+  return true;
+}
+
+// ========= Task =========
+static void otaTask(void *) {
+  while (otaStep()) {}
+  if (state == OTA_DONE) {
+    vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+    if (doneFn) doneFn();
+  }
+  vTaskDelete(NULL);
+}
+
+bool otaStep() {
+  if (state != OTA_DOWNLOADING) return false;
+  if (busyFn && busyFn()) { // relay commands first
+    vTaskDelay(pdMS_TO_TICKS(OTA_BUSY_WAIT_MS));
+    return true;
+  }
+  if (!connected) return connect();
+
+  if (copyLeft) {
+    if (!patchCopy()) return false;
+  } else if (chunkPos < chunkLen) {
+    if (!patchFeed()) return false;
+  } else if (inLeft) {
+    uint32_t want = min(inLeft, (uint32_t)sizeof(chunk));
+    size_t n = in->readBytes(chunk, want);
+    if (!n) {
+      fail("timeout");
+      return false;
+    }
+    inLeft -= n;
+    chunkPos = 0;
+    chunkLen = n;
+    if (!job.delta) {
+      chunkPos = chunkLen;
+      if (!emit(chunk, n)) return false;
+    } else if (!patchFeed()) {
+      return false;
+    }
+  } else {
+    finish();
+    return false;
+  }
+  vTaskDelay(pdMS_TO_TICKS(OTA_CHUNK_DELAY_MS));
+  return true;
+}
+
+// ========= Net task API =========
+void otaBegin(OtaBusyFn busy, OtaDoneFn done) {
+  busyFn = busy;
+  doneFn = done;
+}
+
+const char *otaStart(const OtaRequest &req) {
+  if (state == OTA_DOWNLOADING) return "busy";
+  if (state == OTA_DONE) return "reboot_pending";
+  if (strncmp(req.url, "https://", 8)) return "https_only";
+#if !defined(OTA_CA_CERT) && !defined(OTA_SIGNING_PUBKEY)
+  return "insecure"; // URL and sha256 came over unverified TLS: nothing ties the image to us
+#endif
+#ifdef OTA_SIGNING_PUBKEY
+  if (!req.sigLen) return "unsigned";
+#endif
+  running = esp_ota_get_running_partition();
+  target = esp_ota_get_next_update_partition(nullptr);
+  if (!target) return "no_partition";
+  if (req.size > target->size) return "too_large";
+  if (req.delta) {
+    if (!req.size) return "size_required";
+    if (memcmp(req.base, esp_app_get_description()->app_elf_sha256, sizeof(req.base))) return "base_mismatch";
+  }
+
+  job = req;
+  written = total = 0;
+  reportedPct = 0;
+  error = nullptr;
+  chunkPos = chunkLen = 0;
+  copyLeft = 0;
+  phase = PATCH_HEADER;
+  argLen = 0;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  state = OTA_DOWNLOADING;
+  if (xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK, nullptr, OTA_TASK_PRIORITY, nullptr,
+                              OTA_TASK_CORE) != pdPASS) {
+    // Nothing started: back to idle, the caller reports the refusal (not fail(), which reports too)
+    mbedtls_sha256_free(&sha);
+    state = OTA_IDLE;
+    return "no_task";
+  }
+  report();
+  return nullptr;
+}
+
+bool otaTakeReport(OtaStatus &out) {
+  if (!reportPending) return false;
+  reportPending = false;
+  out.state = state;
+  out.written = written;
+  out.size = total ? total : job.size;
+  out.error = error;
+  out.version = job.version;
+  return true;
+}
+
+bool otaBusy() { return state == OTA_DOWNLOADING; }
+
+void otaConfirmBoot() {
+  static bool confirmed = false;
+  if (confirmed) return;
+  confirmed = true;
+  esp_ota_img_states_t st;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &st) == ESP_OK && st == ESP_OTA_IMG_PENDING_VERIFY) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    LOGI("OTA", "New image confirmed");
+  }
+}
+
+const char *otaRunningVersion() { return esp_app_get_description()->version; }
+
+void otaRunningBuild(char *hex65) {
+  const uint8_t *b = esp_app_get_description()->app_elf_sha256;
+  for (int k = 0; k < 32; k++) snprintf(hex65 + 2 * k, 3, "%02x", b[k]);
+}
@@ -0,0 +1,61 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- OTA firmware update ----------------
+// ota_update starts a one-shot low-priority task. It streams the image over HTTPS
+// straight into the inactive app partition, OTA_CHUNK_BYTES at a time, hashing what
+// it writes; nothing larger than one chunk is ever held in RAM.
+//
+// A delta is an ODP1 patch against the running build, decoded while it streams:
+//   "ODP1" u32 size, then ops: 0x01 COPY u32 src u32 len (from the running image),
+//   0x02 DATA u32 len + bytes, 0xFF END. All little endian.
+// The SHA-256 (and ECDSA signature, when OTA_SIGNING_PUBKEY is set) always covers
+// the resulting image, so a full image and a delta are verified the same way.
+//
+// Before every chunk the task waits while the command path has work, and it pauses
+// after every chunk, so relays keep switching during the download. On success the
+// new partition is set for boot and the done callback schedules the planned reboot
+// (which flushes pending config first).
+//
+// otaStart() / otaTakeReport() / otaConfirmBoot() from the net task; otaStep() is
+// one unit of the OTA task's work (the host simulator calls it directly).
+
+#define OTA_SIG_MAX 80  // DER ECDSA P-256 signature (at most 72 bytes)
+
+enum OtaState : uint8_t { OTA_IDLE, OTA_DOWNLOADING, OTA_DONE, OTA_FAILED };
+
+struct OtaRequest {
+  char url[OTA_URL_LEN];
+  char version[32];
+  uint8_t sha256[32];       // of the resulting image
+  uint8_t base[32];         // delta: app_elf_sha256 of the build the patch applies to
+  bool delta;
+  uint32_t size;            // resulting image size (full image: 0 = HTTP Content-Length)
+  uint8_t sig[OTA_SIG_MAX]; // DER signature of sha256
+  uint16_t sigLen;
+};
+
+struct OtaStatus {
+  OtaState state;
+  uint32_t written;
+  uint32_t size;
+  const char *error;        // OTA_FAILED: short reason
+  const char *version;
+};
+
+typedef bool (*OtaBusyFn)();  // true while the command path has work queued
+typedef void (*OtaDoneFn)();  // new image set for boot
+
+void otaBegin(OtaBusyFn busy, OtaDoneFn done);
+const char *otaStart(const OtaRequest &req);  // nullptr = started, else why it was refused
+bool otaStep();                               // false once the job has finished or failed
+bool otaTakeReport(OtaStatus &out);           // state change / progress not reported yet
+void otaConfirmBoot();                        // the running image reached the backend: keep it
+bool otaBusy();                               // a download is running
+const char *otaRunningVersion();
+void otaRunningBuild(char *hex65);            // app_elf_sha256 of the running image, hex
+
+#endif
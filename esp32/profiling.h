@@ -0,0 +1,78 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Subsystem profiling ----------------
+// PROFILE(section) times the enclosing scope with the CPU cycle counter (one
+// register read on entry and exit) and accumulates calls / total / max cycles.
+// Every section is entered from a single task pinned to one core, so the
+// counters need no locking and the cycle counter never jumps between cores.
+// Readers on another task may see a torn 64-bit total, which only skews one
+// report. ENABLE_PROFILING 0 removes all of it.
+
+enum ProfSection : uint8_t {
+  PROF_WIFI,        // netTask: WiFi status poll / reconnect
+  PROF_WS_LOOP,     // netTask: ws.loop() (TCP/TLS I/O + dispatch)
+  PROF_WS_RX,       // netTask: JSON parse + dispatch of one text frame (inside ws.loop)
+  PROF_NET_DRAIN,   // netTask: netQueue drain (serialize + queue)
+  PROF_WS_TX,       // netTask: outbound queue drain (ws.sendTXT / sendBIN)
+  PROF_HEARTBEAT,   // netTask: heartbeat build + send
+  PROF_CMD_DRAIN,   // GPIO task: one cmdQueue drain + relay apply
+  PROF_MANUAL,      // GPIO task: debounced manual edges
+  PROF_LED,         // telemetry task: blinkStatus
+  PROF_CONFIG,      // telemetry task: deferred NVS commit
+  PROF_COUNT
+};
+
+static const char *const profSectionNames[PROF_COUNT] = {
+  "wifi", "wsLoop", "wsRx", "netDrain", "wsTx", "heartbeat", "cmdDrain", "manual", "led", "config"
+};
+
+struct ProfCounter {
+  uint32_t calls;
+  uint64_t cycles;
+  uint32_t maxCycles;
+};
+
+// Loop period (start of one iteration to the start of the next) of the polling
+// tasks; the GPIO task sleeps on its queue, its cost shows up as PROF_CMD_DRAIN
+enum ProfTask : uint8_t { PROF_TASK_NET, PROF_TASK_TELEMETRY, PROF_TASK_COUNT };
+
+struct ProfLoop {
+  uint32_t lastUs;
+  uint32_t maxPeriodUs;
+};
+
+extern ProfCounter profCounters[PROF_COUNT];
+extern ProfLoop profLoops[PROF_TASK_COUNT];
+
+#if ENABLE_PROFILING
+struct ProfScope {
+  ProfCounter &c;
+  uint32_t start;
+  explicit ProfScope(ProfSection s) : c(profCounters[s]), start(ESP.getCycleCount()) {}
+  ~ProfScope() {
+    uint32_t d = ESP.getCycleCount() - start;
+    c.calls++;
+    c.cycles += d;
+    if (d > c.maxCycles) c.maxCycles = d;
+  }
+};
+#define PROF_CONCAT2(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT2(a, b)
+#define PROFILE(section) ProfScope PROF_CONCAT(profScope_, __LINE__)(section)
+
+inline void profLoopTick(ProfTask t) {
+  uint32_t now = micros();
+  ProfLoop &l = profLoops[t];
+  if (l.lastUs && now - l.lastUs > l.maxPeriodUs) l.maxPeriodUs = now - l.lastUs;
+  l.lastUs = now;
+}
+#else
+#define PROFILE(section) do {} while (0)
+inline void profLoopTick(ProfTask) {}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+#include "relay_driver.h"
+#include "logger.h"
+
+#if RELAY_DRIVER == RELAY_DRIVER_GPIO
+#include <soc/gpio_reg.h>
+#elif RELAY_DRIVER == RELAY_DRIVER_MCP23017
+#include <Wire.h>
+#elif RELAY_DRIVER == RELAY_DRIVER_74HC595
+#include <SPI.h>
+#endif
+
+#if RELAY_DRIVER == RELAY_DRIVER_GPIO
+// ========= Native GPIO =========
+// Staged levels become set/clear masks written through the W1TS/W1TC registers
+// (GPIO.out_w1ts / out_w1tc, out1_* for GPIO32+), so a batch switches in one
+// write per bank instead of staggered digitalWrite calls. W1TS/W1TC only touch
+// the bits given, so other tasks' pins (status LED) are never clobbered.
+static uint32_t gpioSet[2], gpioClr[2];  // [0] = GPIO0..31, [1] = GPIO32..39
+
+static void gpioWriteMasks(const uint32_t *set, const uint32_t *clr) {
+  if (set[0]) REG_WRITE(GPIO_OUT_W1TS_REG, set[0]);
+  if (clr[0]) REG_WRITE(GPIO_OUT_W1TC_REG, clr[0]);
+#ifdef GPIO_OUT1_W1TS_REG
+  if (set[1]) REG_WRITE(GPIO_OUT1_W1TS_REG, set[1]);
+  if (clr[1]) REG_WRITE(GPIO_OUT1_W1TC_REG, clr[1]);
+#endif
+}
+
+bool relayDriverBegin() { return true; }
+
+// The output latch is written before the pad becomes an output, so the pin goes
+// straight from input/pull-up to the requested level (no glitch through ON)
+void relayDriverConfigure(int channel, bool on) {
+  if (channel < 0 || channel >= 40) return;
+  uint32_t mask[2] = {0, 0}, none[2] = {0, 0};
+  mask[channel >> 5] = 1UL << (channel & 31);
+  if (relayLevel(on)) gpioWriteMasks(mask, none);
+  else                gpioWriteMasks(none, mask);
+  pinMode(channel, OUTPUT);
+}
+
+void relayDriverStage(int channel, bool on) {
+  if (channel < 0 || channel >= 40) return;
+  uint32_t bit = 1UL << (channel & 31);
+  int bank = channel >> 5;
+  uint32_t high = 0 - (uint32_t)relayLevel(on); // all ones when the pin goes HIGH
+  gpioSet[bank] = (gpioSet[bank] & ~bit) | (bit & high);
+  gpioClr[bank] = (gpioClr[bank] & ~bit) | (bit & ~high);
+}
+
+#if RELAY_STAGGER_GROUP > 0
+// ON bits still waiting for their group; written by relayDriverService() so the
+// caller's locks are not held across RELAY_STAGGER_MS delays
+static uint32_t staggerPending[2];
+static unsigned long staggerNextMs = 0;
+
+static void staggerGroup() {
+  uint32_t group[2] = {0, 0}, none[2] = {0, 0};
+  for (int n = 0; n < RELAY_STAGGER_GROUP && (staggerPending[0] | staggerPending[1]); n++) {
+    int bank = staggerPending[0] ? 0 : 1;
+    uint32_t low = staggerPending[bank] & (0 - staggerPending[bank]); // lowest pending pin
+    group[bank] |= low;
+    staggerPending[bank] &= ~low;
+  }
+  if (kRelayActiveLow) gpioWriteMasks(none, group);
+  else                 gpioWriteMasks(group, none);
+  staggerNextMs = millis() + RELAY_STAGGER_MS;
+}
+#endif
+
+void relayDriverFlush() {
+  if (!(gpioSet[0] | gpioSet[1] | gpioClr[0] | gpioClr[1])) return;
+#if RELAY_STAGGER_GROUP > 0
+  // Inrush control: relays turning OFF all switch at once (cancelling an ON still
+  // waiting), relays turning ON go in groups of RELAY_STAGGER_GROUP with
+  // RELAY_STAGGER_MS between groups; the first one now unless a group just went out
+  const uint32_t *onMask = kRelayActiveLow ? gpioClr : gpioSet;
+  const uint32_t *offMask = kRelayActiveLow ? gpioSet : gpioClr;
+  uint32_t none[2] = {0, 0};
+  if (kRelayActiveLow) gpioWriteMasks(offMask, none);
+  else                 gpioWriteMasks(none, offMask);
+  for (int b = 0; b < 2; b++) staggerPending[b] = (staggerPending[b] & ~offMask[b]) | onMask[b];
+  if ((staggerPending[0] | staggerPending[1]) && (long)(millis() - staggerNextMs) >= 0) staggerGroup();
+#else
+  gpioWriteMasks(gpioSet, gpioClr);
+#endif
+  gpioSet[0] = gpioSet[1] = gpioClr[0] = gpioClr[1] = 0;
+}
+
+uint32_t relayDriverService() {
+#if RELAY_STAGGER_GROUP > 0
+  if (!(staggerPending[0] | staggerPending[1])) return 0;
+  long left = (long)(staggerNextMs - millis());
+  if (left > 0) return left;
+  staggerGroup();
+  return (staggerPending[0] | staggerPending[1]) ? RELAY_STAGGER_MS : 0;
+#else
+  return 0;
+#endif
+}
+
+int relayDriverChannels() { return 40; }
+const char *relayDriverName() { return "gpio"; }
+
+#elif RELAY_DRIVER == RELAY_DRIVER_MCP23017
+// ========= MCP23017 (I2C) =========
+// IOCON.BANK = 0 (power-on default): OLATA/OLATB are adjacent and the address pointer
+// auto-increments, so one write per chip updates all 16 outputs.
+#define MCP_IODIRA  0x00
+#define MCP_OLATA   0x14
+
+static uint16_t mcpLatch[MCP23017_COUNT];   // output levels as written to OLAT
+static uint8_t  mcpDirty = 0;                // bit k = chip k has staged changes
+static_assert(MCP23017_COUNT >= 1 && MCP23017_COUNT <= 8, "MCP23017 address space is 8 chips");
+
+static bool mcpWrite(int chip, uint8_t reg, uint16_t value) {
+  Wire.beginTransmission(MCP23017_BASE_ADDR + chip);
+  Wire.write(reg);
+  Wire.write(value & 0xFF);    // port A
+  Wire.write(value >> 8);      // port B
+  return Wire.endTransmission() == 0;
+}
+
+bool relayDriverBegin() {
+  Wire.begin(RELAY_I2C_SDA, RELAY_I2C_SCL, RELAY_I2C_FREQ);
+  bool ok = true;
+  uint16_t off = relayLevel(false) ? 0xFFFF : 0x0000;
+  for (int k = 0; k < MCP23017_COUNT; k++) {
+    mcpLatch[k] = off;
+    // Latch OFF before switching the pins to outputs so relays do not chatter at boot
+    ok &= mcpWrite(k, MCP_OLATA, off);
+    ok &= mcpWrite(k, MCP_IODIRA, 0x0000);
+  }
+  mcpDirty = 0;
+  if (!ok) LOGE("RELAY", "MCP23017 not responding");
+  return ok;
+}
+
+void relayDriverConfigure(int channel, bool on) {} // all outputs after begin (latched OFF)
+
+void relayDriverStage(int channel, bool on) {
+  if (channel < 0 || channel >= MCP23017_COUNT * 16) return;
+  int chip = channel >> 4;
+  uint16_t bit = 1U << (channel & 15);
+  uint16_t high = 0 - (uint16_t)relayLevel(on);
+  uint16_t next = (mcpLatch[chip] & ~bit) | (bit & high);
+  if (next == mcpLatch[chip]) return;
+  mcpLatch[chip] = next;
+  mcpDirty |= 1U << chip;
+}
+
+void relayDriverFlush() {
+  for (int k = 0; mcpDirty && k < MCP23017_COUNT; k++) {
+    if (!(mcpDirty & (1U << k))) continue;
+    if (!mcpWrite(k, MCP_OLATA, mcpLatch[k])) {
+      LOGW("RELAY", "MCP23017 #%d write failed", k);
+      continue; // stays dirty, retried on the next flush
+    }
+    mcpDirty &= ~(1U << k);
+  }
+}
+
+uint32_t relayDriverService() { return 0; }
+
+int relayDriverChannels() { return MCP23017_COUNT * 16; }
+const char *relayDriverName() { return "mcp23017"; }
+
+#elif RELAY_DRIVER == RELAY_DRIVER_74HC595
+// ========= 74HC595 chain (SPI) =========
+// The whole chain is shifted on every flush (there is no partial update); the
+// latch pulse makes all outputs change together.
+static uint8_t hcShift[HC595_COUNT];   // [0] = last chip in the chain (shifted first)
+static bool hcDirty = false;
+static SPISettings hcSpi(8000000, MSBFIRST, SPI_MODE0);
+
+static void hcWrite() {
+  uint8_t out[HC595_COUNT];
+  memcpy(out, hcShift, sizeof(out)); // transfer() overwrites the buffer with MISO
+  SPI.beginTransaction(hcSpi);
+  SPI.transfer(out, sizeof(out));
+  SPI.endTransaction();
+  digitalWrite(HC595_LATCH_PIN, HIGH);
+  digitalWrite(HC595_LATCH_PIN, LOW);
+}
+
+bool relayDriverBegin() {
+  pinMode(HC595_LATCH_PIN, OUTPUT);
+  digitalWrite(HC595_LATCH_PIN, LOW);
+  SPI.begin(HC595_CLOCK_PIN, -1, HC595_DATA_PIN, -1);
+  memset(hcShift, relayLevel(false) ? 0xFF : 0x00, sizeof(hcShift));
+  hcWrite();
+  hcDirty = false;
+  if (HC595_OE_PIN >= 0) {
+    pinMode(HC595_OE_PIN, OUTPUT);
+    digitalWrite(HC595_OE_PIN, LOW); // outputs on only once they hold OFF
+  }
+  return true;
+}
+
+void relayDriverConfigure(int channel, bool on) {}
+
+void relayDriverStage(int channel, bool on) {
+  if (channel < 0 || channel >= HC595_COUNT * 8) return;
+  uint8_t &reg = hcShift[HC595_COUNT - 1 - (channel >> 3)];
+  uint8_t bit = 1U << (channel & 7);
+  uint8_t high = 0 - (uint8_t)relayLevel(on);
+  uint8_t next = (reg & ~bit) | (bit & high);
+  if (next == reg) return;
+  reg = next;
+  hcDirty = true;
+}
+
+void relayDriverFlush() {
+  if (!hcDirty) return;
+  hcWrite();
+  hcDirty = false;
+}
+
+uint32_t relayDriverService() { return 0; }
+
+int relayDriverChannels() { return HC595_COUNT * 8; }
+const char *relayDriverName() { return "74hc595"; }
+
+#else
+#error "Unknown RELAY_DRIVER"
+#endif
@@ -0,0 +1,25 @@
+#ifndef RELAY_DRIVER_H
+#define RELAY_DRIVER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Relay output driver ----------------
+// setRelay() stages outputs and the batch owner flushes once, so a scene on an
+// expander is one bus transaction per chip instead of one per relay. The backend
+// is chosen at compile time with RELAY_DRIVER (config.h); channel numbers are
+// ESP32 GPIOs for RELAY_DRIVER_GPIO and expander outputs otherwise. Polarity
+// (board profile, kRelayActiveLow) is applied here as a compile-time constant,
+// callers pass the logical relay state.
+//
+// Called from setup() and then only from the GPIO task.
+
+bool relayDriverBegin();                  // bus + chips, all outputs OFF
+void relayDriverConfigure(int channel, bool on);  // make channel an output, already driving on/off
+void relayDriverStage(int channel, bool on);
+void relayDriverFlush();                  // write every staged change (staggered ON groups: the first)
+uint32_t relayDriverService();            // next staggered group if due; ms until the one after, 0 = none left
+int relayDriverChannels();                // valid channels are 0 .. relayDriverChannels() - 1
+const char *relayDriverName();
+
+#endif
@@ -0,0 +1,322 @@
+#include "scheduler.h"
+#include <Preferences.h>
+#include <stddef.h>
+#include <time.h>
+#include "logger.h"
+
+// ========= Rule table =========
+// The table is replaced as a whole by schedulerUpdate() (net task) and read by the
+// tick (telemetry task); both hold ruleMux for the copy only.
+static ScheduleRule rules[SCHEDULE_MAX_RULES];
+static int ruleCount = 0;
+static uint32_t tableVersion = 0;
+static volatile bool tableChanged = false;  // tick must reload its copy
+static volatile bool tableDirty = false;    // NVS write pending (telemetry task)
+static volatile bool tableReplaced = false; // from schedulerUpdate: fire history starts over
+static portMUX_TYPE ruleMux = portMUX_INITIALIZER_UNLOCKED;
+static ScheduleFireFn fireFn = nullptr;
+
+// ========= NVS =========
+// header + count rules + CRC-32, like the switch config blob
+#define SCHEDULE_NVS_NS        "schedule"
+#define SCHEDULE_NVS_KEY       "rules"
+#define SCHEDULE_BLOB_MAGIC    0x5C4D
+#define SCHEDULE_BLOB_VERSION  1
+
+struct __attribute__((packed)) ScheduleBlob {
+  uint16_t     magic;
+  uint8_t      version;
+  uint8_t      count;
+  uint32_t     tableVersion;
+  ScheduleRule rules[SCHEDULE_MAX_RULES];
+  uint8_t      crcSpace[sizeof(uint32_t)];
+};
+
+static size_t blobBody(uint8_t count) { return offsetof(ScheduleBlob, rules) + count * sizeof(ScheduleRule); }
+
+static uint32_t crc32(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFFUL;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static ScheduleBlob blob;  // scratch, ~500 bytes: keep it off the task stacks
+
+static void loadRules() {
+  Preferences p;
+  p.begin(SCHEDULE_NVS_NS, true);
+  size_t len = p.getBytesLength(SCHEDULE_NVS_KEY);
+  bool ok = len >= blobBody(0) + sizeof(uint32_t) && len <= sizeof(blob) &&
+            p.getBytes(SCHEDULE_NVS_KEY, &blob, len) == len;
+  p.end();
+  if (ok) {
+    ok = blob.magic == SCHEDULE_BLOB_MAGIC && blob.version == SCHEDULE_BLOB_VERSION &&
+         blob.count <= SCHEDULE_MAX_RULES && len == blobBody(blob.count) + sizeof(uint32_t);
+  }
+  if (ok) {
+    uint32_t crc;
+    memcpy(&crc, (const uint8_t *)&blob + blobBody(blob.count), sizeof(crc));
+    ok = crc == crc32(&blob, blobBody(blob.count));
+  }
+  if (!ok) {
+    LOGI("SCHED", "No stored schedule");
+    return;
+  }
+  ruleCount = blob.count;
+  tableVersion = blob.tableVersion;
+  memcpy(rules, blob.rules, ruleCount * sizeof(ScheduleRule));
+  LOGI("SCHED", "Loaded %d rules (version %lu)", ruleCount, (unsigned long)tableVersion);
+}
+
+static void saveRules() {
+  portENTER_CRITICAL(&ruleMux);
+  blob.count = ruleCount;
+  blob.tableVersion = tableVersion;
+  memcpy(blob.rules, rules, ruleCount * sizeof(ScheduleRule));
+  portEXIT_CRITICAL(&ruleMux);
+  blob.magic = SCHEDULE_BLOB_MAGIC;
+  blob.version = SCHEDULE_BLOB_VERSION;
+  uint32_t crc = crc32(&blob, blobBody(blob.count));
+  memcpy((uint8_t *)&blob + blobBody(blob.count), &crc, sizeof(crc));
+  size_t size = blobBody(blob.count) + sizeof(uint32_t);
+  Preferences p;
+  p.begin(SCHEDULE_NVS_NS, false);
+  bool ok = p.putBytes(SCHEDULE_NVS_KEY, &blob, size) == size;
+  p.end();
+  if (!ok) LOGE("SCHED", "Save failed");
+}
+
+bool schedulerUpdate(uint32_t version, const ScheduleRule *in, int count) {
+  if (count < 0 || count > SCHEDULE_MAX_RULES) return false;
+  portENTER_CRITICAL(&ruleMux);
+  memcpy(rules, in, count * sizeof(ScheduleRule));
+  ruleCount = count;
+  tableVersion = version;
+  tableChanged = true;
+  tableDirty = true;
+  tableReplaced = true;
+  portEXIT_CRITICAL(&ruleMux);
+  LOGI("SCHED", "Schedule v%lu: %d rules", (unsigned long)version, count);
+  return true;
+}
+
+uint32_t schedulerVersion() { return tableVersion; }
+int schedulerRuleCount() { return ruleCount; }
+
+// ========= Time =========
+static bool timeStarted = false;
+
+void schedulerStartTime() {
+  if (timeStarted) return;
+  timeStarted = true;
+  configTzTime(SCHEDULE_TZ, SCHEDULE_NTP_SERVER_1, SCHEDULE_NTP_SERVER_2);
+}
+
+bool schedulerTimeValid() { return time(nullptr) >= SCHEDULE_MIN_EPOCH; }
+
+// Next local occurrence of rule strictly after `after` (0 if the rule has no days)
+static time_t nextOccurrence(const ScheduleRule &r, time_t after) {
+  if (!(r.days & 0x7F)) return 0;
+  struct tm day;
+  localtime_r(&after, &day);
+  for (int d = 0; d <= 7; d++) {
+    struct tm t = day;
+    t.tm_mday += d;
+    t.tm_hour = r.minute / 60;
+    t.tm_min = r.minute % 60;
+    t.tm_sec = 0;
+    t.tm_isdst = -1;          // let mktime apply DST for that date
+    time_t at = mktime(&t);   // normalizes tm_mday overflow and sets tm_wday
+    if (at > after && (r.days & (1 << t.tm_wday))) return at;
+  }
+  return 0;
+}
+
+// ========= Timer heap =========
+struct HeapEntry {
+  time_t at;
+  uint8_t rule;
+};
+static HeapEntry heap[SCHEDULE_MAX_RULES];
+static int heapSize = 0;
+
+static void heapPush(HeapEntry e) {
+  int i = heapSize++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent].at <= e.at) break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = e;
+}
+
+static HeapEntry heapPop() {
+  HeapEntry top = heap[0];
+  HeapEntry last = heap[--heapSize];
+  int i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= heapSize) break;
+    if (child + 1 < heapSize && heap[child + 1].at < heap[child].at) child++;
+    if (last.at <= heap[child].at) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  if (heapSize) heap[i] = last;
+  return top;
+}
+
+static ScheduleRule active[SCHEDULE_MAX_RULES];  // tick's copy of the table
+static int activeCount = 0;
+static uint32_t activeVersion = 0;
+static time_t lastFired[SCHEDULE_MAX_RULES];     // occurrence each rule last fired for (this table)
+static bool firedDirty = false;
+
+// lastFired survives a reboot, so boot catch-up skips what ran just before it. One
+// small write per execution (a few a day), from the telemetry task like the rules.
+#define SCHEDULE_NVS_FIRED     "fired"
+#define SCHEDULE_FIRED_MAGIC   0x5CF1
+
+struct __attribute__((packed)) FiredBlob {
+  uint16_t magic;
+  uint32_t tableVersion;   // the table the indices refer to
+  uint32_t at[SCHEDULE_MAX_RULES];
+};
+
+static void loadFired() {
+  FiredBlob b;
+  Preferences p;
+  p.begin(SCHEDULE_NVS_NS, true);
+  bool ok = p.getBytes(SCHEDULE_NVS_FIRED, &b, sizeof(b)) == sizeof(b) && b.magic == SCHEDULE_FIRED_MAGIC &&
+            b.tableVersion == tableVersion;
+  p.end();
+  for (int i = 0; i < SCHEDULE_MAX_RULES; i++) lastFired[i] = ok ? (time_t)b.at[i] : 0;
+}
+
+static void saveFired() {
+  FiredBlob b;
+  b.magic = SCHEDULE_FIRED_MAGIC;
+  b.tableVersion = activeVersion;
+  for (int i = 0; i < SCHEDULE_MAX_RULES; i++) b.at[i] = (uint32_t)lastFired[i];
+  Preferences p;
+  p.begin(SCHEDULE_NVS_NS, false);
+  bool ok = p.putBytes(SCHEDULE_NVS_FIRED, &b, sizeof(b)) == sizeof(b);
+  p.end();
+  if (!ok) LOGE("SCHED", "Fire history save failed");
+}
+
+// Rules due within the last `catchUp` seconds still fire (boot / time jump)
+static void rebuildHeap(time_t now, time_t catchUp) {
+  heapSize = 0;
+  for (int i = 0; i < activeCount; i++) {
+    time_t at = nextOccurrence(active[i], now - catchUp);
+    if (at) heapPush({ at, (uint8_t)i });
+  }
+}
+
+// ========= Execution log =========
+static ScheduleExec reports[SCHEDULE_REPORT_SLOTS];
+static int reportHead = 0, reportCount = 0;
+static portMUX_TYPE reportMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void logExecution(const ScheduleRule &r, time_t at) {
+  portENTER_CRITICAL(&reportMux);
+  int slot = (reportHead + reportCount) % SCHEDULE_REPORT_SLOTS;
+  if (reportCount == SCHEDULE_REPORT_SLOTS) reportHead = (reportHead + 1) % SCHEDULE_REPORT_SLOTS; // oldest goes
+  else reportCount++;
+  reports[slot] = { r.id, (uint32_t)at, r.mask, r.values };
+  portEXIT_CRITICAL(&reportMux);
+}
+
+int schedulerTakeReports(ScheduleExec *out, int max) {
+  portENTER_CRITICAL(&reportMux);
+  int n = min(max, reportCount);
+  for (int k = 0; k < n; k++) out[k] = reports[(reportHead + k) % SCHEDULE_REPORT_SLOTS];
+  reportHead = (reportHead + n) % SCHEDULE_REPORT_SLOTS;
+  reportCount -= n;
+  portEXIT_CRITICAL(&reportMux);
+  return n;
+}
+
+// ========= Tick =========
+static bool heapValid = false;
+static time_t rebuildCatchUp = SCHEDULE_CATCHUP_S;
+static time_t lastWall = 0;
+static unsigned long lastTickMs = 0;
+
+void schedulerBegin(ScheduleFireFn fire) {
+  fireFn = fire;
+  loadRules();
+  loadFired();
+  tableChanged = true; // first tick after the first sync builds the heap
+  heapValid = false;
+  rebuildCatchUp = SCHEDULE_CATCHUP_S;
+}
+
+void schedulerTick() {
+  if (tableChanged) {
+    portENTER_CRITICAL(&ruleMux);
+    activeCount = ruleCount;
+    activeVersion = tableVersion;
+    memcpy(active, rules, ruleCount * sizeof(ScheduleRule));
+    bool replaced = tableReplaced;
+    tableChanged = tableReplaced = false;
+    portEXIT_CRITICAL(&ruleMux);
+    if (replaced) {
+      memset(lastFired, 0, sizeof(lastFired));
+      firedDirty = true;
+    }
+    // A new table starts from now; the boot table may catch up on the last minutes
+    if (heapValid) rebuildCatchUp = 0;
+    heapValid = false;
+  }
+  if (tableDirty) {
+    tableDirty = false;
+    saveRules();
+  }
+  if (!schedulerTimeValid()) return;
+
+  time_t now = time(nullptr);
+  unsigned long ms = millis();
+  // SNTP step: rebuild. Forward, rules skipped by up to a few minutes still fire;
+  // backward, nothing is caught up (it already ran) and lastFired keeps an
+  // occurrence that comes round again from firing twice
+  if (heapValid) {
+    long drift = (long)(now - lastWall) - (long)((ms - lastTickMs) / 1000);
+    if (drift > SCHEDULE_JUMP_S || drift < -SCHEDULE_JUMP_S) {
+      LOGI("SCHED", "Clock moved %ld s, rebuilding timers", drift);
+      heapValid = false;
+      rebuildCatchUp = drift > 0 ? min((time_t)(now - lastWall), (time_t)SCHEDULE_CATCHUP_S) : 0; // the span skipped
+    }
+  }
+  if (!heapValid) {
+    rebuildHeap(now, rebuildCatchUp);
+    heapValid = true;
+  }
+  lastWall = now;
+  lastTickMs = ms;
+
+  while (heapSize && heap[0].at <= now) {
+    HeapEntry e = heapPop();
+    const ScheduleRule &r = active[e.rule];
+    if (now - e.at <= SCHEDULE_CATCHUP_S && e.at > lastFired[e.rule]) {
+      lastFired[e.rule] = e.at;
+      firedDirty = true;
+      LOGI("SCHED", "Rule %lu: 0x%08lx -> 0x%08lx", (unsigned long)r.id, (unsigned long)r.mask,
+           (unsigned long)r.values);
+      if (fireFn) fireFn(r);
+      logExecution(r, e.at);
+    }
+    time_t next = nextOccurrence(r, e.at);
+    if (next) heapPush({ next, e.rule });
+  }
+  if (firedDirty) {
+    firedDirty = false;
+    saveFired();
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Local scheduler ----------------
+// Weekly rules ("Mon-Fri 18:00: relays 0-5 OFF") pushed by the backend with
+// schedule_update, kept in NVS and executed on the device against SNTP time, so
+// they fire on time with the backend or WiFi down. Pending fires sit in a
+// min-heap keyed by their next local-time occurrence; the tick only looks at the
+// top. Each execution is logged and reported to the backend once connected.
+//
+// schedulerBegin() from setup(); schedulerTick() only from the telemetry task
+// (fires and NVS writes); schedulerUpdate() / schedulerTakeReports() from the
+// net task.
+
+struct __attribute__((packed)) ScheduleRule {
+  uint32_t id;       // backend rule id, echoed in execution reports
+  uint8_t  days;     // bit 0 = Sunday .. bit 6 = Saturday
+  uint16_t minute;   // local minute of day, 0..1439
+  uint32_t mask;     // relays (switch index) the rule sets
+  uint32_t values;   // ON bits within mask
+};
+
+struct ScheduleExec {
+  uint32_t id;
+  uint32_t at;       // epoch seconds the rule was due
+  uint32_t mask;
+  uint32_t values;
+};
+
+// Fire callback: runs on the telemetry task, must only queue the change
+typedef void (*ScheduleFireFn)(const ScheduleRule &rule);
+
+void schedulerBegin(ScheduleFireFn fire);
+void schedulerStartTime();                  // SNTP + time zone, once the network is up (idempotent)
+bool schedulerUpdate(uint32_t version, const ScheduleRule *rules, int count);
+void schedulerTick();
+int schedulerTakeReports(ScheduleExec *out, int max);  // oldest first, removes them
+uint32_t schedulerVersion();                // table version the backend last pushed (0 = none)
+int schedulerRuleCount();
+bool schedulerTimeValid();
+
+#endif
@@ -0,0 +1,218 @@
+#include "txqueue.h"
+#include "logger.h"
+
+// ========= Rings =========
+// Each frame is a header plus its bytes, stored contiguously; a frame that does
+// not fit before the end of the buffer starts again at 0 and wrapAt marks where
+// the older data ends. Replaced frames stay in place marked dead until the drain
+// reaches them.
+static_assert(TX_QUEUE_CONTROL_BYTES < 65536 && TX_QUEUE_TELEMETRY_BYTES < 65536 && TX_QUEUE_BULK_BYTES < 65536,
+              "ring offsets are 16 bit");
+
+struct __attribute__((packed)) TxEntry {
+  uint16_t cap;    // bytes reserved after the header
+  uint16_t len;    // bytes in use (a merged frame may be shorter than the one it replaced)
+  uint8_t  key;
+  uint8_t  flags;
+};
+#define TX_FLAG_BINARY 0x01
+#define TX_FLAG_DEAD   0x02
+#define TX_FLAG_PING   0x04
+
+static_assert(TX_QUEUE_CONTROL_BYTES >= MSG_TX_BUF_SIZE + sizeof(TxEntry) &&
+              TX_QUEUE_TELEMETRY_BYTES >= MSG_TX_BUF_SIZE + sizeof(TxEntry) &&
+              TX_QUEUE_BULK_BYTES >= MSG_TX_BUF_SIZE + sizeof(TxEntry),
+              "every ring must hold one full MSG_TX_BUF_SIZE frame");
+
+struct TxRing {
+  uint8_t *buf;
+  uint16_t size;
+  uint16_t head = 0, tail = 0, wrapAt = 0;
+  bool wrapped = false;
+  uint16_t entries = 0;  // incl. dead ones
+  uint16_t frames = 0;   // live
+  uint32_t bytes = 0;    // live payload bytes
+};
+
+static uint8_t controlBuf[TX_QUEUE_CONTROL_BYTES];
+static uint8_t telemetryBuf[TX_QUEUE_TELEMETRY_BYTES];
+static uint8_t bulkBuf[TX_QUEUE_BULK_BYTES];
+static TxRing rings[TX_PRIO_COUNT] = {
+  { controlBuf, TX_QUEUE_CONTROL_BYTES },
+  { telemetryBuf, TX_QUEUE_TELEMETRY_BYTES },
+  { bulkBuf, TX_QUEUE_BULK_BYTES },
+};
+
+// Waiting frame per merge key
+static bool keyLive[TX_KEY_COUNT];
+static uint8_t keyPrio[TX_KEY_COUNT];
+static uint16_t keyAt[TX_KEY_COUNT];
+
+static TxSendFn sendFn = nullptr;
+static TxQueueStats stats;
+
+static TxEntry *entryAt(TxRing &r, uint16_t at) { return (TxEntry *)(r.buf + at); }
+
+static bool ringAlloc(TxRing &r, size_t need, uint16_t &at) {
+  if (!r.wrapped) {
+    if ((size_t)(r.size - r.tail) >= need) {
+      at = r.tail;
+    } else if (r.head >= need) { // room in front of the oldest frame
+      r.wrapAt = r.tail;
+      r.wrapped = true;
+      at = 0;
+    } else {
+      return false;
+    }
+  } else if ((size_t)(r.head - r.tail) >= need) {
+    at = r.tail;
+  } else {
+    return false;
+  }
+  r.tail = at + need;
+  return true;
+}
+
+static void ringPop(TxRing &r) {
+  TxEntry *e = entryAt(r, r.head);
+  r.head += sizeof(TxEntry) + e->cap;
+  r.entries--;
+  if (r.wrapped && r.head == r.wrapAt) {
+    r.head = 0;
+    r.wrapped = false;
+  }
+  if (!r.entries) r.head = r.tail = 0, r.wrapped = false;
+}
+
+static uint32_t queuedBytes() {
+  uint32_t n = 0;
+  for (int p = 0; p < TX_PRIO_COUNT; p++) n += rings[p].bytes;
+  return n;
+}
+
+void txQueueBegin(TxSendFn send) { sendFn = send; }
+
+static bool enqueue(TxPriority prio, TxKey key, const void *data, size_t len, uint8_t flags) {
+  TxRing &r = rings[prio];
+
+  if (key != TX_KEY_NONE && keyLive[key]) {
+    TxRing &kr = rings[keyPrio[key]];
+    TxEntry *old = entryAt(kr, keyAt[key]);
+    stats.merged++;
+    if (keyPrio[key] == prio && len <= old->cap) { // overwrite in place, keeps its turn
+      kr.bytes += len - old->len;
+      memcpy(old + 1, data, len);
+      old->len = len;
+      old->flags = flags;
+      return true;
+    }
+    old->flags |= TX_FLAG_DEAD;
+    kr.frames--;
+    kr.bytes -= old->len;
+    keyLive[key] = false;
+  }
+
+  if (prio != TX_PRIO_CONTROL) {
+    uint32_t ahead = 0;
+    for (int p = 0; p <= prio; p++) ahead += rings[p].bytes;
+    if (ahead >= TX_QUEUE_HIGH_WATER) {
+      stats.drops[prio]++;
+      return false;
+    }
+  }
+
+  uint16_t at;
+  if (!ringAlloc(r, sizeof(TxEntry) + len, at)) {
+    stats.drops[prio]++;
+    if (prio == TX_PRIO_CONTROL) LOGW("TXQ", "Control frame dropped (%u bytes): queue full", (unsigned)len);
+    return false;
+  }
+  TxEntry *e = entryAt(r, at);
+  e->cap = len;
+  e->len = len;
+  e->key = key;
+  e->flags = flags;
+  memcpy(e + 1, data, len);
+  r.entries++;
+  r.frames++;
+  r.bytes += len;
+  if (key != TX_KEY_NONE) {
+    keyLive[key] = true;
+    keyPrio[key] = prio;
+    keyAt[key] = at;
+  }
+  uint32_t total = queuedBytes();
+  if (total > stats.hwmBytes) stats.hwmBytes = total;
+  return true;
+}
+
+bool txEnqueue(TxPriority prio, TxKey key, const void *data, size_t len, bool binary) {
+  return enqueue(prio, key, data, len, binary ? TX_FLAG_BINARY : 0);
+}
+
+bool txEnqueuePing(const void *payload, size_t len) {
+  return enqueue(TX_PRIO_CONTROL, TX_KEY_PING, payload, len, TX_FLAG_PING);
+}
+
+int txQueueDrain() {
+  int sent = 0;
+  uint32_t spent = 0;
+  for (int p = 0; p < TX_PRIO_COUNT; p++) {
+    TxRing &r = rings[p];
+    while (r.entries) {
+      if (sent && spent >= TX_DRAIN_BUDGET_BYTES) return sent;
+      uint16_t at = r.head;
+      TxEntry *e = entryAt(r, at);
+      if (e->flags & TX_FLAG_DEAD) {
+        ringPop(r);
+        continue;
+      }
+      if (e->key != TX_KEY_NONE && keyLive[e->key] && keyAt[e->key] == at && keyPrio[e->key] == p) {
+        keyLive[e->key] = false;
+      }
+      uint32_t t0 = micros();
+      TxFrameType type = (e->flags & TX_FLAG_PING) ? TX_FRAME_PING : (e->flags & TX_FLAG_BINARY) ? TX_FRAME_BINARY : TX_FRAME_TEXT;
+      bool ok = sendFn && sendFn((const uint8_t *)(e + 1), e->len, type);
+      uint32_t took = micros() - t0;
+      r.frames--;
+      r.bytes -= e->len;
+      spent += e->len;
+      ringPop(r);
+      if (!ok) {
+        stats.drops[p]++;
+        return sent;
+      }
+      sent++;
+      if (took > TX_SLOW_SEND_US) {
+        stats.slowSends++;
+        return sent;
+      }
+    }
+  }
+  return sent;
+}
+
+void txQueueClear() {
+  for (int p = 0; p < TX_PRIO_COUNT; p++) {
+    TxRing &r = rings[p];
+    r.head = r.tail = r.wrapAt = 0;
+    r.wrapped = false;
+    r.entries = r.frames = 0;
+    r.bytes = 0;
+  }
+  memset(keyLive, 0, sizeof(keyLive));
+}
+
+uint32_t txQueueFrames() {
+  uint32_t n = 0;
+  for (int p = 0; p < TX_PRIO_COUNT; p++) n += rings[p].frames;
+  return n;
+}
+
+void txQueueStats(TxQueueStats &out) {
+  out = stats;
+  out.frames = txQueueFrames();
+  out.bytes = queuedBytes();
+}
+
+void txQueueResetHwm() { stats.hwmBytes = queuedBytes(); }
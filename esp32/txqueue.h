@@ -0,0 +1,63 @@
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- Outbound queue ----------------
+// Every frame for the backend is serialized into one of three byte rings instead
+// of being written to the socket where it was produced (often inside the ws.loop()
+// receive callback). The net task drains them after ws.loop(), highest priority
+// first, within a byte budget per pass, and stops early when a send is slow, so a
+// backed-up TCP connection delays telemetry instead of the command path.
+//
+//  - A frame with a merge key replaces the one with the same key still waiting
+//    (a newer state_update covers everything an older one reported).
+//  - Telemetry and bulk frames are dropped once TX_QUEUE_HIGH_WATER bytes are
+//    waiting at their priority or above; control frames only when their ring is full.
+//
+// WebSocket pings (keepalive.h) are queued as control frames too, so nothing but
+// the drain writes to the socket.
+//
+// Net task only (it owns ws), so nothing here is locked.
+
+enum TxPriority : uint8_t {
+  TX_PRIO_CONTROL,    // auth, acks, state
+  TX_PRIO_TELEMETRY,  // heartbeat, metrics, occupancy, journal replay
+  TX_PRIO_BULK,       // logs
+  TX_PRIO_COUNT
+};
+
+enum TxKey : uint8_t {
+  TX_KEY_NONE,
+  TX_KEY_STATE,       // state_update / BIN_DELTA
+  TX_KEY_FULL_STATE,
+  TX_KEY_OCCUPANCY,
+  TX_KEY_PING,        // keepalive ping
+  TX_KEY_COUNT
+};
+
+struct TxQueueStats {
+  uint32_t frames;                  // waiting now
+  uint32_t bytes;
+  uint32_t hwmBytes;                // most bytes waiting at once
+  uint32_t drops[TX_PRIO_COUNT];    // refused (high water / ring full) or failed sends
+  uint32_t merged;                  // frames replaced by a newer one
+  uint32_t slowSends;               // drains cut short by a slow send
+};
+
+enum TxFrameType : uint8_t { TX_FRAME_TEXT, TX_FRAME_BINARY, TX_FRAME_PING };
+
+// Writes one frame to the socket; false = not sent (the frame is dropped)
+typedef bool (*TxSendFn)(const uint8_t *data, size_t len, TxFrameType type);
+
+void txQueueBegin(TxSendFn send);
+bool txEnqueue(TxPriority prio, TxKey key, const void *data, size_t len, bool binary);
+bool txEnqueuePing(const void *payload, size_t len); // control priority, replaces a ping still waiting
+int txQueueDrain();                 // frames sent this pass
+void txQueueClear();                // connection gone: queued frames are stale
+uint32_t txQueueFrames();
+void txQueueStats(TxQueueStats &out);
+void txQueueResetHwm();
+
+#endif
@@ -3,299 +3,1457 @@
 #include <ArduinoJson.h>
 #include <Preferences.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
 #include "config.h"
+#include "binproto.h"
+#include "relay_driver.h"
+#include "logger.h"
+#include "latency.h"
+#include "profiling.h"
+#include "wifi_manager.h"
+#include "scheduler.h"
+#include "journal.h"
+#include "txqueue.h"
+#include "ota.h"
+#include "keepalive.h"
+#if ENABLE_AUTO_LIGHT_SLEEP
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#endif
 
 // ========= Globals =========
 Preferences prefs;
 WebSocketsClient ws;
 
+// Switch state is struct-of-arrays sized to the compile-time cap; only the first
+// numSwitches entries are live. numSwitches changes under cfgMutex (netTask).
+int numSwitches = DEFAULT_SWITCH_COUNT;
 SwitchConfig switchCfg[MAX_SWITCHES];     // Active config (NVS or defaults)
 bool relayState[MAX_SWITCHES] = {false};  // Current relay ON/OFF (true=ON)
 
-// Debounce for maintained switches
+// Debounce for maintained switches: pin edge ISR -> esp_timer one-shot -> stable edge
 bool lastStableManual[MAX_SWITCHES] = {false};
-bool lastReadManual[MAX_SWITCHES]   = {false};
-unsigned long lastChangeMs[MAX_SWITCHES] = {0};
+struct ManualInput {
+  int idx;
+  int pin;                    // pin the ISR is currently attached to (-1 = none)
+  bool activeLow;
+  esp_timer_handle_t timer;   // DEBOUNCE_MS one-shot, restarted on every bounce
+  volatile uint32_t edgeUs;   // first edge of the current bounce burst (0 = none)
+};
+ManualInput manualInputs[MAX_SWITCHES];
+
+// PIR sensors: edge ISR -> esp_timer debounce -> CMD_PIR_MOTION; when motion stops the
+// vacancy one-shot raises CMD_PIR_VACANT after autoOffS. pirCfg is written by netTask
+// (config_update, under cfgMutex); the occupancy state below belongs to the GPIO task.
+PirConfig pirCfg[MAX_PIR_SENSORS];
+struct PirInput {
+  int idx;
+  int pin;                    // pin the ISR is currently attached to (-1 = none)
+  bool activeLow;
+  esp_timer_handle_t debounce;
+  esp_timer_handle_t vacancy; // autoOffS one-shot, armed when motion stops
+  volatile uint32_t gen;      // bumped on every (re)arm; a stale CMD_PIR_VACANT carries an old one
+  volatile uint32_t edgeUs;
+};
+PirInput pirInputs[MAX_PIR_SENSORS];
+bool pirMotion[MAX_PIR_SENSORS] = {false};        // debounced sensor output
+uint32_t pirMotionCount[MAX_PIR_SENSORS] = {0};   // motion starts since boot
+volatile uint32_t occupiedMask = 0;              // sensors with motion or a running vacancy timer
+volatile bool occupancyPending = false;          // transition not reported yet (netTask clears)
+unsigned long lastOccupancyReport = 0;           // netTask
+
+// Journal replay (journal.h): one batch in flight until journal_ack (netTask)
+uint32_t journalSeq = 0;
+int journalInFlight = 0;                         // records in batch journalSeq, 0 = none
+unsigned long journalSentMs = 0;
 
 // Connection / timers
 enum ConnState { WIFI_DISCONNECTED, WIFI_ONLY, BACKEND_CONNECTED };
 ConnState connState = WIFI_DISCONNECTED;
-unsigned long lastWiFiRetry = 0;
-unsigned long lastHeartbeat = 0;
 int reconnectionAttempts = 0;
 
-// Command queue (serialize backend actions)
-struct Command { int idx; bool state; };
+// Reconnect storm protection (netTask only)
+uint32_t reconnectRng = 0;               // xorshift32 state, seeded from the MAC
+uint32_t reconnectTokens = RECONNECT_BUCKET_SIZE;
+unsigned long lastTokenRefill = 0;
+unsigned long retryAfterMs = 0;          // server hint, consumed by the next disconnect
+uint32_t stormedReconnects = 0;          // reconnects delayed by a hint or an empty bucket
+
+// Connect cost: ws.loop() runs TCP + TLS + upgrade synchronously, so the loop call
+// that raises WStype_CONNECTED is the handshake (netTask only)
+uint32_t wsLoopStartUs = 0;
+uint32_t wsLoopStartHeap = 0;
+uint32_t tlsHandshakeMs = 0;             // last connect
+uint32_t tlsHandshakeMaxMs = 0;
+uint32_t tlsHeapCost = 0;                // free heap drop across the last connect
+bool binMode = false;     // server accepted BINPROTO_NAME in auth_success
+volatile bool wsAuthed = false; // auth_success seen on this connection (netTask writes; off = journal events)
+
+// State versioning: every relay change bumps stateSeq and stamps changeSeq[idx]. The
+// server acks the seq it has applied; deltas carry only relays changed after ackedSeq.
+// stateEpoch is random per boot so a seq from a previous boot never matches.
+portMUX_TYPE stateMux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t stateEpoch = 0;
+uint32_t stateSeq = 0;                     // written by the GPIO task under stateMux
+uint32_t changeSeq[MAX_SWITCHES] = {0};
+uint32_t ackedSeq = 0;                     // netTask only
+
+// Command queue (network task -> GPIO task, serializes backend actions)
+enum CommandType : uint8_t { CMD_SET_RELAY, CMD_MANUAL_EDGE, CMD_BATCH, CMD_RESYNC, CMD_SCHEDULE,
+                              CMD_PIR_MOTION, CMD_PIR_VACANT };
+struct Command {
+  CommandType type = CMD_SET_RELAY;
+  int idx = -1;
+  bool state = false;
+  // CMD_BATCH (switch_command_batch) / CMD_SCHEDULE (local rule, seq = rule id): relays in
+  // mask are set to the matching bit of values
+  uint32_t mask = 0;
+  uint32_t values = 0;
+  uint32_t seq = 0;       // CMD_SET_RELAY: server command id (0 = none), CMD_PIR_VACANT: PirInput.gen
+  uint8_t rejected = 0;   // batch entries that matched no switch
+  uint32_t t0Us = 0;      // origin: frame receipt (backend) or first pin edge (manual)
+  uint32_t enqUs = 0;     // stamped by enqueueCommand
+};
 QueueHandle_t cmdQueue;
+uint32_t cmdDrops = 0;  // commands rejected because cmdQueue was full
+uint32_t cmdQueueHwm = 0;  // most commands seen waiting at once (GPIO task)
+
+// Relay changes coalesced while draining cmdQueue: last requested state per idx wins
+static_assert(MAX_SWITCHES <= 32, "relay masks are 32 bit");
+struct RelayBatch {
+  uint32_t mask;              // relays touched in this batch
+  uint32_t acked;             // relays already reported through a switch_batch_ack / switch_result
+  bool state[MAX_SWITCHES];
+  uint32_t remoteT0, manualT0; // earliest origin per source in this batch (0 = none)
+  void set(int idx, bool on) { mask |= (1UL << idx); state[idx] = on; }
+  static void stamp(uint32_t &slot, uint32_t t) { if (t && (!slot || (int32_t)(t - slot) < 0)) slot = t; }
+  bool pending(int idx) const { return mask & (1UL << idx); }
+};
+
+// Outbound events (GPIO/telemetry tasks -> network task). Only netTask touches ws.
+// NET_FULL_STATE carries names/pins (after boot/config changes); NET_STATE_UPDATE is a
+// delta of the relays in mask plus anything the server has not acked yet
+enum NetEventType : uint8_t { NET_STATE_UPDATE, NET_FULL_STATE, NET_BATCH_ACK, NET_SCHEDULE_REPORT,
+                              NET_SWITCH_RESULT };
+struct NetEvent {
+  NetEventType type = NET_STATE_UPDATE;
+  int idx = -1;
+  bool state = false;
+  uint32_t seq = 0;       // NET_BATCH_ACK: echoed command sequence id
+  uint32_t mask = 0;      // NET_STATE_UPDATE: relays to report, NET_BATCH_ACK: relays the batch applied
+  uint8_t rejected = 0;
+  uint32_t remoteT0 = 0;  // origins of the change being reported, for LAT_*_ACK (0 = none)
+  uint32_t manualT0 = 0;
+};
+QueueHandle_t netQueue;
+
+// switch_command results: the GPIO task adds one per command with an id once its relay
+// is driven and posts NET_SWITCH_RESULT; netTask sends them. Oldest dropped when full.
+struct SwitchResult {
+  uint32_t id;
+  uint32_t t0Us;       // frame receipt
+  uint32_t appliedUs;  // relay written
+  int8_t idx;
+  bool requested;
+  bool actual;
+};
+SwitchResult switchResults[SWITCH_RESULT_SLOTS];
+int switchResultHead = 0, switchResultCount = 0;
+uint32_t switchResultDrops = 0;
+portMUX_TYPE switchResultMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Recently accepted command ids (netTask only). The server resends commands it has no
+// result for after a reconnect; a repeat must not re-apply an older state.
+uint32_t recentCmdIds[CMD_DEDUP_SLOTS];
+int recentCmdNext = 0;
+uint32_t dupCommands = 0;
+
+// switchCfg is written only by netTask (config_update); other tasks hold this while reading it
+SemaphoreHandle_t cfgMutex;
+
+// Command/manual path latency (latency.h): GPIO task writes QUEUE/*_RELAY, netTask *_ACK
+LatencyHist latency[LAT_COUNT];
+uint32_t wsRxUs = 0;  // receipt time of the frame being dispatched (netTask)
+
+ProfCounter profCounters[PROF_COUNT];
+ProfLoop profLoops[PROF_TASK_COUNT];
+uint32_t netQueueHwm = 0;  // netTask
+static inline uint32_t nowUs() { return (uint32_t)esp_timer_get_time(); }
+
+// Command dispatch lookup (name hash + gpio -> index), rebuilt whenever switchCfg changes.
+// Built and read only on netTask (and setup), so it needs no locking.
+#define GPIO_LOOKUP_SIZE 40
+#define NAME_TABLE_SIZE  64   // open addressing, power of two, >= 2 * MAX_SWITCHES
+static_assert(NAME_TABLE_SIZE >= 2 * MAX_SWITCHES && (NAME_TABLE_SIZE & (NAME_TABLE_SIZE - 1)) == 0,
+              "NAME_TABLE_SIZE must be a power of two with room for every switch");
+int8_t gpioToIdx[GPIO_LOOKUP_SIZE];
+struct NameSlot { uint32_t hash; int8_t idx; };
+NameSlot nameTable[NAME_TABLE_SIZE];
+
+// Message builder storage (netTask only): parse into rxDoc, compose into txDoc,
+// serialize into txBuf and copy that into the outbound queue (txqueue.h)
+StaticJsonDocument<MSG_RX_DOC_SIZE> rxDoc;
+StaticJsonDocument<MSG_TX_DOC_SIZE> txDoc;
+char txBuf[MSG_TX_BUF_SIZE];
+char macStr[18];  // cached WiFi.macAddress(), filled once in setup()
+
+TaskHandle_t gpioTaskHandle = nullptr;
+TaskHandle_t netTaskHandle = nullptr;
+TaskHandle_t telemetryTaskHandle = nullptr;
+TaskHandle_t logTaskHandle = nullptr;
+
+// Deferred config commit: config_update changes RAM right away and only marks the
+// table dirty; the telemetry task writes NVS once edits settle (flash erase stalls
+// the caches, so it must not happen inside the WebSocket callback)
+volatile bool configDirty = false;
+volatile unsigned long configDirtySince = 0;  // first unsaved change
+volatile unsigned long configLastChange = 0;
+volatile bool rebootRequested = false;
 
 // Forward decls
 void loadConfigFromNVS();
-void saveConfigToNVS();
+void restoreBootState();
+void retainRelayState();
+void relayStateCommitTick();
+void saveConfigToNVS(const SwitchConfig *cfg, int count, const PirConfig *pir);
+void markConfigDirty();
+void configCommitTick();
+void flushConfigNow();
+void requestPlannedReboot();
 void applyPinModes();
+void releaseInactiveChannels();
+void rebuildSwitchIndex();
+int findSwitchByName(const char *name);
+int findSwitchByGpio(int gpio);
 void readAllManualAndApply(bool notifyBackend);
 void setRelay(int idx, bool on, bool notifyBackend);
+void postNetEvent(NetEventType type, int idx = -1, bool state = false);
+void postBatchAck(const Command &c);
+void postStateUpdate(uint32_t mask, uint32_t remoteT0 = 0, uint32_t manualT0 = 0);
+void recordAckLatency(const NetEvent &e);
+void sendStateDelta(uint32_t include);
+uint32_t changedSince(uint32_t seq);
+void handleStateAck(uint32_t epoch, uint32_t seq);
+void sendBatchAck(const NetEvent &e);
+void handleSwitchCommand(JsonDocument &doc);
+bool recentCommand(uint32_t id);
+void publishSwitchResults(const SwitchResult *res, int n);
+void sendSwitchResults();
+void sendSwitchResult(uint32_t id, int gpio, bool requested, bool success, bool actual, uint32_t us,
+                      const char *reason, bool dup);
+void handleSwitchCommandBatch(JsonDocument &doc);
+uint8_t parseRelayCommands(JsonArray arr, uint32_t &mask, uint32_t &values);
+void handleScheduleUpdate(JsonDocument &doc);
+void fireScheduleRule(const ScheduleRule &rule);
+void sendScheduleReports();
+void handleOtaUpdate(JsonDocument &doc);
+void sendOtaStatus(const OtaStatus &st);
+bool otaShouldYield();
+int hexDecode(const char *hex, uint8_t *out, int max);
+JsonDocument &beginMessage(const char *type);
+bool sendMessage(TxPriority prio = TX_PRIO_CONTROL, TxKey key = TX_KEY_NONE);
+bool sendBinary(const void *frame, size_t len, TxPriority prio = TX_PRIO_CONTROL, TxKey key = TX_KEY_NONE);
+bool wsWrite(const uint8_t *data, size_t len, TxFrameType type);
+uint32_t relayMask();
+void handleBinFrame(uint8_t *payload, size_t length);
 void sendFullState();
 void sendHeartbeat();
+void keepaliveService();
+bool sendKeepalivePing();
+void applyKeepaliveHint(JsonVariant hint);
 void blinkStatus();
-void handleManualMaintained();
+void handleManualMaintained(int idx, bool active, RelayBatch &batch);
+void applyRelayBatch(RelayBatch &batch);
+bool enqueueCommand(const Command &c);
+void attachManualInputs();
+void attachPirInputs();
+void IRAM_ATTR onPirEdge(void *arg);
+void onPirDebounced(void *arg);
+void onPirVacancy(void *arg);
+void handlePirMotion(int s, bool motion, RelayBatch &batch);
+void handlePirVacant(int s, uint32_t gen, RelayBatch &batch);
+void sendOccupancy();
+void journalReplayTick();
+void IRAM_ATTR onManualEdge(void *arg);
+void onManualDebounced(void *arg);
 void setupWebSocket();
 void onWsEvent(WStype_t type, uint8_t * payload, size_t length);
+void logLastError();
+void seedReconnectJitter();
+unsigned long nextReconnectDelay();
+void gpioTask(void *);
+void netTask(void *);
+void telemetryTask(void *);
+void logTask(void *);
+void sendLogs(int lines);
+void sendMetrics(bool reset);
+void gpioService(TickType_t wait);
+void netService();
 
 // ========= Setup =========
 void setup() {
+  // Relays first: last known state on the outputs before Serial, the watchdog or
+  // any radio init (log lines are buffered until the log task runs)
+  loadConfigFromNVS();
+  rebuildSwitchIndex();
+  stateEpoch = esp_random() | 1;
+  journalBegin(stateEpoch);
+  restoreBootState();
+
   Serial.begin(115200);
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
 
-  // Watchdog setup (ESP-IDF v5 API) - 10s timeout, monitor all cores, panic on timeout
+  // Watchdog setup (ESP-IDF v5 API) - 10s timeout, monitor all cores, panic on timeout.
+  // Each task registers itself below instead of the loopTask.
   esp_task_wdt_config_t twdt_config = {
     .timeout_ms = 10000,
     .idle_core_mask = (1 << portNUM_PROCESSORS) - 1,
     .trigger_panic = true
   };
   esp_task_wdt_init(&twdt_config);
-  esp_task_wdt_add(NULL);  // Add current task (loopTask)
 
-  // Load config (NVS -> fallback to defaults)
-  loadConfigFromNVS();
-  applyPinModes();
+#if ENABLE_AUTO_LIGHT_SLEEP && CONFIG_PM_ENABLE
+  // Tasks block on queues between events, so the idle task can light-sleep
+  esp_pm_config_t pm = { .max_freq_mhz = 240, .min_freq_mhz = 80, .light_sleep_enable = true };
+  esp_pm_configure(&pm);
+  esp_sleep_enable_gpio_wakeup();
+#endif
+
+  // Queues between tasks
+  cmdQueue = xQueueCreate(CMD_QUEUE_DEPTH, sizeof(Command));
+  netQueue = xQueueCreate(NET_QUEUE_DEPTH, sizeof(NetEvent));
+  cfgMutex = xSemaphoreCreateMutex();
 
-  // Initialize states to reflect actual maintained switch positions at boot
-  readAllManualAndApply(false); // no notify yet
+  // Manual switch and PIR edges feed cmdQueue from here on
+  attachManualInputs();
+  attachPirInputs();
 
-  // Command queue
-  cmdQueue = xQueueCreate(16, sizeof(Command));
+  // Start WiFi (cached AP first; the net task runs the state machine from WiFi events)
+  wifiManagerBegin();
+  strlcpy(macStr, WiFi.macAddress().c_str(), sizeof(macStr));
 
-  // Start WiFi (non-blocking reconnect loop in loop())
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  // Local schedule from NVS; rules start firing once SNTP has set the clock
+  schedulerBegin(fireScheduleRule);
+  otaBegin(otaShouldYield, requestPlannedReboot);
+  seedReconnectJitter();
 
-  // Start WebSocket (connect when WiFi is up)
+  // Configure WebSocket (connects from netTask once WiFi is up)
+  txQueueBegin(wsWrite);
   setupWebSocket();
+
+  xTaskCreatePinnedToCore(gpioTask, "gpio", GPIO_TASK_STACK, nullptr,
+                          GPIO_TASK_PRIORITY, &gpioTaskHandle, GPIO_TASK_CORE);
+  xTaskCreatePinnedToCore(netTask, "net", NET_TASK_STACK, nullptr,
+                          NET_TASK_PRIORITY, &netTaskHandle, NET_TASK_CORE);
+  xTaskCreatePinnedToCore(telemetryTask, "telemetry", TELEMETRY_TASK_STACK, nullptr,
+                          TELEMETRY_TASK_PRIORITY, &telemetryTaskHandle, TELEMETRY_TASK_CORE);
+  xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr,
+                          LOG_TASK_PRIORITY, &logTaskHandle, LOG_TASK_CORE);
 }
 
 // ========= Loop =========
 void loop() {
-  esp_task_wdt_reset();
-
-  // ----- WiFi connect/retry -----
-  if (WiFi.status() != WL_CONNECTED) {
-    connState = WIFI_DISCONNECTED;
-    unsigned long now = millis();
-    if (now - lastWiFiRetry >= WIFI_RETRY_INTERVAL_MS) {
-      lastWiFiRetry = now;
-      if (WiFi.status() != WL_IDLE_STATUS) WiFi.disconnect(true);
-      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-      Serial.println("[WiFi] (re)connecting...");
-    }
-  } else {
-    if (!ws.isConnected()) {
-      connState = WIFI_ONLY;
+  // All work happens in the tasks created in setup()
+  vTaskDelete(NULL);
+}
+
+// ========= Tasks =========
+// GPIO/relay task: highest priority, pinned away from the WiFi/TLS core
+void gpioTask(void *) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    esp_task_wdt_reset();
+    gpioService(pdMS_TO_TICKS(GPIO_TASK_WAIT_MS));
+  }
+}
+
+void gpioService(TickType_t wait) {
+  // ----- Staggered relay groups still to switch on (outside cfgMutex) -----
+  uint32_t staggerMs = relayDriverService();
+  if (staggerMs && pdMS_TO_TICKS(staggerMs) < wait) wait = pdMS_TO_TICKS(staggerMs);
+
+  // ----- Backend commands + debounced manual edges (sleeps until one arrives) -----
+  Command c;
+  if (!xQueueReceive(cmdQueue, &c, wait)) return;
+  PROFILE(PROF_CMD_DRAIN);
+  uint32_t waiting = uxQueueMessagesWaiting(cmdQueue) + 1;
+  if (waiting > cmdQueueHwm) cmdQueueHwm = waiting;
+
+  // Drain everything pending, keep the last state per relay, then apply in one sweep
+  RelayBatch batch = {};
+  SwitchResult results[CMD_QUEUE_DEPTH]; // commands with an id, answered after the sweep
+  int nResults = 0;
+  int budget = CMD_QUEUE_DEPTH; // bounded so a command flood cannot pin the task
+  xSemaphoreTake(cfgMutex, portMAX_DELAY);
+  do {
+    latency[LAT_QUEUE].add(nowUs() - c.enqUs);
+    switch (c.type) {
+      case CMD_SET_RELAY:
+        batch.set(c.idx, c.state);
+        RelayBatch::stamp(batch.remoteT0, c.t0Us);
+        if (c.seq) { // the switch_result replaces the delta for this relay
+          batch.acked |= (1UL << c.idx);
+          results[nResults++] = { c.seq, c.t0Us, 0, (int8_t)c.idx, c.state, false };
+        }
+        break;
+      case CMD_MANUAL_EDGE: {
+        PROFILE(PROF_MANUAL);
+        handleManualMaintained(c.idx, c.state, batch);
+        if (c.idx < numSwitches && batch.pending(c.idx)) RelayBatch::stamp(batch.manualT0, c.t0Us);
+      } break;
+      case CMD_BATCH:
+        // Whole scene lands in this sweep; the ack below replaces per-relay updates
+        for (int i = 0; i < numSwitches; i++) {
+          if (c.mask & (1UL << i)) batch.set(i, c.values & (1UL << i));
+        }
+        batch.acked |= c.mask;
+        RelayBatch::stamp(batch.remoteT0, c.t0Us);
+        applyRelayBatch(batch);
+        postBatchAck(c);
+        break;
+      case CMD_PIR_MOTION:
+        handlePirMotion(c.idx, c.state, batch);
+        break;
+      case CMD_PIR_VACANT:
+        handlePirVacant(c.idx, c.seq, batch);
+        break;
+      case CMD_SCHEDULE:
+        // Reported as an ordinary delta (and a schedule_report once the backend is back)
+        for (int i = 0; i < numSwitches; i++) {
+          if (c.mask & (1UL << i)) batch.set(i, c.values & (1UL << i));
+        }
+        break;
+      case CMD_RESYNC:
+        applyRelayBatch(batch); // commands queued before the remap still use the old pins
+        // After pin remap, re-read maintained switches and apply; one snapshot (names/pins
+        // changed) reports the result instead of a state_update per switch
+        releaseInactiveChannels();
+        applyPinModes();
+        attachManualInputs();
+        attachPirInputs();
+        readAllManualAndApply(false);
+        postNetEvent(NET_FULL_STATE);
+        break;
     }
+  } while (--budget > 0 && xQueueReceive(cmdQueue, &c, 0));
+  applyRelayBatch(batch);
+  if (nResults) publishSwitchResults(results, nResults);
+  xSemaphoreGive(cfgMutex);
+}
+
+// Apply all coalesced relays in one sweep and report them with a single delta
+void applyRelayBatch(RelayBatch &batch) {
+  if (!batch.mask) return;
+  bool offline = !wsAuthed;
+  for (int i = 0; i < numSwitches; i++) {
+    if (!batch.pending(i)) continue;
+    if (offline && relayState[i] != batch.state[i]) journalRecord(JOURNAL_RELAY, i, batch.state[i]);
+    setRelay(i, batch.state[i], false);
+  }
+  relayDriverFlush();
+  retainRelayState();
+  uint32_t written = nowUs();
+  if (batch.remoteT0) latency[LAT_CMD_RELAY].add(written - batch.remoteT0);
+  if (batch.manualT0) latency[LAT_MANUAL_RELAY].add(written - batch.manualT0);
+  LOGI("RELAY", "Applied 0x%08lx -> 0x%08lx", (unsigned long)batch.mask, (unsigned long)relayMask());
+  uint32_t report = batch.mask & ~batch.acked;
+  if (report && ws.isConnected()) { // notify backend so UI reflects final state
+    postStateUpdate(report, batch.remoteT0, batch.manualT0);
+  }
+  batch.mask = 0;
+  batch.acked = 0;
+  batch.remoteT0 = batch.manualT0 = 0;
+}
+
+void postStateUpdate(uint32_t mask, uint32_t remoteT0, uint32_t manualT0) {
+  if (!netQueue) return;
+  NetEvent e = { NET_STATE_UPDATE, -1, false, 0, mask, 0, remoteT0, manualT0 };
+  xQueueSend(netQueue, &e, 0);
+}
+
+void postBatchAck(const Command &c) {
+  if (!netQueue) return;
+  NetEvent e = { NET_BATCH_ACK, -1, false, c.seq, c.mask, c.rejected, c.t0Us, 0 };
+  xQueueSend(netQueue, &e, 0);
+}
+
+// Used by netTask and the debounce timers; full queue = dropped command.
+// Backend commands leave t0Us unset and get the receipt time of the frame being
+// dispatched; manual edges carry their own.
+bool enqueueCommand(const Command &in) {
+  Command c = in;
+  c.enqUs = nowUs();
+  if (!c.t0Us) c.t0Us = wsRxUs;
+  if (xQueueSend(cmdQueue, &c, 0) == pdTRUE) return true;
+  cmdDrops++;
+  LOGW("CMD", "queue full, dropped command for idx %d (%lu total)", c.idx, (unsigned long)cmdDrops);
+  return false;
+}
+
+// Network task: owns the WiFi state machine, ws.loop() and every socket write
+// (outbound frames are queued by priority and written after ws.loop())
+void netTask(void *) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    esp_task_wdt_reset();
+    netService();
+    vTaskDelay(pdMS_TO_TICKS(NET_TASK_PERIOD_MS));
+  }
+}
+
+void netService() {
+  profLoopTick(PROF_TASK_NET);
+
+  // ----- WiFi events / state machine (wifi_manager.h) -----
+  {
+    PROFILE(PROF_WIFI);
+    wifiManagerTick();
+    if (!wifiManagerConnected()) connState = WIFI_DISCONNECTED;
+    else if (!ws.isConnected()) connState = WIFI_ONLY;
+    if (wifiManagerConnected()) schedulerStartTime(); // once; SNTP keeps running across link losses
   }
 
   // ----- WebSocket -----
-  ws.loop();
+  {
+    PROFILE(PROF_WS_LOOP);
+    wsLoopStartUs = micros();
+    if (!ws.isConnected()) wsLoopStartHeap = ESP.getFreeHeap();
+    ws.loop();
+  }
 
-  // ----- LED pattern -----
-  blinkStatus();
+  // ----- Outbound events from the other tasks -----
+  PROFILE(PROF_NET_DRAIN);
+  uint32_t waiting = uxQueueMessagesWaiting(netQueue);
+  if (waiting > netQueueHwm) netQueueHwm = waiting;
+  NetEvent e;
+  while (xQueueReceive(netQueue, &e, 0)) {
+    switch (e.type) {
+      case NET_STATE_UPDATE: sendStateDelta(e.mask); recordAckLatency(e); keepaliveActivity(millis()); break;
+      case NET_FULL_STATE:   sendFullState(); break;
+      case NET_BATCH_ACK:    sendBatchAck(e); recordAckLatency(e); keepaliveActivity(millis()); break;
+      case NET_SWITCH_RESULT: sendSwitchResults(); keepaliveActivity(millis()); break;
+      case NET_SCHEDULE_REPORT: sendScheduleReports(); break;
+    }
+  }
+  if (occupancyPending) sendOccupancy(); // rate limited, so it may stay pending for a while
+  journalReplayTick();
+  OtaStatus ota;
+  if (wsAuthed && otaTakeReport(ota)) sendOtaStatus(ota);
+  keepaliveService();
 
-  // ----- Maintained switches (debounced) -----
-  handleManualMaintained();
+  // ----- Outbound queue: acks/state first, then telemetry, then logs -----
+  {
+    PROFILE(PROF_WS_TX);
+    if (ws.isConnected()) txQueueDrain();
+    else txQueueClear();
+  }
+}
 
-  // ----- Dequeue backend commands -----
-  Command c;
-  if (xQueueReceive(cmdQueue, &c, 0)) {
-    setRelay(c.idx, c.state, true); // notify backend so UI reflects final state
+// Telemetry task: low priority LED pattern, schedules, deferred NVS commits
+void telemetryTask(void *) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    esp_task_wdt_reset();
+    profLoopTick(PROF_TASK_TELEMETRY);
+    { PROFILE(PROF_LED); blinkStatus(); }
+    schedulerTick();
+    { PROFILE(PROF_CONFIG); configCommitTick(); wifiManagerCommit(); relayStateCommitTick(); journalCommit(); }
+    vTaskDelay(pdMS_TO_TICKS(TELEMETRY_TASK_PERIOD_MS));
+  }
+}
+
+// Lowest priority: UART output only happens when nothing else wants the CPU
+void logTask(void *) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    esp_task_wdt_reset();
+    logDrain();
+    vTaskDelay(pdMS_TO_TICKS(LOG_TASK_PERIOD_MS));
   }
+}
 
-  // ----- Heartbeat -----
-  sendHeartbeat();
+void postNetEvent(NetEventType type, int idx, bool state) {
+  if (!netQueue) return; // boot-time calls before the tasks exist
+  NetEvent e = { type, idx, state };
+  xQueueSend(netQueue, &e, 0);
 }
 
 // ========= Config Persistence =========
-void loadConfigFromNVS() {
-  bool have = false;
-  prefs.begin("switchcfg", true);
-  if (prefs.isKey("relay0") && prefs.isKey("manual0")) have = true;
-  prefs.end();
+// The whole switch table is one CRC-checked blob. Two slots (cfgA/cfgB) alternate
+// and the highest valid generation wins, so a write torn by power loss falls back
+// to the previous config instead of a mix of old and new keys.
+#define CONFIG_NVS_NS        "switchcfg"
+#define CONFIG_BLOB_MAGIC    0xC5F1
+#define CONFIG_BLOB_VERSION  2
+
+struct __attribute__((packed)) ConfigRecord {
+  int8_t  relayPin;
+  int8_t  manualPin;
+  uint8_t manualActiveLow;
+  char    name[SWITCH_NAME_LEN];
+};
 
+struct __attribute__((packed)) PirRecord {
+  int8_t   pin;
+  uint8_t  flags;     // bit 0 activeLow, bit 1 autoOn
+  uint16_t autoOffS;
+  uint32_t linked;
+};
+
+// Stored length is header + PIR sensors + count records + CRC-32 (of everything
+// before it), so the blob only grows with the channels actually in use
+struct __attribute__((packed)) ConfigBlob {
+  uint16_t     magic;
+  uint8_t      version;
+  uint8_t      count;       // records in use = active switch count
+  uint32_t     generation;  // bumped on every save, picks the newer slot
+  PirRecord    pir[MAX_PIR_SENSORS]; // v2
+  ConfigRecord records[MAX_SWITCHES];
+  uint8_t      crcSpace[sizeof(uint32_t)]; // room for the CRC when count == MAX_SWITCHES
+};
+
+static size_t configBlobBody(uint8_t count) { return offsetof(ConfigBlob, records) + count * sizeof(ConfigRecord); }
+static size_t configBlobSize(uint8_t count) { return configBlobBody(count) + sizeof(uint32_t); }
+// v1 had no PIR block: the records followed the header directly
+static size_t configBlobBodyV1(uint8_t count) { return offsetof(ConfigBlob, pir) + count * sizeof(ConfigRecord); }
+
+static const char *const configSlotKeys[2] = { "cfgA", "cfgB" };
+static ConfigBlob savedBlob;      // last blob read or written (change detection)
+static int savedSlot = -1;        // slot holding savedBlob, -1 = nothing in NVS
+
+static uint32_t crc32(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFFUL;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static void pirToRecord(const PirConfig &c, PirRecord &r) {
+  r.pin = c.pin;
+  r.flags = (c.activeLow ? 1 : 0) | (c.autoOn ? 2 : 0);
+  r.autoOffS = c.autoOffS;
+  r.linked = c.linked;
+}
+
+static void defaultPirConfig(PirConfig &c) {
+  c.pin = -1;
+  c.activeLow = false;
+  c.autoOn = true;
+  c.autoOffS = PIR_DEFAULT_AUTO_OFF_S;
+  c.linked = 0;
+}
+
+static bool readConfigSlot(int slot, ConfigBlob &blob) {
+  size_t len = prefs.getBytesLength(configSlotKeys[slot]);
+  if (len < configBlobBodyV1(0) + sizeof(uint32_t) || len > sizeof(blob)) return false;
+  prefs.getBytes(configSlotKeys[slot], &blob, len);
+  if (blob.magic != CONFIG_BLOB_MAGIC || blob.count > MAX_SWITCHES) return false;
+  size_t body;
+  if (blob.version == CONFIG_BLOB_VERSION) body = configBlobBody(blob.count);
+  else if (blob.version == 1) body = configBlobBodyV1(blob.count);
+  else return false;
+  if (len != body + sizeof(uint32_t)) return false;
+  uint32_t crc;
+  memcpy(&crc, (const uint8_t *)&blob + body, sizeof(crc));
+  if (crc != crc32(&blob, body)) return false;
+  if (blob.version == 1) {
+    // Upgrade in RAM to the v2 layout without sensors; rewritten on the next change
+    memmove(blob.records, blob.pir, blob.count * sizeof(ConfigRecord));
+    PirConfig none;
+    defaultPirConfig(none);
+    for (int k = 0; k < MAX_PIR_SENSORS; k++) pirToRecord(none, blob.pir[k]);
+    blob.version = CONFIG_BLOB_VERSION;
+  }
+  return true;
+}
+
+static void defaultSwitchConfig(int i, SwitchConfig &cfg) {
+  if (i < DEFAULT_SWITCH_COUNT) {
+    const BoardChannel &ch = Board::channels[i];
+    cfg.relayPin = ch.relay;
+    cfg.manualPin = ch.manual;
+    strlcpy(cfg.name, ch.name, SWITCH_NAME_LEN);
+    cfg.manualActiveLow = ch.manualActiveLow;
+    return;
+  }
+  cfg.relayPin = -1;
+  cfg.manualPin = -1;
+  snprintf(cfg.name, SWITCH_NAME_LEN, "Switch%d", i + 1);
+  cfg.manualActiveLow = true;
+}
+
+// v0 layout: relayN/manualN ints, names and polarity were never stored
+static bool loadLegacyConfig() {
+  if (!prefs.isKey("relay0") || !prefs.isKey("manual0")) return false;
+  char key[12];
+  for (int i = 0; i < DEFAULT_SWITCH_COUNT; i++) {
+    snprintf(key, sizeof(key), "relay%d", i);
+    switchCfg[i].relayPin = prefs.getInt(key, switchCfg[i].relayPin);
+    snprintf(key, sizeof(key), "manual%d", i);
+    switchCfg[i].manualPin = prefs.getInt(key, switchCfg[i].manualPin);
+  }
+  return true;
+}
+
+void loadConfigFromNVS() {
   // seed with defaults
+  numSwitches = DEFAULT_SWITCH_COUNT;
   for (int i = 0; i < MAX_SWITCHES; i++) {
-    switchCfg[i] = defaultSwitchConfigs[i];
+    defaultSwitchConfig(i, switchCfg[i]);
   }
+  for (int k = 0; k < MAX_PIR_SENSORS; k++) defaultPirConfig(pirCfg[k]);
 
-  if (have) {
-    prefs.begin("switchcfg", true);
-    for (int i = 0; i < MAX_SWITCHES; i++) {
-      switchCfg[i].relayPin = prefs.getInt(("relay"+String(i)).c_str(), switchCfg[i].relayPin);
-      switchCfg[i].manualPin = prefs.getInt(("manual"+String(i)).c_str(), switchCfg[i].manualPin);
-      // name + manualActiveLow remain from defaults unless also persisted
+  prefs.begin(CONFIG_NVS_NS, true);
+  static ConfigBlob slots[2];
+  bool valid[2] = { readConfigSlot(0, slots[0]), readConfigSlot(1, slots[1]) };
+  int best = -1;
+  if (valid[0]) best = 0;
+  if (valid[1] && (best < 0 || (int32_t)(slots[1].generation - slots[0].generation) > 0)) best = 1;
+  bool legacy = best < 0 && loadLegacyConfig();
+  prefs.end();
+
+  if (best >= 0) {
+    savedBlob = slots[best];
+    savedSlot = best;
+    numSwitches = savedBlob.count;
+    for (int i = 0; i < savedBlob.count; i++) {
+      const ConfigRecord &r = savedBlob.records[i];
+      switchCfg[i].relayPin = r.relayPin;
+      switchCfg[i].manualPin = r.manualPin;
+      switchCfg[i].manualActiveLow = r.manualActiveLow;
+      memcpy(switchCfg[i].name, r.name, SWITCH_NAME_LEN);
+      switchCfg[i].name[SWITCH_NAME_LEN - 1] = '\0';
+    }
+    for (int k = 0; k < MAX_PIR_SENSORS; k++) {
+      const PirRecord &r = savedBlob.pir[k];
+      pirCfg[k].pin = r.pin;
+      pirCfg[k].activeLow = r.flags & 1;
+      pirCfg[k].autoOn = r.flags & 2;
+      pirCfg[k].autoOffS = r.autoOffS;
+      pirCfg[k].linked = r.linked;
     }
-    prefs.end();
-    Serial.println("[CFG] Loaded pin map from NVS");
+    LOGI("CFG", "Loaded config slot %s (gen %lu, %d switches)",
+                  configSlotKeys[best], (unsigned long)savedBlob.generation, numSwitches);
+  } else if (legacy) {
+    LOGI("CFG", "Migrating legacy pin map");
+    saveConfigToNVS(switchCfg, numSwitches, pirCfg);
   } else {
-    Serial.println("[CFG] Using factory defaults");
+    LOGI("CFG", "Using factory defaults");
   }
 }
 
-void saveConfigToNVS() {
-  prefs.begin("switchcfg", false);
-  for (int i = 0; i < MAX_SWITCHES; i++) {
-    prefs.putInt(("relay"+String(i)).c_str(), switchCfg[i].relayPin);
-    prefs.putInt(("manual"+String(i)).c_str(), switchCfg[i].manualPin);
+// Only called from setup() and the telemetry task, so NVS and savedBlob have one owner
+void saveConfigToNVS(const SwitchConfig *cfg, int count, const PirConfig *pir) {
+  static ConfigBlob blob; // ~900 bytes at 32 channels, too big for the telemetry stack
+  memset(&blob, 0, sizeof(blob));
+  blob.magic = CONFIG_BLOB_MAGIC;
+  blob.version = CONFIG_BLOB_VERSION;
+  blob.count = count;
+  for (int i = 0; i < count; i++) {
+    ConfigRecord &r = blob.records[i];
+    r.relayPin = cfg[i].relayPin;
+    r.manualPin = cfg[i].manualPin;
+    r.manualActiveLow = cfg[i].manualActiveLow;
+    strlcpy(r.name, cfg[i].name, SWITCH_NAME_LEN);
+  }
+  for (int k = 0; k < MAX_PIR_SENSORS; k++) pirToRecord(pir[k], blob.pir[k]);
+
+  // Skip the flash write entirely when nothing persisted would change
+  if (savedSlot >= 0 && savedBlob.count == blob.count &&
+      memcmp(savedBlob.pir, blob.pir, sizeof(blob.pir)) == 0 &&
+      memcmp(savedBlob.records, blob.records, count * sizeof(ConfigRecord)) == 0) {
+    return;
+  }
+
+  int slot = savedSlot < 0 ? 0 : savedSlot ^ 1; // never overwrite the current good copy
+  blob.generation = savedSlot < 0 ? 1 : savedBlob.generation + 1;
+  uint32_t crc = crc32(&blob, configBlobBody(blob.count));
+  memcpy((uint8_t *)&blob + configBlobBody(blob.count), &crc, sizeof(crc));
+  size_t size = configBlobSize(blob.count);
+
+  prefs.begin(CONFIG_NVS_NS, false);
+  size_t written = prefs.putBytes(configSlotKeys[slot], &blob, size);
+  if (written == size && prefs.isKey("relay0")) {
+    for (int i = 0; i < DEFAULT_SWITCH_COUNT; i++) {
+      char key[12];
+      snprintf(key, sizeof(key), "relay%d", i);
+      prefs.remove(key);
+      snprintf(key, sizeof(key), "manual%d", i);
+      prefs.remove(key);
+    }
   }
   prefs.end();
-  Serial.println("[CFG] Saved pin map to NVS");
+
+  if (written != size) {
+    LOGE("CFG", "Save failed");
+    return;
+  }
+  savedBlob = blob;
+  savedSlot = slot;
+  LOGI("CFG", "Saved config to %s (gen %lu)", configSlotKeys[slot], (unsigned long)blob.generation);
+}
+
+// Caller holds cfgMutex (the change it marks was made under it)
+void markConfigDirty() {
+  unsigned long now = millis();
+  if (!configDirty) configDirtySince = now;
+  configLastChange = now;
+  configDirty = true;
+}
+
+// Snapshot the dirty table under cfgMutex, then write it without holding the lock
+void flushConfigNow() {
+  static SwitchConfig snapshot[MAX_SWITCHES];
+  static PirConfig pirSnapshot[MAX_PIR_SENSORS];
+  int count = 0;
+  xSemaphoreTake(cfgMutex, portMAX_DELAY);
+  bool dirty = configDirty;
+  if (dirty) {
+    count = numSwitches;
+    memcpy(snapshot, switchCfg, count * sizeof(SwitchConfig));
+    memcpy(pirSnapshot, pirCfg, sizeof(pirCfg));
+    configDirty = false;
+  }
+  xSemaphoreGive(cfgMutex);
+  if (dirty) saveConfigToNVS(snapshot, count, pirSnapshot);
+}
+
+void configCommitTick() {
+  if (rebootRequested) {
+    flushConfigNow();
+    LOGI("SYS", "Planned reboot");
+    logFlushBlocking();
+    ESP.restart();
+  }
+  if (!configDirty) return;
+  unsigned long now = millis();
+  if (now - configLastChange >= CONFIG_COMMIT_IDLE_MS || now - configDirtySince >= CONFIG_COMMIT_MAX_MS) {
+    flushConfigNow();
+  }
+}
+
+// Any task: the telemetry task flushes pending config and restarts
+void requestPlannedReboot() {
+  rebootRequested = true;
+}
+
+// ========= Boot Restore =========
+// The relay mask and the maintained switch positions it was applied with. The RTC
+// copy is rewritten after every relay flush (GPIO task); the telemetry task copies
+// it to NVS once it stops changing. RTC_NOINIT memory is garbage after power-on,
+// the CRC tells.
+#define RELAY_STATE_NS     "relaystate"
+#define RELAY_STATE_KEY    "last"
+#define RELAY_STATE_MAGIC  0xB007
+
+struct __attribute__((packed)) RelaySnapshot {
+  uint16_t magic;
+  uint8_t  count;    // numSwitches the masks belong to
+  uint8_t  reserved;
+  uint32_t relays;   // bit i = relay i ON
+  uint32_t manual;   // bit i = maintained switch i active (channels with a manual pin)
+  uint32_t crc;      // CRC-32 of the fields above
+};
+
+RTC_NOINIT_ATTR RelaySnapshot rtcSnapshot;
+static portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile unsigned long snapshotChangedAt = 0;
+static RelaySnapshot savedSnapshot = {};  // NVS copy (setup, then telemetry task)
+static unsigned long lastSnapshotSave = 0;
+
+static bool snapshotValid(const RelaySnapshot &s) {
+  return s.magic == RELAY_STATE_MAGIC && s.count == numSwitches &&
+         s.crc == crc32(&s, offsetof(RelaySnapshot, crc));
+}
+
+static uint32_t manualMask() {
+  uint32_t m = 0;
+  for (int i = 0; i < numSwitches; i++) {
+    if (switchCfg[i].manualPin >= 0 && lastStableManual[i]) m |= (1UL << i);
+  }
+  return m;
+}
+
+// After every relay flush (setup / GPIO task); a RAM write, no flash
+void retainRelayState() {
+  RelaySnapshot s = { RELAY_STATE_MAGIC, (uint8_t)numSwitches, 0, relayMask(), manualMask(), 0 };
+  s.crc = crc32(&s, offsetof(RelaySnapshot, crc));
+  portENTER_CRITICAL(&snapshotMux);
+  bool changed = memcmp(&s, &rtcSnapshot, sizeof(s)) != 0;
+  if (changed) rtcSnapshot = s;
+  portEXIT_CRITICAL(&snapshotMux);
+  if (changed) snapshotChangedAt = millis();
+}
+
+// Telemetry task: persist a snapshot that has been stable for a while
+void relayStateCommitTick() {
+  unsigned long now = millis();
+  if (now - snapshotChangedAt < RELAY_PERSIST_IDLE_MS) return;
+  if (lastSnapshotSave && now - lastSnapshotSave < RELAY_PERSIST_MIN_GAP_MS) return;
+  RelaySnapshot s;
+  portENTER_CRITICAL(&snapshotMux);
+  s = rtcSnapshot;
+  portEXIT_CRITICAL(&snapshotMux);
+  if (s.magic != RELAY_STATE_MAGIC || !memcmp(&s, &savedSnapshot, sizeof(s))) return;
+  Preferences p;
+  p.begin(RELAY_STATE_NS, false);
+  bool ok = p.putBytes(RELAY_STATE_KEY, &s, sizeof(s)) == sizeof(s);
+  p.end();
+  lastSnapshotSave = now;
+  if (ok) savedSnapshot = s;
+  LOGD("RELAY", "Persisted 0x%08lx", (unsigned long)s.relays);
+}
+
+// setup(): pick each relay's boot state, then bring the outputs up already driving it
+void restoreBootState() {
+  const char *source = nullptr;
+  RelaySnapshot s = {};
+  {
+    Preferences p;
+    p.begin(RELAY_STATE_NS, true);
+    if (p.getBytes(RELAY_STATE_KEY, &savedSnapshot, sizeof(savedSnapshot)) != sizeof(savedSnapshot)) savedSnapshot = {};
+    p.end();
+  }
+  if (esp_reset_reason() != ESP_RST_POWERON && snapshotValid(rtcSnapshot)) {
+    s = rtcSnapshot;
+    source = "rtc";
+  } else if (snapshotValid(savedSnapshot)) {
+    s = savedSnapshot;
+    source = "nvs";
+  }
+  if (BOOT_RESTORE_POLICY == BOOT_RESTORE_MANUAL) source = nullptr;
+
+  for (int i = 0; i < numSwitches; i++) {
+    if (switchCfg[i].manualPin >= 0) pinMode(switchCfg[i].manualPin, INPUT_PULLUP);
+  }
+  delayMicroseconds(50); // let the pull-ups charge the switch wiring before sampling
+
+  for (int i = 0; i < numSwitches; i++) {
+    uint32_t bit = 1UL << i;
+    bool on = source && (s.relays & bit);
+    if (switchCfg[i].manualPin >= 0) {
+      int lvl = digitalRead(switchCfg[i].manualPin);
+      bool active = inputActive(lvl, switchCfg[i].manualActiveLow);
+      lastStableManual[i] = active;
+      // No snapshot: the switch decides; MERGE: a switch moved while we were down wins
+      if (!source || (BOOT_RESTORE_POLICY == BOOT_RESTORE_MERGE && active != (bool)(s.manual & bit))) on = active;
+    }
+    relayState[i] = on;
+  }
+
+  // Expanders latch OFF in begin() and get the mask with the flush below; the
+  // GPIO backend presets each output latch in relayDriverConfigure()
+  relayDriverBegin();
+  applyPinModes();
+  for (int i = 0; i < numSwitches; i++) relayDriverStage(switchCfg[i].relayPin, relayState[i]);
+  relayDriverFlush();
+  retainRelayState();
+  LOGI("RELAY", "Board %s, driver %s, %d channels; boot state 0x%08lx from %s", Board::id, relayDriverName(), relayDriverChannels(),
+       (unsigned long)relayMask(), source ? source : "switches");
+}
+
+// ========= Switch Lookup =========
+// FNV-1a over the raw name bytes, no String temporaries on the command path
+static uint32_t hashName(const char *name) {
+  uint32_t h = 2166136261UL;
+  while (*name) { h ^= (uint8_t)*name++; h *= 16777619UL; }
+  return h;
+}
+
+void rebuildSwitchIndex() {
+  memset(gpioToIdx, -1, sizeof(gpioToIdx));
+  for (int i = 0; i < NAME_TABLE_SIZE; i++) nameTable[i].idx = -1;
+
+  for (int i = 0; i < numSwitches; i++) {
+    int gpio = switchCfg[i].relayPin;
+    if (gpio >= 0 && gpio < GPIO_LOOKUP_SIZE && gpioToIdx[gpio] < 0) gpioToIdx[gpio] = i; // first wins, like the old scan
+
+    uint32_t h = hashName(switchCfg[i].name);
+    for (uint32_t slot = h & (NAME_TABLE_SIZE - 1);; slot = (slot + 1) & (NAME_TABLE_SIZE - 1)) {
+      if (nameTable[slot].idx < 0) { nameTable[slot] = { h, (int8_t)i }; break; }
+      // duplicate name: keep the lower index
+      if (nameTable[slot].hash == h && strcmp(switchCfg[nameTable[slot].idx].name, switchCfg[i].name) == 0) break;
+    }
+  }
+}
+
+int findSwitchByName(const char *name) {
+  uint32_t h = hashName(name);
+  for (uint32_t slot = h & (NAME_TABLE_SIZE - 1);; slot = (slot + 1) & (NAME_TABLE_SIZE - 1)) {
+    const NameSlot &e = nameTable[slot];
+    if (e.idx < 0) return -1;
+    if (e.hash == h && strcmp(switchCfg[e.idx].name, name) == 0) return e.idx;
+  }
+}
+
+int findSwitchByGpio(int gpio) {
+  return (gpio >= 0 && gpio < GPIO_LOOKUP_SIZE) ? gpioToIdx[gpio] : -1;
 }
 
 // ========= Hardware Apply =========
 void applyPinModes() {
-  for (int i = 0; i < MAX_SWITCHES; i++) {
-    pinMode(switchCfg[i].relayPin, OUTPUT);
-    // Do not force OFF here; we'll set from manual state right after
-    pinMode(switchCfg[i].manualPin, INPUT_PULLUP);
+  for (int i = 0; i < numSwitches; i++) {
+    // Output comes up at the state we already hold for it (boot restore / remap)
+    relayDriverConfigure(switchCfg[i].relayPin, relayState[i]);
+    if (switchCfg[i].manualPin >= 0) pinMode(switchCfg[i].manualPin, INPUT_PULLUP);
+  }
+}
+
+// Channels dropped by a smaller switch count: relay OFF before its pin is forgotten
+void releaseInactiveChannels() {
+  for (int i = numSwitches; i < MAX_SWITCHES; i++) {
+    if (relayState[i]) setRelay(i, false, false);
   }
+  relayDriverFlush();
+  retainRelayState();
 }
 
 void readAllManualAndApply(bool notifyBackend) {
-  for (int i = 0; i < MAX_SWITCHES; i++) {
+  for (int i = 0; i < numSwitches; i++) {
+    if (switchCfg[i].manualPin < 0) continue; // no wall switch: keep the current state
     int lvl = digitalRead(switchCfg[i].manualPin);
-    bool active = switchCfg[i].manualActiveLow ? (lvl == LOW) : (lvl == HIGH);
-    lastReadManual[i]   = active;
+    bool active = inputActive(lvl, switchCfg[i].manualActiveLow);
     lastStableManual[i] = active;
-    lastChangeMs[i]     = millis();
     setRelay(i, active, notifyBackend);
   }
+  relayDriverFlush();
+  retainRelayState();
+  LOGI("RELAY", "Manual sync -> 0x%08lx", (unsigned long)relayMask());
 }
 
 // ========= Relay Control =========
 void setRelay(int idx, bool on, bool notifyBackend) {
+  if (relayState[idx] != on) {
+    portENTER_CRITICAL(&stateMux);
+    changeSeq[idx] = ++stateSeq;
+    portEXIT_CRITICAL(&stateMux);
+  }
   relayState[idx] = on;
-  digitalWrite(switchCfg[idx].relayPin, on ? RELAY_ON_LEVEL : RELAY_OFF_LEVEL);
+  relayDriverStage(switchCfg[idx].relayPin, on); // caller flushes once per batch
 
   if (notifyBackend && ws.isConnected()) {
-    DynamicJsonDocument doc(256);
-    doc["type"]  = "state_update";
-    doc["name"]  = switchCfg[idx].name;
-    doc["gpio"]  = switchCfg[idx].relayPin;
-    doc["state"] = on;
-    String out; serializeJson(doc, out);
-    ws.sendTXT(out);
+    postStateUpdate(1UL << idx);
   }
-
-  // Debug
-  Serial.print("[RELAY] "); Serial.print(switchCfg[idx].name);
-  Serial.print(" @GPIO "); Serial.print(switchCfg[idx].relayPin);
-  Serial.print(" -> "); Serial.println(on ? "ON" : "OFF");
 }
 
 // ========= Maintained Switch Handling (with debounce) =========
-void handleManualMaintained() {
-  unsigned long now = millis();
+// (Re)attach edge interrupts to the configured manual pins. Caller holds cfgMutex
+// or runs before the tasks start.
+void attachManualInputs() {
   for (int i = 0; i < MAX_SWITCHES; i++) {
-    int lvl = digitalRead(switchCfg[i].manualPin);
-    bool current = switchCfg[i].manualActiveLow ? (lvl == LOW) : (lvl == HIGH);
+    ManualInput &in = manualInputs[i];
+    if (!in.timer) {
+      esp_timer_create_args_t args = {};
+      args.callback = onManualDebounced;
+      args.arg = &in;
+      args.dispatch_method = ESP_TIMER_TASK;
+      args.name = "manual_db";
+      esp_timer_create(&args, &in.timer);
+      in.pin = -1;
+    }
+    if (in.pin >= 0 && in.pin != switchCfg[i].manualPin) {
+      detachInterrupt(in.pin);
+      in.pin = -1;
+    }
+    esp_timer_stop(in.timer);
+    in.idx = i;
+    in.activeLow = switchCfg[i].manualActiveLow;
+    if (i >= numSwitches || switchCfg[i].manualPin < 0) {
+      if (in.pin >= 0) detachInterrupt(in.pin);
+      in.pin = -1;
+      continue;
+    }
+    if (in.pin < 0) {
+      in.pin = switchCfg[i].manualPin;
+      attachInterruptArg(in.pin, onManualEdge, &in, CHANGE);
+    }
+#if ENABLE_AUTO_LIGHT_SLEEP && CONFIG_PM_ENABLE
+    // GPIO wake is level based: wake on the level opposite to the current one
+    gpio_wakeup_enable((gpio_num_t)in.pin, digitalRead(in.pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+#endif
+  }
+}
+
+// Pin edge ISR: every bounce restarts the debounce window
+void IRAM_ATTR onManualEdge(void *arg) {
+  ManualInput *in = (ManualInput *)arg;
+  if (!in->edgeUs) in->edgeUs = (uint32_t)esp_timer_get_time() | 1; // ISR safe; 0 means unset
+  esp_timer_stop(in->timer);
+  esp_timer_start_once(in->timer, (uint64_t)DEBOUNCE_MS * 1000ULL);
+}
 
-    if (current != lastReadManual[i]) {
-      lastReadManual[i] = current;
-      lastChangeMs[i] = now; // start debounce window
+// Debounce window expired (esp_timer task): sample once and hand the stable level to the GPIO task
+void onManualDebounced(void *arg) {
+  ManualInput *in = (ManualInput *)arg;
+  int lvl = digitalRead(in->pin);
+#if ENABLE_AUTO_LIGHT_SLEEP && CONFIG_PM_ENABLE
+  gpio_wakeup_enable((gpio_num_t)in->pin, lvl ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+#endif
+  bool active = inputActive(lvl, in->activeLow);
+  Command c = { CMD_MANUAL_EDGE, in->idx, active };
+  c.t0Us = in->edgeUs ? in->edgeUs : (nowUs() | 1);
+  in->edgeUs = 0;
+  enqueueCommand(c);
+}
+
+// Runs on the GPIO task for each debounced edge; the relay change joins the current batch
+void handleManualMaintained(int idx, bool active, RelayBatch &batch) {
+  if (idx >= numSwitches) return; // edge raced a shrinking config_update
+  if (active == lastStableManual[idx]) return; // bounce settled back to the old level
+  lastStableManual[idx] = active;
+  if (!wsAuthed) journalRecord(JOURNAL_MANUAL, idx, active);
+  // Maintained behavior: relay follows switch position (edge-based -> avoids fighting web overrides)
+  bool current = batch.pending(idx) ? batch.state[idx] : relayState[idx];
+  if (current != active) {
+    batch.set(idx, active); // backend is notified when the batch is applied
+  }
+}
+
+// ========= PIR Occupancy =========
+// Pins already used by an active switch are refused: one ISR per pin
+static bool pirPinInUse(int pin) {
+  for (int i = 0; i < numSwitches; i++) {
+    if (switchCfg[i].manualPin == pin) return true;
+#if RELAY_DRIVER == RELAY_DRIVER_GPIO
+    if (switchCfg[i].relayPin == pin) return true;
+#endif
+  }
+  return false;
+}
+
+// GPIO task (or setup(), before the tasks run); netTask reports the change
+static void setOccupied(int s, bool occupied) {
+  uint32_t bit = 1UL << s;
+  uint32_t m = occupied ? (occupiedMask | bit) : (occupiedMask & ~bit);
+  if (m == occupiedMask) return;
+  occupiedMask = m;
+  occupancyPending = true;
+  if (!wsAuthed) journalRecord(JOURNAL_PIR, s, occupied);
+  LOGI("PIR", "Sensor %d %s", s, occupied ? "occupied" : "vacant");
+}
+
+// (Re)attach the PIR inputs; a sensor whose pin changed starts vacant. Each attached
+// sensor is sampled once so motion already present is picked up. Caller holds
+// cfgMutex or runs before the tasks start.
+void attachPirInputs() {
+  for (int s = 0; s < MAX_PIR_SENSORS; s++) {
+    PirInput &in = pirInputs[s];
+    if (!in.debounce) {
+      esp_timer_create_args_t args = {};
+      args.arg = &in;
+      args.dispatch_method = ESP_TIMER_TASK;
+      args.callback = onPirDebounced;
+      args.name = "pir_db";
+      esp_timer_create(&args, &in.debounce);
+      args.callback = onPirVacancy;
+      args.name = "pir_vacancy";
+      esp_timer_create(&args, &in.vacancy);
+      in.pin = -1;
+    }
+    in.idx = s;
+    in.activeLow = pirCfg[s].activeLow;
+    int pin = pirCfg[s].pin;
+    if (pin >= 0 && pirPinInUse(pin)) {
+      LOGW("PIR", "Sensor %d: GPIO %d already used by a switch", s, pin);
+      pin = -1;
+    }
+    if (in.pin == pin) {
+      if (pin >= 0) esp_timer_start_once(in.debounce, (uint64_t)PIR_DEBOUNCE_MS * 1000ULL);
+      continue;
     }
+    if (in.pin >= 0) detachInterrupt(in.pin);
+    esp_timer_stop(in.debounce);
+    esp_timer_stop(in.vacancy);
+    in.gen++;
+    pirMotion[s] = false;
+    setOccupied(s, false);
+    in.pin = pin;
+    if (pin < 0) continue;
+    pinMode(pin, INPUT);
+    attachInterruptArg(pin, onPirEdge, &in, CHANGE);
+    esp_timer_start_once(in.debounce, (uint64_t)PIR_DEBOUNCE_MS * 1000ULL);
+  }
+}
+
+void IRAM_ATTR onPirEdge(void *arg) {
+  PirInput *in = (PirInput *)arg;
+  if (!in->edgeUs) in->edgeUs = (uint32_t)esp_timer_get_time() | 1;
+  esp_timer_stop(in->debounce);
+  esp_timer_start_once(in->debounce, (uint64_t)PIR_DEBOUNCE_MS * 1000ULL);
+}
+
+// esp_timer task: settled sensor output to the GPIO task
+void onPirDebounced(void *arg) {
+  PirInput *in = (PirInput *)arg;
+  if (in->pin < 0) return;
+  int lvl = digitalRead(in->pin);
+  Command c = { CMD_PIR_MOTION, in->idx, inputActive(lvl, in->activeLow) };
+  c.t0Us = in->edgeUs ? in->edgeUs : (nowUs() | 1);
+  in->edgeUs = 0;
+  enqueueCommand(c);
+}
 
-    if (current != lastStableManual[i] && (now - lastChangeMs[i] >= DEBOUNCE_MS)) {
-      lastStableManual[i] = current;
-      // Maintained behavior: relay follows switch position (edge-based -> avoids fighting web overrides)
-      if (relayState[i] != current) {
-        setRelay(i, current, true); // notify backend so UI updates
+// esp_timer task: no motion for autoOffS
+void onPirVacancy(void *arg) {
+  PirInput *in = (PirInput *)arg;
+  Command c = { CMD_PIR_VACANT, in->idx, false };
+  c.seq = in->gen;
+  enqueueCommand(c);
+}
+
+// GPIO task. Motion switches the linked relays on and cancels a pending vacancy;
+// the end of motion arms it. Retriggering PIR modules make this a few edges a minute.
+void handlePirMotion(int s, bool motion, RelayBatch &batch) {
+  if (s >= MAX_PIR_SENSORS || pirInputs[s].pin < 0 || motion == pirMotion[s]) return;
+  pirMotion[s] = motion;
+  PirInput &in = pirInputs[s];
+  const PirConfig &cfg = pirCfg[s];
+  esp_timer_stop(in.vacancy);
+  in.gen++;
+  if (motion) {
+    pirMotionCount[s]++;
+    if (cfg.autoOn) {
+      for (int i = 0; i < numSwitches; i++) {
+        bool current = batch.pending(i) ? batch.state[i] : relayState[i];
+        if ((cfg.linked & (1UL << i)) && !current) batch.set(i, true);
       }
     }
+    setOccupied(s, true);
+  } else if (cfg.autoOffS) {
+    esp_timer_start_once(in.vacancy, (uint64_t)cfg.autoOffS * 1000000ULL);
+  } else {
+    setOccupied(s, false); // no local auto-off: vacant as soon as the output drops
+  }
+}
+
+// GPIO task. Relays another occupied sensor also drives stay on.
+void handlePirVacant(int s, uint32_t gen, RelayBatch &batch) {
+  if (s >= MAX_PIR_SENSORS || gen != pirInputs[s].gen || pirMotion[s]) return; // re-armed or motion since
+  uint32_t held = 0;
+  for (int k = 0; k < MAX_PIR_SENSORS; k++) {
+    if (k != s && (occupiedMask & (1UL << k))) held |= pirCfg[k].linked;
+  }
+  uint32_t off = pirCfg[s].linked & ~held;
+  for (int i = 0; i < numSwitches; i++) {
+    bool current = batch.pending(i) ? batch.state[i] : relayState[i];
+    if ((off & (1UL << i)) && current) batch.set(i, false);
   }
+  setOccupied(s, false);
 }
 
 // ========= WebSocket =========
 void setupWebSocket() {
+#ifdef WEBSOCKET_CA_CERT
+  ws.beginSslWithCA(WEBSOCKET_HOST, WEBSOCKET_PORT, WEBSOCKET_PATH, WEBSOCKET_CA_CERT);
+#else
   ws.beginSSL(WEBSOCKET_HOST, WEBSOCKET_PORT, WEBSOCKET_PATH);
+#endif
   ws.onEvent(onWsEvent);
   ws.setReconnectInterval(3000);
-  ws.enableHeartbeat(15000, 3000, 2); // Enable heartbeat with 15s interval, 3s timeout, 2 retries
+  // No library heartbeat: keepaliveService() sends the pings (with telemetry) only when needed
 }
 
 void onWsEvent(WStype_t type, uint8_t * payload, size_t length) {
+  wsRxUs = nowUs();
+  if (type != WStype_DISCONNECTED && type != WStype_ERROR) keepaliveRx(millis());
   switch (type) {
     case WStype_CONNECTED: {
       connState = BACKEND_CONNECTED;
-      Serial.println("[WS] Connected");
+      tlsHandshakeMs = (micros() - wsLoopStartUs) / 1000;
+      tlsHandshakeMaxMs = max(tlsHandshakeMaxMs, tlsHandshakeMs);
+      {
+        uint32_t heapNow = ESP.getFreeHeap();
+        tlsHeapCost = wsLoopStartHeap > heapNow ? wsLoopStartHeap - heapNow : 0;
+      }
+      LOGI("WS", "Connected (handshake %lu ms, heap -%lu)",
+                    (unsigned long)tlsHandshakeMs, (unsigned long)tlsHeapCost);
       // Auth
-      DynamicJsonDocument doc(256);
-      doc["type"] = "auth";
-      doc["mac"]  = WiFi.macAddress();
+      JsonDocument &doc = beginMessage("auth");
+      doc["mac"]  = (const char *)macStr;
       doc["secretKey"] = DEVICE_SECRET_KEY;
-      String out; serializeJson(doc, out);
-      ws.sendTXT(out);
+#if ENABLE_BIN_PROTO
+      doc["proto"] = BINPROTO_NAME;
+#endif
+      char build[65];
+      otaRunningBuild(build);
+      doc["fw"] = otaRunningVersion();
+      doc["build"] = (const char *)build; // base for delta OTA; serialized before it goes out of scope
+      sendMessage();
       
       // Reset reconnection attempts counter on successful connection
       reconnectionAttempts = 0;
     } break;
 
-    case WStype_DISCONNECTED:
-      Serial.println("[WS] Disconnected");
-      connState = (WiFi.status()==WL_CONNECTED) ? WIFI_ONLY : WIFI_DISCONNECTED;
+    case WStype_DISCONNECTED: {
+      LOGW("WS", "Disconnected");
+      binMode = false; // renegotiated on the next auth
+      wsAuthed = false;
+      txQueueClear();      // frames for the old connection; state is resent after auth
+      journalInFlight = 0; // unacked batch is replayed again after the next auth
+      journalAbandon();
+      connState = wifiManagerConnected() ? WIFI_ONLY : WIFI_DISCONNECTED;
       
-      // Implement exponential backoff for reconnection
+      // Jittered exponential backoff, stretched by retry_after hints and the token bucket
       reconnectionAttempts++;
-      unsigned long backoffTime = min(30000UL, 1000UL * (1 << min(reconnectionAttempts, 5)));
-      Serial.printf("[WS] Will attempt reconnection in %lu ms (attempt #%d)\n", backoffTime, reconnectionAttempts);
+      if (reconnectionAttempts >= WIFI_CACHE_IP_WS_FAILS) wifiManagerUplinkFailed(); // a reused lease may be taken
+      unsigned long backoffTime = nextReconnectDelay();
+      LOGI("WS", "Will attempt reconnection in %lu ms (attempt #%d)", backoffTime, reconnectionAttempts);
       ws.setReconnectInterval(backoffTime);
-      break;
+    } break;
       
     case WStype_ERROR:
-      Serial.println("[WS] Error occurred");
+      LOGE("WS", "Error occurred");
       logLastError();
       break;
 
+    case WStype_BIN:
+      handleBinFrame(payload, length);
+      break;
+
+    case WStype_PONG:
+      keepalivePong(millis());
+      break;
+
     case WStype_TEXT: {
-      DynamicJsonDocument doc(1024);
-      auto err = deserializeJson(doc, payload, length);
-      if (err) { Serial.println("[WS] JSON parse error"); return; }
+      PROFILE(PROF_WS_RX);
+      // Zero-copy parse: strings in rxDoc point into the (mutable) payload buffer
+      JsonDocument &doc = rxDoc;
+      auto err = deserializeJson(doc, (char *)payload, length);
+      if (err) { LOGW("WS", "JSON parse error"); return; }
 
-      String t = doc["type"] | "";
+      const char *t = doc["type"] | "";
 
-      if (t == "auth_success") {
-        // Push full current truth so UI matches hardware
-        sendFullState();
+      if (!strcmp(t, "auth_success")) {
+        binMode = ENABLE_BIN_PROTO && !strcmp(doc["proto"] | "", BINPROTO_NAME);
+        wsAuthed = true;
+        otaConfirmBoot(); // reached the backend: an OTA image no longer rolls back
+        keepaliveReset(millis());
+        applyKeepaliveHint(doc["keepalive"]);
+        if (binMode) LOGI("WS", "Binary protocol " BINPROTO_NAME " enabled");
+        // Resync: if the server already holds our epoch/seq only the missing delta is sent,
+        // otherwise push full current truth (JSON: also carries the index -> gpio map)
+        uint32_t srvEpoch = doc["stateEpoch"] | 0;
+        uint32_t srvSeq   = doc["stateSeq"] | 0;
+        if (srvEpoch == stateEpoch && srvSeq <= stateSeq) {
+          ackedSeq = srvSeq;
+          sendStateDelta(0); // no-op when srvSeq == stateSeq
+        } else {
+          ackedSeq = 0;
+          sendFullState();
+        }
+        sendScheduleReports(); // executions while the backend was unreachable
+        for (int s = 0; s < MAX_PIR_SENSORS; s++) if (pirCfg[s].pin >= 0) occupancyPending = true;
       }
-      else if (t == "switch_command") {
-        // Supported: by "name" or by "gpio"
-        bool haveName = doc.containsKey("name");
-        bool haveGpio = doc.containsKey("gpio");
-        bool state    = doc["state"] | false;
-
-        for (int i = 0; i < MAX_SWITCHES; i++) {
-          bool match = false;
-          if (haveName) match = (switchCfg[i].name == String((const char*)doc["name"]));
-          if (!match && haveGpio) match = (switchCfg[i].relayPin == (int)doc["gpio"]);
-
-          if (match) {
-            Command c = { i, state };
-            xQueueSend(cmdQueue, &c, 0);
-            break;
-          }
+      else if (!strcmp(t, "switch_command")) {
+        handleSwitchCommand(doc);
+      }
+      else if (!strcmp(t, "retry_after") || !strcmp(t, "auth_failed")) {
+        // Server asks us to stay away for a while (e.g. restarting or overloaded)
+        unsigned long ms = doc["ms"] | (doc["retryAfter"] | 0UL);
+        if (ms) retryAfterMs = min(ms, (unsigned long)RETRY_AFTER_MAX_MS);
+      }
+      else if (!strcmp(t, "state_ack")) {
+        if (doc.containsKey("seq")) handleStateAck(doc["stateEpoch"] | stateEpoch, doc["seq"] | 0);
+      }
+      else if (!strcmp(t, "switch_command_batch")) {
+        handleSwitchCommandBatch(doc);
+      }
+      else if (!strcmp(t, "journal_ack")) {
+        if (journalInFlight && (doc["seq"] | 0UL) == journalSeq) {
+          journalConsume(journalInFlight);
+          journalInFlight = 0;
         }
       }
-      else if (t == "config_update") {
-        // Expect: { type:"config_update", switches:[{relay:4, manual:25, name:"Fan1", manualActiveLow:true}, ...] }
+      else if (!strcmp(t, "schedule_update")) {
+        handleScheduleUpdate(doc);
+      }
+      else if (!strcmp(t, "get_metrics")) {
+        sendMetrics(doc["reset"] | false);
+      }
+      else if (!strcmp(t, "get_logs")) {
+        sendLogs(doc["lines"] | LOG_HISTORY_LINES);
+      }
+      else if (!strcmp(t, "reboot")) {
+        requestPlannedReboot();
+      }
+      else if (!strcmp(t, "ota_update")) {
+        handleOtaUpdate(doc);
+      }
+      else if (!strcmp(t, "keepalive")) {
+        applyKeepaliveHint(doc.as<JsonVariant>());
+      }
+      else if (!strcmp(t, "config_update")) {
+        // Expect: { type:"config_update", count:6, switches:[{relay:4, manual:25, name:"Fan1", manualActiveLow:true}, ...] }
+        // Without "count" the active count only grows to cover the entries sent.
         JsonArray arr = doc["switches"].as<JsonArray>();
-        for (int i = 0; i < MAX_SWITCHES && i < (int)arr.size(); i++) {
+        bool changed = false;
+        int count = numSwitches;
+        if (doc.containsKey("count")) count = constrain(doc["count"] | numSwitches, 1, MAX_SWITCHES);
+        else if ((int)arr.size() > count) count = min((int)arr.size(), MAX_SWITCHES);
+        if (count != numSwitches) {
+          xSemaphoreTake(cfgMutex, portMAX_DELAY);
+          numSwitches = count;
+          markConfigDirty();
+          xSemaphoreGive(cfgMutex);
+          changed = true;
+        }
+        for (int i = 0; i < count && i < (int)arr.size(); i++) {
           JsonObject s = arr[i];
-          if (s.containsKey("relay")) switchCfg[i].relayPin = (int)s["relay"];
-          if (s.containsKey("manual")) switchCfg[i].manualPin = (int)s["manual"];
-          if (s.containsKey("name")) switchCfg[i].name = (const char*)s["name"];
-          if (s.containsKey("manualActiveLow")) switchCfg[i].manualActiveLow = (bool)s["manualActiveLow"];
+          SwitchConfig next = switchCfg[i];
+          if (s.containsKey("relay")) next.relayPin = (int)s["relay"];
+          if (s.containsKey("manual")) next.manualPin = (int)s["manual"];
+          if (s.containsKey("name")) strlcpy(next.name, s["name"] | "", SWITCH_NAME_LEN);
+          if (s.containsKey("manualActiveLow")) next.manualActiveLow = (bool)s["manualActiveLow"];
+          if (next.relayPin == switchCfg[i].relayPin && next.manualPin == switchCfg[i].manualPin &&
+              !strcmp(next.name, switchCfg[i].name) && next.manualActiveLow == switchCfg[i].manualActiveLow) continue;
+          xSemaphoreTake(cfgMutex, portMAX_DELAY);
+          switchCfg[i] = next;
+          markConfigDirty();
+          xSemaphoreGive(cfgMutex);
+          changed = true;
         }
-        saveConfigToNVS();
-        applyPinModes();
-        // After pin remap, re-read maintained switches and apply
-        readAllManualAndApply(true);
-        sendFullState(); // extra safety so UI stays in sync
+        // Expect: pir:[{gpio:34, autoOff:30, linked:[0,2], autoOn:true, activeLow:false}, ...]
+        // (linked: switch indexes or a mask); sensors not listed are removed
+        if (doc.containsKey("pir")) {
+          PirConfig next[MAX_PIR_SENSORS];
+          int k = 0;
+          for (JsonObject p : doc["pir"].as<JsonArray>()) {
+            if (k >= MAX_PIR_SENSORS) break;
+            PirConfig &c = next[k++];
+            defaultPirConfig(c);
+            c.pin = p["gpio"] | -1;
+            c.activeLow = p["activeLow"] | false;
+            c.autoOn = p["autoOn"] | true;
+            c.autoOffS = constrain(p["autoOff"] | PIR_DEFAULT_AUTO_OFF_S, 0, 65535);
+            if (p["linked"].is<JsonArray>()) {
+              for (int idx : p["linked"].as<JsonArray>()) if (idx >= 0 && idx < MAX_SWITCHES) c.linked |= 1UL << idx;
+            } else {
+              c.linked = p["linked"] | 0UL;
+            }
+          }
+          for (; k < MAX_PIR_SENSORS; k++) defaultPirConfig(next[k]);
+          for (k = 0; k < MAX_PIR_SENSORS; k++) {
+            const PirConfig &a = next[k], &b = pirCfg[k];
+            if (a.pin == b.pin && a.activeLow == b.activeLow && a.autoOn == b.autoOn &&
+                a.autoOffS == b.autoOffS && a.linked == b.linked) continue;
+            xSemaphoreTake(cfgMutex, portMAX_DELAY);
+            pirCfg[k] = a;
+            markConfigDirty();
+            xSemaphoreGive(cfgMutex);
+            changed = true;
+          }
+        }
+        // The server re-sends config on every auth; an identical config costs nothing
+        if (!changed) return;
+        rebuildSwitchIndex();
+        // Pin modes + relay re-apply happen on the GPIO task
+        Command c = { CMD_RESYNC, -1, false };
+        enqueueCommand(c);
       }
     } break;
 
@@ -303,49 +1461,796 @@ void onWsEvent(WStype_t type, uint8_t * payload, size_t length) {
   }
 }
 
+// Expect: { type:"switch_command_batch", seq:42, commands:[{index:0, state:true}, {gpio:16, state:false}, ...] }
+// All entries go to the GPIO task as one command so the scene is applied in a single sweep.
+void handleSwitchCommandBatch(JsonDocument &doc) {
+  Command c = { CMD_BATCH, -1, false };
+  c.seq = doc["seq"] | 0;
+  JsonArray arr = doc["commands"].as<JsonArray>();
+  c.rejected = parseRelayCommands(arr, c.mask, c.values);
+  if (!enqueueCommand(c)) {
+    // Nothing applied: answer right away so the server does not wait on us
+    NetEvent e = { NET_BATCH_ACK, -1, false, c.seq, 0, (uint8_t)min((int)arr.size(), 255) };
+    sendBatchAck(e);
+  }
+}
+
+// [{index|gpio, state}, ...] -> relay mask + values; returns the entries that matched no switch
+uint8_t parseRelayCommands(JsonArray arr, uint32_t &mask, uint32_t &values) {
+  uint8_t rejected = 0;
+  for (JsonObject cmd : arr) {
+    int idx = -1;
+    if (cmd.containsKey("index")) {
+      idx = cmd["index"] | -1;
+      if (idx >= numSwitches) idx = -1;
+    } else if (cmd.containsKey("gpio")) {
+      idx = findSwitchByGpio(cmd["gpio"] | -1);
+    }
+    if (idx < 0) {
+      if (rejected < 255) rejected++;
+      continue;
+    }
+    uint32_t bit = 1UL << idx;
+    mask |= bit;
+    if (cmd["state"] | false) values |= bit;
+    else values &= ~bit; // later entry for the same relay wins
+  }
+  return rejected;
+}
+
+// BIN_COMMAND: header + count * (index, state). seq != 0 asks for a BIN_BATCH_ACK and
+// is applied atomically like switch_command_batch; seq == 0 behaves like switch_command.
+void handleBinFrame(uint8_t *payload, size_t length) {
+  if (!binHeaderValid(payload, length)) { LOGW("WS", "Bad binary frame"); return; }
+  const BinHeader *h = (const BinHeader *)payload;
+  if (h->type == BIN_STATE_ACK) {
+    handleStateAck(stateEpoch, h->seq);
+    return;
+  }
+  if (h->type != BIN_COMMAND) return;
+  if (length < sizeof(BinHeader) + h->count * sizeof(BinCommandPair)) { LOGW("WS", "Short binary command"); return; }
+
+  const BinCommandPair *pairs = (const BinCommandPair *)(payload + sizeof(BinHeader));
+  Command batch = { CMD_BATCH, -1, false };
+  batch.seq = h->seq;
+  for (int k = 0; k < h->count; k++) {
+    int idx = pairs[k].index;
+    if (idx >= numSwitches) {
+      if (batch.rejected < 255) batch.rejected++;
+      continue;
+    }
+    if (h->seq == 0) {
+      Command c = { CMD_SET_RELAY, idx, pairs[k].state != 0 };
+      enqueueCommand(c);
+      continue;
+    }
+    uint32_t bit = 1UL << idx;
+    batch.mask |= bit;
+    if (pairs[k].state) batch.values |= bit;
+    else batch.values &= ~bit;
+  }
+  if (h->seq != 0 && !enqueueCommand(batch)) {
+    NetEvent e = { NET_BATCH_ACK, -1, false, batch.seq, 0, h->count };
+    sendBatchAck(e);
+  }
+}
+
+// ========= Local Scheduler =========
+// Expect: { type:"schedule_update", version:7, rules:[{id:3, days:62, at:"18:00",
+//           commands:[{index:0, state:false}, {gpio:16, state:false}]}, ...] }
+// days: bit 0 = Sunday .. bit 6 = Saturday (default every day). The table replaces the
+// previous one and is answered with schedule_ack { version, rules, rejected }.
+void handleScheduleUpdate(JsonDocument &doc) {
+  static ScheduleRule parsed[SCHEDULE_MAX_RULES]; // netTask only, off its stack
+  int count = 0, rejected = 0;
+  for (JsonObject r : doc["rules"].as<JsonArray>()) {
+    ScheduleRule rule = {};
+    rule.id = r["id"] | 0;
+    rule.days = (r["days"] | 0x7F) & 0x7F;
+    int hh = -1, mm = -1;
+    const char *at = r["at"] | "";
+    if (sscanf(at, "%d:%d", &hh, &mm) != 2 || hh < 0 || hh > 23 || mm < 0 || mm > 59 || count >= SCHEDULE_MAX_RULES) {
+      rejected++;
+      continue;
+    }
+    rule.minute = hh * 60 + mm;
+    uint32_t mask = 0, values = 0;
+    if (parseRelayCommands(r["commands"].as<JsonArray>(), mask, values) || !mask) {
+      rejected++;
+      continue;
+    }
+    rule.mask = mask;
+    rule.values = values;
+    parsed[count++] = rule;
+  }
+  uint32_t version = doc["version"] | 0;
+  schedulerUpdate(version, parsed, count);
+
+  JsonDocument &ack = beginMessage("schedule_ack");
+  ack["version"]  = version;
+  ack["rules"]    = count;
+  ack["rejected"] = rejected;
+  ack["timeValid"] = schedulerTimeValid();
+  sendMessage();
+}
+
+// Telemetry task (schedulerTick): the rule goes through the GPIO task like a scene
+void fireScheduleRule(const ScheduleRule &rule) {
+  Command c = { CMD_SCHEDULE, -1, false };
+  c.mask = rule.mask;
+  c.values = rule.values;
+  c.seq = rule.id;
+  c.t0Us = nowUs();
+  enqueueCommand(c);
+  postNetEvent(NET_SCHEDULE_REPORT);
+}
+
+// schedule_report { mac, version, executions:[{id, at, mask, state}] }, oldest first.
+// Executions stay buffered (SCHEDULE_REPORT_SLOTS) until a connection is authenticated.
+void sendScheduleReports() {
+  if (!wsAuthed || !ws.isConnected()) return;
+  ScheduleExec ex[8];
+  int n;
+  while ((n = schedulerTakeReports(ex, 8)) > 0) {
+    JsonDocument &doc = beginMessage("schedule_report");
+    doc["mac"]     = (const char *)macStr;
+    doc["version"] = schedulerVersion();
+    JsonArray arr = doc.createNestedArray("executions");
+    for (int k = 0; k < n; k++) {
+      JsonObject e = arr.createNestedObject();
+      e["id"]    = ex[k].id;
+      e["at"]    = ex[k].at;
+      e["mask"]  = ex[k].mask;
+      e["state"] = ex[k].values;
+    }
+    sendMessage();
+  }
+}
+
+// ========= OTA =========
+// ota_update { url, sha256, size[, version][, sig][, delta:{ base }] }, hex sha256 / sig /
+// base (app_elf_sha256 of the running build, sent as "build" in auth). A refusal is
+// answered right away; the OTA task's progress follows as ota_status.
+void handleOtaUpdate(JsonDocument &doc) {
+  static OtaRequest req; // ~450 bytes, kept off the net task stack
+  memset(&req, 0, sizeof(req));
+  const char *url = doc["url"] | "";
+  strlcpy(req.url, url, sizeof(req.url));
+  strlcpy(req.version, doc["version"] | "", sizeof(req.version));
+  req.size = doc["size"] | 0UL;
+  JsonVariant delta = doc["delta"];
+  req.delta = !delta.isNull();
+
+  const char *reason = nullptr;
+  int sigLen = hexDecode(doc["sig"] | "", req.sig, OTA_SIG_MAX);
+  if (strlen(url) >= sizeof(req.url)) reason = "url_too_long";
+  else if (hexDecode(doc["sha256"] | "", req.sha256, 32) != 32) reason = "sha256";
+  else if (req.delta && hexDecode(delta["base"] | "", req.base, 32) != 32) reason = "base";
+  else if (sigLen < 0) reason = "sig";
+  else {
+    req.sigLen = sigLen;
+    reason = otaStart(req);
+  }
+  if (reason) {
+    LOGW("OTA", "ota_update refused: %s", reason);
+    OtaStatus st = { OTA_FAILED, 0, req.size, reason, req.version };
+    sendOtaStatus(st);
+  }
+}
+
+// ota_status { mac, state, version, written, size[, reason] }; final states go out as control
+void sendOtaStatus(const OtaStatus &st) {
+  static const char *const names[] = { "idle", "downloading", "done", "failed" };
+  JsonDocument &doc = beginMessage("ota_status");
+  doc["mac"]     = (const char *)macStr;
+  doc["state"]   = names[st.state];
+  doc["version"] = st.version;
+  doc["written"] = st.written;
+  doc["size"]    = st.size;
+  if (st.error) doc["reason"] = st.error;
+  sendMessage(st.state == OTA_DOWNLOADING ? TX_PRIO_TELEMETRY : TX_PRIO_CONTROL);
+}
+
+// OTA task: hold the next chunk while relay commands or outbound events are waiting
+bool otaShouldYield() {
+  return uxQueueMessagesWaiting(cmdQueue) || uxQueueMessagesWaiting(netQueue);
+}
+
+// Bytes written, or -1 if hex is not an even run of hex digits that fits in max
+int hexDecode(const char *hex, uint8_t *out, int max) {
+  int n = 0;
+  for (; hex[0] && hex[1]; hex += 2) {
+    if (n == max || !isxdigit((unsigned char)hex[0]) || !isxdigit((unsigned char)hex[1])) return -1;
+    char pair[3] = { hex[0], hex[1], 0 };
+    out[n++] = (uint8_t)strtoul(pair, nullptr, 16);
+  }
+  return hex[0] ? -1 : n;
+}
+
+// ========= Reconnect Policy =========
+void seedReconnectJitter() {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  uint32_t h = 2166136261UL;
+  for (int i = 0; i < 6; i++) { h ^= mac[i]; h *= 16777619UL; }
+  reconnectRng = (h ^ esp_random()) | 1; // never zero (xorshift fixed point)
+  lastTokenRefill = millis();
+}
+
+static uint32_t reconnectRand() {
+  reconnectRng ^= reconnectRng << 13;
+  reconnectRng ^= reconnectRng >> 17;
+  reconnectRng ^= reconnectRng << 5;
+  return reconnectRng;
+}
+
+// Delay before the next reconnect attempt (ms). Each call spends one bucket token.
+unsigned long nextReconnectDelay() {
+  unsigned long now = millis();
+
+  // Jittered exponential backoff: uniform in [ceil/2, ceil]
+  unsigned long ceil = min((unsigned long)RECONNECT_MAX_MS,
+                           (unsigned long)RECONNECT_BASE_MS << min(reconnectionAttempts, 5));
+  unsigned long delayMs = ceil / 2 + reconnectRand() % (ceil / 2 + 1);
+  bool stormed = false;
+
+  // Server hint: wait at least retry_after, spread over an extra 50%
+  if (retryAfterMs) {
+    delayMs = max(delayMs, retryAfterMs + reconnectRand() % (retryAfterMs / 2 + 1));
+    retryAfterMs = 0;
+    stormed = true;
+  }
+
+  // Token bucket
+  unsigned long refills = (now - lastTokenRefill) / RECONNECT_REFILL_MS;
+  if (refills) {
+    reconnectTokens = min((unsigned long)RECONNECT_BUCKET_SIZE, reconnectTokens + refills);
+    lastTokenRefill += refills * RECONNECT_REFILL_MS;
+  }
+  if (reconnectTokens > 0) {
+    reconnectTokens--;
+  } else {
+    unsigned long untilToken = RECONNECT_REFILL_MS - (now - lastTokenRefill);
+    delayMs = max(delayMs, untilToken + reconnectRand() % (RECONNECT_REFILL_MS / 4));
+    stormed = true;
+  }
+
+  if (stormed) stormedReconnects++;
+  return delayMs;
+}
+
+// ========= Message Builder =========
+// All outbound JSON goes through txDoc/txBuf. Values set as const char* are stored
+// by pointer, so switch names and the cached MAC are never copied.
+JsonDocument &beginMessage(const char *type) {
+  txDoc.clear();
+  txDoc["type"] = type;
+  return txDoc;
+}
+
+bool sendMessage(TxPriority prio, TxKey key) {
+  if (txDoc.overflowed()) {
+    LOGE("WS", "%s dropped: MSG_TX_DOC_SIZE too small", (const char *)(txDoc["type"] | "?"));
+    return false;
+  }
+  size_t len = serializeJson(txDoc, txBuf, sizeof(txBuf));
+  if (len >= sizeof(txBuf) - 1) {
+    LOGE("WS", "%s dropped: MSG_TX_BUF_SIZE too small", (const char *)(txDoc["type"] | "?"));
+    return false;
+  }
+  return txEnqueue(prio, key, txBuf, len, false);
+}
+
+// Binary frames (binproto.h) are small fixed structs built on the caller's stack
+bool sendBinary(const void *frame, size_t len, TxPriority prio, TxKey key) {
+  return txEnqueue(prio, key, frame, len, true);
+}
+
+// txQueueDrain() callback: the only place frames reach the socket (keepalive pings included)
+bool wsWrite(const uint8_t *data, size_t len, TxFrameType type) {
+  switch (type) {
+    case TX_FRAME_BINARY: return ws.sendBIN(data, len);
+    case TX_FRAME_PING:   return ws.sendPing((uint8_t *)data, len);
+    default:              return ws.sendTXT((const char *)data, len);
+  }
+}
+
 // ========= State / Heartbeat =========
+// Runs on netTask (drained from netQueue). Reports the relays in include plus every
+// relay changed since the server's last ack, so a lost delta is repaired by the next one.
+void sendStateDelta(uint32_t include) {
+  if (!ws.isConnected()) return;
+
+  portENTER_CRITICAL(&stateMux);
+  uint32_t seq = stateSeq;
+  uint32_t changed = include | changedSince(ackedSeq);
+  portEXIT_CRITICAL(&stateMux);
+  if (!changed) return;
+
+  if (binMode) {
+    BinDelta f;
+    binHeader(f.h, BIN_DELTA, numSwitches, seq);
+    f.epoch = stateEpoch;
+    f.base = ackedSeq;
+    f.changed = changed;
+    f.state = relayMask();
+    sendBinary(&f, sizeof(f), TX_PRIO_CONTROL, TX_KEY_STATE);
+    return;
+  }
+
+  JsonDocument &doc = beginMessage("state_update");
+  doc["seq"]     = seq;
+  doc["epoch"]   = stateEpoch;
+  doc["base"]    = ackedSeq;
+  doc["changed"] = changed;
+  JsonArray arr = doc.createNestedArray("switches");
+  int last = -1;
+  for (int i = 0; i < numSwitches; i++) {
+    if (!(changed & (1UL << i))) continue;
+    JsonObject s = arr.createNestedObject();
+    s["name"]  = (const char *)switchCfg[i].name; // stored by pointer, serialized before any config change
+    s["gpio"]  = switchCfg[i].relayPin;
+    s["state"] = relayState[i];
+    last = i;
+  }
+  if (arr.size() == 1) { // single relay: keep the flat name/gpio/state form as well
+    doc["name"]  = (const char *)switchCfg[last].name;
+    doc["gpio"]  = switchCfg[last].relayPin;
+    doc["state"] = relayState[last];
+  }
+  // A still-queued older delta is replaced: this one covers everything since ackedSeq
+  sendMessage(TX_PRIO_CONTROL, TX_KEY_STATE);
+}
+
+// Caller holds stateMux
+uint32_t changedSince(uint32_t seq) {
+  uint32_t m = 0;
+  for (int i = 0; i < numSwitches; i++) if (changeSeq[i] > seq) m |= (1UL << i);
+  return m;
+}
+
+// state_ack { seq[, stateEpoch] } / BIN_STATE_ACK: server has applied everything up to seq
+void handleStateAck(uint32_t epoch, uint32_t seq) {
+  if (epoch != stateEpoch || seq > stateSeq || seq <= ackedSeq) return;
+  ackedSeq = seq;
+}
+
+// ========= Command results =========
+// switch_command { name | gpio, state[, seq] }. With a seq (server command id) the device
+// answers with a switch_result once the relay is driven, so the server can keep several
+// commands in flight instead of waiting for state_update; without one only the delta
+// reports it, as before.
+void handleSwitchCommand(JsonDocument &doc) {
+  const char *name = doc["name"];
+  bool state = doc["state"] | false;
+  uint32_t id = doc["seq"] | 0UL;
+  int gpio = doc["gpio"] | -1;
+
+  int idx = name ? findSwitchByName(name) : -1;
+  if (idx < 0 && gpio >= 0) idx = findSwitchByGpio(gpio);
+  if (idx < 0) {
+    if (id) sendSwitchResult(id, gpio, state, false, false, 0, "unknown_gpio", false);
+    return;
+  }
+  gpio = switchCfg[idx].relayPin;
+  if (id && recentCommand(id)) { // applied already: report, do not apply again
+    dupCommands++;
+    sendSwitchResult(id, gpio, state, true, relayState[idx], 0, nullptr, true);
+    return;
+  }
+  Command c = { CMD_SET_RELAY, idx, state };
+  c.seq = id;
+  if (!enqueueCommand(c)) {
+    if (id) sendSwitchResult(id, gpio, state, false, relayState[idx], 0, "busy", false); // safe to resend
+    return;
+  }
+  if (id) {
+    recentCmdIds[recentCmdNext] = id;
+    recentCmdNext = (recentCmdNext + 1) % CMD_DEDUP_SLOTS;
+  }
+}
+
+bool recentCommand(uint32_t id) {
+  for (int k = 0; k < CMD_DEDUP_SLOTS; k++) if (recentCmdIds[k] == id) return true;
+  return false;
+}
+
+// GPIO task, after the sweep's relay write (cfgMutex held)
+void publishSwitchResults(const SwitchResult *res, int n) {
+  uint32_t written = nowUs();
+  portENTER_CRITICAL(&switchResultMux);
+  for (int k = 0; k < n; k++) {
+    int slot = (switchResultHead + switchResultCount) % SWITCH_RESULT_SLOTS;
+    if (switchResultCount == SWITCH_RESULT_SLOTS) { // oldest goes; its relay is in the next delta
+      switchResultHead = (switchResultHead + 1) % SWITCH_RESULT_SLOTS;
+      switchResultDrops++;
+    } else {
+      switchResultCount++;
+    }
+    switchResults[slot] = res[k];
+    switchResults[slot].appliedUs = written;
+    switchResults[slot].actual = relayState[res[k].idx];
+  }
+  portEXIT_CRITICAL(&switchResultMux);
+  postNetEvent(NET_SWITCH_RESULT);
+}
+
+void sendSwitchResults() {
+  for (;;) {
+    portENTER_CRITICAL(&switchResultMux);
+    if (!switchResultCount) {
+      portEXIT_CRITICAL(&switchResultMux);
+      return;
+    }
+    SwitchResult r = switchResults[switchResultHead];
+    switchResultHead = (switchResultHead + 1) % SWITCH_RESULT_SLOTS;
+    switchResultCount--;
+    portEXIT_CRITICAL(&switchResultMux);
+    if (!ws.isConnected()) continue;
+    sendSwitchResult(r.id, switchCfg[r.idx].relayPin, r.requested, true, r.actual, r.appliedUs - r.t0Us, nullptr, false);
+    latency[LAT_CMD_ACK].add(nowUs() - r.t0Us);
+  }
+}
+
+// switch_result { seq, gpio, success, requestedState, actualState, us[, reason][, dup] }
+// us: frame receipt to relay write on the device
+void sendSwitchResult(uint32_t id, int gpio, bool requested, bool success, bool actual, uint32_t us,
+                      const char *reason, bool dup) {
+  JsonDocument &doc = beginMessage("switch_result");
+  doc["seq"]            = id;
+  doc["gpio"]           = gpio;
+  doc["success"]        = success;
+  doc["requestedState"] = requested;
+  doc["actualState"]    = actual;
+  doc["us"]             = us;
+  if (reason) doc["reason"] = reason;
+  if (dup) doc["dup"] = true;
+  sendMessage();
+}
+
+// One aggregated reply per switch_command_batch with the resulting relay states
+void sendBatchAck(const NetEvent &e) {
+  if (!ws.isConnected()) return;
+
+  if (binMode) {
+    BinBatchAck f;
+    binHeader(f.h, BIN_BATCH_ACK, e.rejected, e.seq);
+    f.applied = e.mask;
+    f.state = relayMask();
+    sendBinary(&f, sizeof(f));
+    return;
+  }
+
+  JsonDocument &doc = beginMessage("switch_batch_ack");
+  doc["seq"]      = e.seq;
+  doc["rejected"] = e.rejected;
+  JsonArray arr = doc.createNestedArray("switches");
+  int applied = 0;
+  for (int i = 0; i < numSwitches; i++) {
+    if (!(e.mask & (1UL << i))) continue;
+    JsonObject s = arr.createNestedObject();
+    s["gpio"]  = switchCfg[i].relayPin;
+    s["state"] = relayState[i];
+    applied++;
+  }
+  doc["applied"] = applied;
+  sendMessage();
+}
+
+uint32_t relayMask() {
+  uint32_t m = 0;
+  for (int i = 0; i < numSwitches; i++) if (relayState[i]) m |= (1UL << i);
+  return m;
+}
+
 void sendFullState() {
   if (!ws.isConnected()) return;
 
-  DynamicJsonDocument doc(1024);
-  doc["type"] = "full_state";
-  doc["mac"]  = WiFi.macAddress();
+  portENTER_CRITICAL(&stateMux);
+  uint32_t seq = stateSeq;
+  portEXIT_CRITICAL(&stateMux);
+
+  JsonDocument &doc = beginMessage("full_state");
+  doc["mac"]  = (const char *)macStr;
+  doc["seq"]   = seq;
+  doc["epoch"] = stateEpoch;
+  doc["scheduleVersion"] = schedulerVersion(); // backend re-sends schedule_update when it differs
 
   JsonArray arr = doc.createNestedArray("switches");
-  for (int i = 0; i < MAX_SWITCHES; i++) {
+  for (int i = 0; i < numSwitches; i++) {
     JsonObject s = arr.createNestedObject();
-    s["name"]   = switchCfg[i].name;
+    s["name"]   = (const char *)switchCfg[i].name;
     s["gpio"]   = switchCfg[i].relayPin;
     s["manual"] = switchCfg[i].manualPin;
     s["state"]  = relayState[i];
   }
 
-  String out; serializeJson(doc, out);
-  ws.sendTXT(out);
-  Serial.println("[WS] full_state sent");
+  sendMessage(TX_PRIO_CONTROL, TX_KEY_FULL_STATE);
+  LOGD("WS", "full_state queued");
+}
+
+// occupancy { mac, occupied, sensors:[{gpio, occupied, motion, motions}] }: the latest
+// state of every sensor, at most once per PIR_REPORT_MIN_MS; transitions in between
+// are folded into it (motions counts motion starts since boot)
+void sendOccupancy() {
+  if (!wsAuthed || !ws.isConnected()) return;
+  unsigned long now = millis();
+  if (lastOccupancyReport && now - lastOccupancyReport < PIR_REPORT_MIN_MS) return;
+  occupancyPending = false;
+  lastOccupancyReport = now | 1;
+  uint32_t occupied = occupiedMask;
+
+  JsonDocument &doc = beginMessage("occupancy");
+  doc["mac"]      = (const char *)macStr;
+  doc["occupied"] = occupied;
+  JsonArray arr = doc.createNestedArray("sensors");
+  for (int s = 0; s < MAX_PIR_SENSORS; s++) {
+    if (pirCfg[s].pin < 0) continue;
+    JsonObject o = arr.createNestedObject();
+    o["gpio"]     = pirCfg[s].pin;
+    o["occupied"] = (bool)(occupied & (1UL << s));
+    o["motion"]   = pirMotion[s];
+    o["motions"]  = pirMotionCount[s];
+  }
+  if (!sendMessage(TX_PRIO_TELEMETRY, TX_KEY_OCCUPANCY)) occupancyPending = true; // retried after the rate limit
+}
+
+// journal { seq, boot, epoch, up, pending, events:[[dUp, kind, idx, state], ...] }
+// Records of one boot, oldest first; dUp is ms since the previous record (the first is
+// relative to up, the sender's millis() at epoch, so it is usually negative). One batch
+// is in flight at a time and it waits while commands or outbound events are queued, so
+// replay only fills idle time. A batch not acked within JOURNAL_ACK_TIMEOUT_MS goes out
+// again under a new seq, so the server may see a record twice (dedup on boot + up + idx).
+void journalReplayTick() {
+  if (!wsAuthed || !ws.isConnected()) return;
+  if (journalInFlight && millis() - journalSentMs < JOURNAL_ACK_TIMEOUT_MS) return;
+  if (uxQueueMessagesWaiting(cmdQueue) || uxQueueMessagesWaiting(netQueue) || txQueueFrames()) return;
+  JournalEvent ev[JOURNAL_BATCH];
+  JournalAnchor anchor;
+  int n = journalPeek(ev, JOURNAL_BATCH, anchor);
+  if (!n) return;
+
+  JsonDocument &doc = beginMessage("journal");
+  doc["seq"]     = ++journalSeq;
+  doc["boot"]    = anchor.boot;
+  doc["epoch"]   = anchor.epoch;
+  doc["up"]      = anchor.upMs;
+  doc["pending"] = journalPending();
+  JsonArray arr = doc.createNestedArray("events");
+  uint32_t prev = anchor.upMs;
+  for (int k = 0; k < n; k++) {
+    JsonArray e = arr.createNestedArray();
+    e.add((int32_t)(ev[k].upMs - prev));
+    e.add(ev[k].kind);
+    e.add(ev[k].idx);
+    e.add(ev[k].state);
+    prev = ev[k].upMs;
+  }
+  if (sendMessage(TX_PRIO_TELEMETRY)) {
+    journalInFlight = n;
+    journalSentMs = millis();
+  }
+}
+
+static void addLogLine(const char *line, void *ctx) {
+  ((JsonArray *)ctx)->add((char *)line); // char* makes ArduinoJson copy; line is a scratch buffer
+}
+
+// get_logs { lines } -> logs { mac, dropped, lines:[oldest..newest] }
+void sendLogs(int lines) {
+  if (!ws.isConnected()) return;
+  JsonDocument &doc = beginMessage("logs");
+  doc["mac"] = (const char *)macStr;
+  doc["dropped"] = logDropped();
+  JsonArray arr = doc.createNestedArray("lines");
+  logRecent(constrain(lines, 0, LOG_HISTORY_LINES), addLogLine, &arr);
+  sendMessage(TX_PRIO_BULK);
+}
+
+// get_metrics { reset } -> metrics: profiling counters, loop periods, stacks, heap, queues
+void sendMetrics(bool reset) {
+  if (!ws.isConnected()) return;
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  JsonDocument &doc = beginMessage("metrics");
+  doc["mac"] = (const char *)macStr;
+  doc["uptime"] = millis() / 1000;
+
+  // prof: { section: [calls, avgUs, maxUs] }
+  JsonObject prof = doc.createNestedObject("prof");
+  for (int k = 0; k < PROF_COUNT; k++) {
+    const ProfCounter &c = profCounters[k];
+    JsonArray v = prof.createNestedArray(profSectionNames[k]);
+    v.add(c.calls);
+    v.add(c.calls ? (uint32_t)(c.cycles / c.calls / mhz) : 0);
+    v.add(c.maxCycles / mhz);
+  }
+  JsonObject loops = doc.createNestedObject("loopMaxUs");
+  loops["net"] = profLoops[PROF_TASK_NET].maxPeriodUs;
+  loops["telemetry"] = profLoops[PROF_TASK_TELEMETRY].maxPeriodUs;
+
+  // Unused stack per task (bytes; FreeRTOS on ESP32 counts stack in bytes)
+  JsonObject stack = doc.createNestedObject("stackFree");
+  stack["gpio"] = uxTaskGetStackHighWaterMark(gpioTaskHandle);
+  stack["net"] = uxTaskGetStackHighWaterMark(netTaskHandle);
+  stack["telemetry"] = uxTaskGetStackHighWaterMark(telemetryTaskHandle);
+  stack["log"] = uxTaskGetStackHighWaterMark(logTaskHandle);
+
+  JsonObject heap = doc.createNestedObject("heap");
+  heap["free"] = ESP.getFreeHeap();
+  heap["min"] = ESP.getMinFreeHeap();
+  heap["largest"] = ESP.getMaxAllocHeap();
+
+  JsonObject queues = doc.createNestedObject("queues");
+  queues["cmdHwm"] = cmdQueueHwm;
+  queues["cmdDepth"] = CMD_QUEUE_DEPTH;
+  queues["cmdDrops"] = cmdDrops;
+  queues["cmdDups"] = dupCommands;
+  queues["resultDrops"] = switchResultDrops;
+  queues["netHwm"] = netQueueHwm;
+  queues["logDrops"] = logDropped();
+  queues["journalPending"] = journalPending();
+  queues["journalDrops"] = journalDropped();
+  // tx: outbound queue, drops per priority [control, telemetry, bulk]
+  TxQueueStats tx;
+  txQueueStats(tx);
+  queues["txFrames"] = tx.frames;
+  queues["txBytes"] = tx.bytes;
+  queues["txHwm"] = tx.hwmBytes;
+  JsonArray txDrops = queues.createNestedArray("txDrops");
+  for (int p = 0; p < TX_PRIO_COUNT; p++) txDrops.add(tx.drops[p]);
+  queues["txMerged"] = tx.merged;
+  queues["txSlow"] = tx.slowSends;
+
+  KeepaliveStats ka;
+  keepaliveStats(ka);
+  JsonObject keep = doc.createNestedObject("keepalive");
+  keep["heartbeatMs"] = ka.heartbeatMs;
+  keep["pingMs"] = ka.pingMs;
+  keep["rttMs"] = ka.rttMs;
+  keep["awakeRttMs"] = ka.awakeRttMs;
+  keep["sleepAddedMs"] = ka.sleepAddedMs;
+  keep["sleeping"] = ka.sleeping;
+  keep["heartbeats"] = ka.heartbeats;
+  keep["pings"] = ka.pings;
+  keep["pongs"] = ka.pongs;
+  keep["sleepBackoffs"] = ka.sleepBackoffs;
+  sendMessage(TX_PRIO_TELEMETRY);
+
+  if (reset) {
+    // Other tasks may be mid-update; a lost sample only affects this window
+    memset(profCounters, 0, sizeof(profCounters));
+    for (int t = 0; t < PROF_TASK_COUNT; t++) profLoops[t].maxPeriodUs = 0;
+    cmdQueueHwm = 0;
+    netQueueHwm = 0;
+    txQueueResetHwm();
+  }
 }
 
 void logLastError() {
   // Log the last WebSocket error
-  Serial.printf("[WS] Error details: Connection state: %d, WiFi status: %d\n", 
-                connState, WiFi.status());
-  Serial.printf("[WS] Network info: IP: %s, RSSI: %d dBm\n", 
+  LOGE("WS", "Error details: Connection state: %d, WiFi: %s",
+                connState, wifiManagerStateName(wifiManagerState()));
+  LOGE("WS", "Network info: IP: %s, RSSI: %d dBm", 
                 WiFi.localIP().toString().c_str(), WiFi.RSSI());
 }
 
+// Net task, every pass: the heartbeat or ping that is due, dead link detection, radio power
+void keepaliveService() {
+  uint32_t now = millis();
+  bool sleep = keepaliveSleep(now, otaBusy()); // downloads run at full speed
+  static int8_t appliedSleep = -1;
+  if (sleep != appliedSleep) {
+    WiFi.setSleep(sleep ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE); // wake for every DTIM beacon
+    appliedSleep = sleep;
+  }
+  if (!wsAuthed || !ws.isConnected()) return;
+  switch (keepaliveTick(now)) {
+    case KEEPALIVE_HEARTBEAT:
+      sendHeartbeat();
+      keepaliveSent(KEEPALIVE_HEARTBEAT, now);
+      break;
+    case KEEPALIVE_PING:
+      if (sendKeepalivePing()) keepaliveSent(KEEPALIVE_PING, now); // else retried next pass
+      break;
+    case KEEPALIVE_DEAD:
+      ws.disconnect(); // reconnects through the normal backoff
+      break;
+    case KEEPALIVE_NONE:
+      break;
+  }
+}
+
+// Ping carrying BinPing telemetry; the backend reads it as a lightweight heartbeat.
+// Queued at control priority and written by the drain at the end of this pass.
+bool sendKeepalivePing() {
+  static uint16_t pingSeq = 0;
+  KeepaliveStats ka;
+  keepaliveStats(ka);
+  BinPing p = {};
+  binHeader(p.h, BIN_PING, numSwitches, ++pingSeq);
+  p.uptime = millis() / 1000;
+  p.rssi = WiFi.RSSI();
+  p.flags = (ka.sleeping ? BIN_PING_SLEEP : 0) | (ka.active ? BIN_PING_ACTIVE : 0);
+  p.heapKb = (uint16_t)min(ESP.getFreeHeap() / 1024, (uint32_t)0xFFFF);
+  for (int i = 0; i < numSwitches; i++) if (relayState[i]) p.relays |= 1UL << i;
+  p.rttMs = (uint16_t)min(ka.rttMs, (uint32_t)0xFFFF);
+  p.heartbeatS = ka.heartbeatMs / 1000;
+  return txEnqueuePing(&p, sizeof(p));
+}
+
+// keepalive { pingMs, heartbeatMs } from the backend (also inside auth_success); clamped
+void applyKeepaliveHint(JsonVariant hint) {
+  if (hint.isNull()) return;
+  keepaliveHint(hint["pingMs"] | 0UL, hint["heartbeatMs"] | 0UL);
+}
+
+// Runs right after the state_update / batch ack for e was queued; control frames are
+// written at the end of the same pass unless TCP is backed up
+void recordAckLatency(const NetEvent &e) {
+  if (!ws.isConnected()) return;
+  uint32_t sent = nowUs();
+  if (e.remoteT0) latency[LAT_CMD_ACK].add(sent - e.remoteT0);
+  if (e.manualT0) latency[LAT_MANUAL_ACK].add(sent - e.manualT0);
+}
+
+static uint16_t latencyUnits(uint32_t us) { return (uint16_t)min(us / 100, (uint32_t)0xFFFF); }
+
 void sendHeartbeat() {
-  unsigned long now = millis();
   if (!ws.isConnected()) return;
-  if (now - lastHeartbeat < HEARTBEAT_INTERVAL_MS) return;
-  lastHeartbeat = now;
+  PROFILE(PROF_HEARTBEAT);
 
-  DynamicJsonDocument doc(256);
-  doc["type"] = "heartbeat";
-  doc["mac"]  = WiFi.macAddress();
+  // Latency covers the interval since the previous heartbeat
+  static LatencyHist window[LAT_COUNT];
+  memcpy(window, latency, sizeof(window));
+  memset(latency, 0, sizeof(latency));
+
+  if (binMode) {
+    struct __attribute__((packed)) {
+      BinHeartbeat hb;
+      BinLatency lat[LAT_COUNT];
+    } frame = {};
+    BinHeartbeat &f = frame.hb;
+    binHeader(f.h, BIN_HEARTBEAT, LAT_COUNT, 0);
+    f.uptime = millis() / 1000;
+    f.rssi = WiFi.RSSI();
+    f.storms = (uint16_t)min(stormedReconnects, (uint32_t)0xFFFF);
+    f.tls10ms = (uint8_t)min(tlsHandshakeMs / 10, (uint32_t)0xFF);
+    f.freeHeap = ESP.getFreeHeap();
+    for (int k = 0; k < LAT_COUNT; k++) {
+      frame.lat[k].count = (uint16_t)min(window[k].count, (uint32_t)0xFFFF);
+      frame.lat[k].p50 = latencyUnits(window[k].percentile(50));
+      frame.lat[k].p99 = latencyUnits(window[k].percentile(99));
+      frame.lat[k].max = latencyUnits(window[k].maxUs);
+    }
+    sendBinary(&frame, sizeof(frame), TX_PRIO_TELEMETRY);
+    return;
+  }
+
+  JsonDocument &doc = beginMessage("heartbeat");
+  doc["mac"]  = (const char *)macStr;
   doc["uptime"] = millis() / 1000; // Add uptime in seconds
   doc["rssi"] = WiFi.RSSI(); // Add signal strength
-  String out; serializeJson(doc, out);
-  ws.sendTXT(out);
+  doc["wifiMs"] = wifiManagerLastConnectMs(); // last (re)connect: first join attempt -> IP
+  doc["roams"] = wifiManagerRoams();
+  doc["storms"] = stormedReconnects;
+  JsonObject tls = doc.createNestedObject("tls");
+  tls["ms"] = tlsHandshakeMs;
+  tls["maxMs"] = tlsHandshakeMaxMs;
+  tls["heap"] = tlsHeapCost;
+  doc["heapMax"] = ESP.getMaxAllocHeap();   // fragmentation: largest allocatable block
+  doc["loopMaxUs"] = profLoops[PROF_TASK_NET].maxPeriodUs;
+  doc["cmdQHwm"] = cmdQueueHwm;
+  // lat: { stage: [count, p50, p99, max] } in us, stages with samples only
+  JsonObject lat = doc.createNestedObject("lat");
+  for (int k = 0; k < LAT_COUNT; k++) {
+    if (!window[k].count) continue;
+    JsonArray v = lat.createNestedArray(latencyStageNames[k]);
+    v.add(window[k].count);
+    v.add(window[k].percentile(50));
+    v.add(window[k].percentile(99));
+    v.add(window[k].maxUs);
+  }
+  sendMessage(TX_PRIO_TELEMETRY);
 }
 
 // ========= LED Patterns =========
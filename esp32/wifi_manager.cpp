@@ -0,0 +1,392 @@
+#include "wifi_manager.h"
+#include <WiFi.h>
+#include <Preferences.h>
+#include <time.h>
+#include "logger.h"
+
+// ========= Events =========
+// The Arduino event task only copies what it needs into the queue; every
+// WiFi.* call that changes the radio happens on the net task.
+enum WifiEventId : uint8_t { WEV_CONNECTED, WEV_DISCONNECTED, WEV_GOT_IP, WEV_LOST_IP, WEV_SCAN_DONE };
+
+struct WifiEvent {
+  WifiEventId id;
+  uint8_t reason;       // WEV_DISCONNECTED: wifi_err_reason_t
+  uint32_t ip, gw, mask;
+};
+
+static QueueHandle_t wifiEvents = nullptr;
+
+static void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  WifiEvent e = {};
+  switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_CONNECTED:    e.id = WEV_CONNECTED; break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      e.id = WEV_DISCONNECTED;
+      e.reason = info.wifi_sta_disconnected.reason;
+      break;
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+      e.id = WEV_GOT_IP;
+      e.ip = info.got_ip.ip_info.ip.addr;
+      e.gw = info.got_ip.ip_info.gw.addr;
+      e.mask = info.got_ip.ip_info.netmask.addr;
+      break;
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:      e.id = WEV_LOST_IP; break;
+    case ARDUINO_EVENT_WIFI_SCAN_DONE:        e.id = WEV_SCAN_DONE; break;
+    default: return;
+  }
+  xQueueSend(wifiEvents, &e, 0);
+}
+
+// ========= AP cache (NVS) =========
+#define WIFI_CACHE_NS      "wificache"
+#define WIFI_CACHE_KEY     "ap"
+#define WIFI_CACHE_MAGIC   0xA9C1
+#define WIFI_CACHE_VERSION 2
+
+struct __attribute__((packed)) WifiCache {
+  uint16_t magic;
+  uint8_t  version;
+  uint8_t  channel;
+  uint32_t ssidHash;   // network the entry belongs to; a changed wifiNetworks list invalidates it
+  uint8_t  bssid[6];
+  uint32_t ip, gw, mask, dns;  // last DHCP lease (0 = none)
+  uint32_t leaseEpoch; // wall clock when DHCP granted it, 0 = clock was not set
+  uint8_t  staticJoins;  // joins on the lease as static IP since DHCP last handed it out
+  uint8_t  reserved[3];
+};
+
+static WifiCache cache = {};        // net task; valid when magic matches
+static WifiCache cacheOut = {};     // copy handed to the telemetry task
+static volatile bool cacheDirty = false;
+static portMUX_TYPE cacheMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t ssidHash(const char *s) {
+  uint32_t h = 2166136261UL;
+  while (*s) { h ^= (uint8_t)*s++; h *= 16777619UL; }
+  return h;
+}
+
+static int cachedNetwork() {
+  if (cache.magic != WIFI_CACHE_MAGIC || cache.version != WIFI_CACHE_VERSION) return -1;
+  for (int k = 0; k < (int)WIFI_NETWORK_COUNT; k++) {
+    if (ssidHash(wifiNetworks[k].ssid) == cache.ssidHash) return k;
+  }
+  return -1;
+}
+
+static void cachePublish() {
+  portENTER_CRITICAL(&cacheMux);
+  cacheOut = cache;
+  cacheDirty = true;
+  portEXIT_CRITICAL(&cacheMux);
+}
+
+// lease = nullptr: the join reused the cached lease, which keeps its DHCP time
+static void cacheStore(int net, const uint8_t *bssid, uint8_t channel, const WifiCache *lease) {
+  WifiCache c = {};
+  c.magic = WIFI_CACHE_MAGIC;
+  c.version = WIFI_CACHE_VERSION;
+  c.channel = channel;
+  c.ssidHash = ssidHash(wifiNetworks[net].ssid);
+  memcpy(c.bssid, bssid, 6);
+  if (!lease) lease = &cache;
+  c.ip = lease->ip; c.gw = lease->gw; c.mask = lease->mask; c.dns = lease->dns;
+  c.leaseEpoch = lease->leaseEpoch;
+  c.staticJoins = lease->staticJoins;
+  if (!memcmp(&c, &cache, sizeof(c))) return; // same AP and lease: no flash write
+  cache = c;
+  cachePublish();
+}
+
+// The cached lease may still be ours: younger than WIFI_CACHE_IP_MAX_AGE_S where the
+// clock can tell, and reused at most WIFI_CACHE_IP_MAX_JOINS times without DHCP
+// confirming it (the only bound after a power cut, when the clock is not set yet;
+// a lease granted then is dated once SNTP sets it, see wifiManagerTick)
+static bool leaseReusable() {
+  if (!cache.ip || cache.staticJoins >= WIFI_CACHE_IP_MAX_JOINS) return false;
+  time_t now = time(nullptr);
+  if (!cache.leaseEpoch || now < SCHEDULE_MIN_EPOCH) return true;
+  return (uint32_t)now >= cache.leaseEpoch && (uint32_t)now - cache.leaseEpoch < WIFI_CACHE_IP_MAX_AGE_S;
+}
+
+void wifiManagerCommit() {
+  if (!cacheDirty) return;
+  WifiCache c;
+  portENTER_CRITICAL(&cacheMux);
+  c = cacheOut;
+  cacheDirty = false;
+  portEXIT_CRITICAL(&cacheMux);
+  Preferences p;
+  p.begin(WIFI_CACHE_NS, false);
+  p.putBytes(WIFI_CACHE_KEY, &c, sizeof(c));
+  p.end();
+}
+
+// ========= State machine =========
+static WifiState state = WIFI_STATE_IDLE;
+static volatile bool linkUp = false;
+static unsigned long stateSince = 0;
+static unsigned long attemptStart = 0;     // first join attempt of this outage
+static unsigned long retryAt = 0;
+static unsigned long lastRoamCheck = 0;
+static uint8_t failedRounds = 0;
+static bool roamScan = false;              // scan started while connected
+static int curNet = -1;                    // wifiNetworks index being joined / joined
+static uint8_t curBssid[6];
+static uint8_t curChannel = 0;
+static uint32_t lastConnectMs = 0;
+static bool staticJoin = false;            // joining / joined on the cached lease
+static unsigned long leaseMs = 0;          // when DHCP last granted the lease in use
+static uint32_t roams = 0;
+
+static void enter(WifiState s) {
+  state = s;
+  stateSince = millis();
+  linkUp = (s == WIFI_STATE_CONNECTED);
+}
+
+static void join(int net, const uint8_t *bssid, uint8_t channel, bool fast) {
+  curNet = net;
+  memcpy(curBssid, bssid, 6);
+  curChannel = channel;
+#if WIFI_CACHE_IP
+  staticJoin = fast && leaseReusable();
+  if (staticJoin) {
+    // Reuse the last lease; the router normally still holds it for this MAC
+    cache.staticJoins++;
+    cachePublish(); // the budget must survive a reboot mid-join
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gw), IPAddress(cache.mask), IPAddress(cache.dns));
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // back to DHCP
+  }
+#endif
+  WiFi.begin(wifiNetworks[net].ssid, wifiNetworks[net].password, channel, bssid, true);
+  enter(fast ? WIFI_STATE_FAST_CONNECT : WIFI_STATE_CONNECTING);
+  LOGI("WiFi", "Joining %s %02X:%02X:%02X:%02X:%02X:%02X ch %u%s", wifiNetworks[net].ssid,
+       bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5], channel, fast ? " (cached)" : "");
+}
+
+static void startScan() {
+  // Async: WEV_SCAN_DONE arrives when all channels are done (~120 ms each)
+  if (WiFi.scanNetworks(true, false, false, 120) == WIFI_SCAN_FAILED) {
+    LOGW("WiFi", "Scan failed to start");
+    roamScan = false;
+    if (state != WIFI_STATE_CONNECTED) {
+      retryAt = millis() + WIFI_RETRY_INTERVAL_MS;
+      enter(WIFI_STATE_BACKOFF);
+    }
+    return;
+  }
+  if (state != WIFI_STATE_CONNECTED) enter(WIFI_STATE_SCANNING);
+}
+
+static void backoff() {
+  if (failedRounds < 4) failedRounds++;
+  unsigned long wait = (unsigned long)WIFI_RETRY_INTERVAL_MS << (failedRounds - 1);
+  retryAt = millis() + wait;
+  enter(WIFI_STATE_BACKOFF);
+  LOGW("WiFi", "No usable AP, rescanning in %lu ms", wait);
+}
+
+// Strongest scanned AP of any configured network; false if none was seen
+static bool bestScanned(int &net, uint8_t *bssid, uint8_t &channel, int &rssi) {
+  int n = WiFi.scanComplete();
+  bool found = false;
+  for (int i = 0; i < n; i++) {
+    String ssid = WiFi.SSID(i);
+    for (int k = 0; k < (int)WIFI_NETWORK_COUNT; k++) {
+      if (ssid != wifiNetworks[k].ssid) continue;
+      int r = WiFi.RSSI(i);
+      if (!found || r > rssi) {
+        found = true;
+        net = k;
+        rssi = r;
+        channel = WiFi.channel(i);
+        memcpy(bssid, WiFi.BSSID(i), 6);
+      }
+    }
+  }
+  WiFi.scanDelete();
+  return found;
+}
+
+static void onScanDone() {
+  int net = -1, rssi = -127;
+  uint8_t bssid[6] = {}, channel = 0;
+  bool found = bestScanned(net, bssid, channel, rssi);
+  if (roamScan) {
+    roamScan = false;
+    if (state != WIFI_STATE_CONNECTED || !found) return;
+    int cur = WiFi.RSSI();
+    if (memcmp(bssid, curBssid, 6) && rssi >= cur + WIFI_ROAM_HYSTERESIS_DB) {
+      LOGI("WiFi", "Roaming from %d dBm to %s at %d dBm", cur, wifiNetworks[net].ssid, rssi);
+      roams++;
+      attemptStart = millis();
+      join(net, bssid, channel, false);
+    }
+    return;
+  }
+  if (state != WIFI_STATE_SCANNING) return;
+  if (!found) { backoff(); return; }
+  join(net, bssid, channel, false);
+}
+
+static void onGotIp(const WifiEvent &e) {
+  if (state == WIFI_STATE_CONNECTED) return;
+  bool fast = (state == WIFI_STATE_FAST_CONNECT);
+  lastConnectMs = millis() - attemptStart;
+  failedRounds = 0;
+  lastRoamCheck = millis();
+  enter(WIFI_STATE_CONNECTED);
+  // Cache what the driver actually joined (a scan join may have been re-targeted)
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid) memcpy(curBssid, bssid, 6);
+  curChannel = WiFi.channel();
+  if (staticJoin) {
+    cacheStore(curNet, curBssid, curChannel, nullptr); // not a new lease: its age and join count stand
+  } else {
+    WifiCache lease = {};
+    lease.ip = e.ip; lease.gw = e.gw; lease.mask = e.mask; lease.dns = (uint32_t)WiFi.dnsIP();
+    time_t now = time(nullptr);
+    lease.leaseEpoch = now >= SCHEDULE_MIN_EPOCH ? (uint32_t)now : 0;
+    leaseMs = millis();
+    cacheStore(curNet, curBssid, curChannel, &lease);
+  }
+  LOGI("WiFi", "Connected to %s ch %u, %d dBm, IP %s in %lu ms%s", wifiNetworks[curNet].ssid, curChannel,
+       WiFi.RSSI(), WiFi.localIP().toString().c_str(), (unsigned long)lastConnectMs,
+       staticJoin ? " (fast path, cached IP)" : fast ? " (fast path)" : "");
+}
+
+static void onLinkLost(uint8_t reason) {
+  switch (state) {
+    case WIFI_STATE_CONNECTED:
+      // Straight back to the same AP; a scan only if that fails
+      LOGW("WiFi", "Link lost (reason %u)", reason);
+      attemptStart = millis();
+      join(curNet, curBssid, curChannel, true);
+      break;
+    case WIFI_STATE_FAST_CONNECT:
+      LOGW("WiFi", "Cached AP failed (reason %u), scanning", reason);
+      cache.magic = 0; // RAM only; the next successful join overwrites NVS
+      startScan();
+      break;
+    case WIFI_STATE_CONNECTING:
+      LOGW("WiFi", "Join failed (reason %u)", reason);
+      backoff();
+      break;
+    default:
+      break;
+  }
+}
+
+void wifiManagerBegin() {
+  if (!wifiEvents) wifiEvents = xQueueCreate(8, sizeof(WifiEvent)); // once per boot; the simulator reboots
+  Preferences p;
+  p.begin(WIFI_CACHE_NS, true);
+  if (p.getBytes(WIFI_CACHE_KEY, &cache, sizeof(cache)) != sizeof(cache)) cache = WifiCache{};
+  p.end();
+
+  WiFi.persistent(false);       // credentials come from config.h; no NVS write per begin()
+  WiFi.setAutoReconnect(false); // reconnects are driven from the events below
+  WiFi.mode(WIFI_STA);
+  WiFi.onEvent(onWifiEvent);
+
+  attemptStart = millis();
+  int net = cachedNetwork();
+  if (net >= 0) join(net, cache.bssid, cache.channel, true);
+  else startScan();
+}
+
+void wifiManagerTick() {
+  WifiEvent e;
+  while (xQueueReceive(wifiEvents, &e, 0)) {
+    switch (e.id) {
+      case WEV_GOT_IP:    onGotIp(e); break;
+      case WEV_SCAN_DONE: onScanDone(); break;
+      case WEV_LOST_IP:   onLinkLost(0); break;
+      case WEV_DISCONNECTED:
+        // Leaving the old AP ourselves (roam, re-join) is not a failure of the new attempt
+        if (e.reason == WIFI_REASON_ASSOC_LEAVE && state != WIFI_STATE_CONNECTED) break;
+        onLinkLost(e.reason);
+        break;
+      case WEV_CONNECTED: break; // IP (cached or DHCP) follows
+    }
+  }
+
+  // Timeouts and timers; nothing here talks to the radio unless a deadline passed
+  unsigned long now = millis();
+  switch (state) {
+    case WIFI_STATE_FAST_CONNECT:
+      if (now - stateSince > WIFI_FAST_TIMEOUT_MS) {
+        LOGW("WiFi", "Cached AP timed out, scanning");
+        cache.magic = 0;
+        WiFi.disconnect(false);
+        startScan();
+      }
+      break;
+    case WIFI_STATE_CONNECTING:
+      if (now - stateSince > WIFI_CONNECT_TIMEOUT_MS) {
+        WiFi.disconnect(false);
+        backoff();
+      }
+      break;
+    case WIFI_STATE_SCANNING:
+      if (now - stateSince > WIFI_SCAN_TIMEOUT_MS) {
+        WiFi.scanDelete();
+        backoff();
+      }
+      break;
+    case WIFI_STATE_BACKOFF:
+      if ((long)(now - retryAt) >= 0) startScan();
+      break;
+    case WIFI_STATE_CONNECTED:
+#if WIFI_CACHE_IP
+      // Lease from DHCP before the clock was set: date it now, as of when it was granted
+      if (!staticJoin && cache.ip && !cache.leaseEpoch && time(nullptr) >= SCHEDULE_MIN_EPOCH) {
+        cache.leaseEpoch = (uint32_t)time(nullptr) - (now - leaseMs) / 1000;
+        cachePublish();
+      }
+#endif
+      if (!roamScan && now - lastRoamCheck > WIFI_ROAM_CHECK_MS) {
+        lastRoamCheck = now;
+        if (WiFi.RSSI() < WIFI_ROAM_RSSI) {
+          roamScan = true;
+          startScan();
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void wifiManagerUplinkFailed() {
+#if WIFI_CACHE_IP
+  if (state != WIFI_STATE_CONNECTED || !staticJoin) return;
+  // The lease may have gone to another host; drop it and ask DHCP
+  LOGW("WiFi", "Backend unreachable on the cached IP, rejoining with DHCP");
+  cache.ip = 0;
+  cachePublish();
+  attemptStart = millis();
+  WiFi.disconnect(false);
+  join(curNet, curBssid, curChannel, false);
+#endif
+}
+
+bool wifiManagerConnected() { return linkUp; }
+WifiState wifiManagerState() { return state; }
+uint32_t wifiManagerLastConnectMs() { return lastConnectMs; }
+uint32_t wifiManagerRoams() { return roams; }
+
+const char *wifiManagerStateName(WifiState s) {
+  switch (s) {
+    case WIFI_STATE_IDLE:         return "idle";
+    case WIFI_STATE_FAST_CONNECT: return "fast";
+    case WIFI_STATE_SCANNING:     return "scan";
+    case WIFI_STATE_CONNECTING:   return "join";
+    case WIFI_STATE_CONNECTED:    return "up";
+    case WIFI_STATE_BACKOFF:      return "backoff";
+  }
+  return "?";
+}
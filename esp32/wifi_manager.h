@@ -0,0 +1,43 @@
+#ifndef WIFI_MANAGER_H
+#define WIFI_MANAGER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ---------------- WiFi connection manager ----------------
+// Event driven: WiFi.onEvent() forwards STA/scan events into a queue and
+// wifiManagerTick() (net task) runs the state machine from them, so nobody
+// polls WiFi.status() or tears an association down on a timer.
+//
+// Boot / link loss first retries the AP that worked last time (BSSID + channel
+// cached in NVS, optionally the DHCP lease as static IP), which skips the scan
+// and DHCP. The lease is reused only while it is young enough and for a few joins
+// (WIFI_CACHE_IP_MAX_AGE_S / _MAX_JOINS), and dropped when the backend cannot be
+// reached on it. If that fails within WIFI_FAST_TIMEOUT_MS, an async scan picks the
+// strongest AP of any configured network (wifiNetworks, config.h). While
+// connected, a weak link (< WIFI_ROAM_RSSI) triggers a background scan and
+// roams to a configured AP at least WIFI_ROAM_HYSTERESIS_DB stronger.
+//
+// wifiManagerBegin() from setup(), wifiManagerTick() / wifiManagerUplinkFailed() only
+// from the net task, wifiManagerCommit() only from the telemetry task (NVS writes).
+
+enum WifiState : uint8_t {
+  WIFI_STATE_IDLE,
+  WIFI_STATE_FAST_CONNECT,  // joining the cached AP directly
+  WIFI_STATE_SCANNING,
+  WIFI_STATE_CONNECTING,    // joining the AP picked from a scan
+  WIFI_STATE_CONNECTED,     // associated and IP assigned
+  WIFI_STATE_BACKOFF,       // nothing found / join failed, next scan at retry time
+};
+
+void wifiManagerBegin();
+void wifiManagerTick();
+void wifiManagerCommit();            // persist a changed AP cache
+void wifiManagerUplinkFailed();      // backend connects keep failing: rejoin with DHCP if on the cached IP
+bool wifiManagerConnected();         // safe from any task
+WifiState wifiManagerState();
+uint32_t wifiManagerLastConnectMs(); // attempt start -> IP for the last connect
+uint32_t wifiManagerRoams();
+const char *wifiManagerStateName(WifiState s);
+
+#endif